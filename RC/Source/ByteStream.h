@@ -0,0 +1,81 @@
+
+
+
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+
+/* Byte streams
+ * What the binary formats (lookup tables, compiled circuits) are written with. Values go in with a plain
+ * memcpy, so a file only makes sense to a machine with the same endianness and float layout, which is
+ * fine for caches and for things shipped next to the plugin binary.
+ */
+class ByteWriter {
+
+public:
+    explicit ByteWriter(std::vector<unsigned char>& destination) : out(destination) {}
+
+    template <typename T>
+    void put(const T* p, std::size_t n){
+        static_assert(std::is_trivially_copyable<T>::value, "ByteWriter: plain data only");
+        const auto* bytes = reinterpret_cast<const unsigned char*>(p);
+        out.insert(out.end(), bytes, bytes + n * sizeof(T));
+    }
+
+    template <typename T>
+    void put(const T& v) { put(&v, 1); }
+
+    //zero padding up to a multiple of alignment from the start of the stream
+    void align(std::size_t alignment) { out.resize((out.size() + alignment - 1)/alignment * alignment, 0); }
+
+    std::size_t size() const { return out.size(); }
+
+private:
+    std::vector<unsigned char>& out;
+};
+
+
+//bounds checked, every get() is false (and reads nothing) once the data runs out
+class ByteReader {
+
+public:
+    ByteReader(const void* data, std::size_t size) : start(static_cast<const unsigned char*>(data)), p(start), left(size) {}
+
+    template <typename T>
+    bool get(T* out, std::size_t n){
+        static_assert(std::is_trivially_copyable<T>::value, "ByteReader: plain data only");
+        if(n > left/sizeof(T))
+            return false;
+        std::memcpy(out, p, n * sizeof(T));
+        p += n * sizeof(T);
+        left -= n * sizeof(T);
+        return true;
+    }
+
+    template <typename T>
+    bool get(T& v) { return get(&v, 1); }
+
+    bool align(std::size_t alignment){
+        const std::size_t offset = static_cast<std::size_t>(p - start);
+        return skip((offset + alignment - 1)/alignment * alignment - offset);
+    }
+
+    bool skip(std::size_t n){
+        if(n > left)
+            return false;
+        p += n;
+        left -= n;
+        return true;
+    }
+
+    const unsigned char* position() const { return p; }
+    std::size_t remaining() const { return left; }
+
+private:
+    const unsigned char* start;
+    const unsigned char* p;
+    std::size_t left;
+};
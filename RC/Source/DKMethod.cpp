@@ -1,10 +1,14 @@
 
 
 #include "DKMethod.h"
+#include <cmath>
 
 
 float DKMethod::process_sample(float n){
-    float Vout = (n * (R/(R + Z))) + (X * (R/(R + Z)));
+    if(noise_on)
+        n += noise_sigma * noise.next()[0];
+    //node equation (n - Vout)/R = Vout/Z - X with the cap as a 1/Z conductance and X its history current
+    float Vout = (n + R*X) * (Z/(R + Z));
     X = ((2/Z)*Vout) - X;
     return Vout;
 }
@@ -15,6 +19,13 @@ void DKMethod::prepare (float newFs){
         fs = newFs;
         update_coefficients();
     }
+    reset();
+}
+
+
+//at rest the cap has charged up to the input and X = (2/Z) Vout - X leaves X = Vout/Z
+void DKMethod::reset(float input){
+    X = input/Z;
 }
 
 
@@ -30,6 +41,14 @@ void DKMethod::setKnobs(float res, float cap){
     }
 }
 
+void DKMethod::set_noise(bool enabled, float temp){
+    noise_on = enabled;
+    temperature = temp;
+    noise.prepare(1);
+    update_coefficients();
+}
+
 void DKMethod::update_coefficients(){
     Z = 1/(2* fs * C);
+    noise_sigma = std::sqrt(noise::thermal_voltage_variance(R, temperature, fs));
 }
@@ -1,6 +1,7 @@
 
 
 #pragma once
+#include "Noise.h"
 
 
 class DKMethod {
@@ -8,17 +9,25 @@ class DKMethod {
 public:
     
     float process_sample(float x);
-    void prepare (float newFs);
+    void prepare (float newFs); //also resets
+    void reset(float input = 0.0f); //state already settled on a constant input
     void setKnobs(float res, float cap);
+    void set_noise(bool enabled, float temperature = 300.0f); //thermal noise of R, not realtime safe
     
 private:
     
     void update_coefficients();
     
     float R = 10000.0f;
-    float C = 10000.0f;
+    float C = 10e-9f;
     float X = 0.0f;
     float fs = 44100.f;
     float Z = 1/(2* fs * C);
+
+    //noise of R is a voltage in series with it, which is the same as adding it to the input
+    bool noise_on = false;
+    float temperature = 300.0f;
+    float noise_sigma = 0.0f;
+    NoiseBlock noise;
     
 };
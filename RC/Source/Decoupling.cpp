@@ -0,0 +1,357 @@
+
+#include "Decoupling.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+
+DecoupledMNA::DecoupledMNA(const Netlist& circuit, const std::vector<int>& cut_nodes, int line_delay,
+                           int num_threads, float default_impedance)
+    : original(circuit), delay(std::max(1, line_delay)), default_Z(default_impedance){
+    split(cut_nodes);
+    seg_in.assign(delay, 0.0f);
+
+    if(num_threads <= 0)
+        num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    num_threads = std::min(num_threads, num_subcircuits());
+    if(delay < min_parallel_block)
+        num_threads = 1; //a handoff per segment would cost more than the segment, see the header
+
+    //the calling thread is worker 0
+    for(int w = 1; w < num_threads; ++w)
+        workers.emplace_back(&DecoupledMNA::worker_loop, this, w);
+}
+
+
+DecoupledMNA::~DecoupledMNA(){
+    running.store(false);
+    generation.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    wake.notify_all();
+    for(auto& t : workers)
+        t.join();
+}
+
+
+void DecoupledMNA::split(const std::vector<int>& cut_nodes){
+    const int nn = original.num_nodes();
+    const int ne = original.num_elements();
+
+    std::vector<bool> is_cut(nn, false);
+    for(int c : cut_nodes){
+        if(c <= 0 || c >= nn)
+            throw std::invalid_argument("DecoupledMNA: cut node out of range");
+        is_cut[c] = true;
+    }
+    auto plain = [&](int n){ return n != 0 && !is_cut[n]; };
+
+    //union find over everything that isn't ground or a cut
+    std::vector<int> parent(nn);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&](int n){
+        while(parent[n] != n){
+            parent[n] = parent[parent[n]];
+            n = parent[n];
+        }
+        return n;
+    };
+    for(int i = 0; i < ne; ++i){
+        const Element& e = original.element(i);
+        if(plain(e.n1) && plain(e.n2))
+            parent[root(e.n1)] = root(e.n2);
+    }
+
+    //a capacitor from a cut node to ground becomes the line itself
+    lines.assign(cut_nodes.size(), Line{});
+    std::vector<bool> absorbed(ne, false);
+    for(std::size_t l = 0; l < cut_nodes.size(); ++l){
+        for(int i = 0; i < ne; ++i){
+            const Element& e = original.element(i);
+            if(e.type == ElementType::Capacitor && !absorbed[i]
+               && ((e.n1 == cut_nodes[l] && e.n2 == 0) || (e.n2 == cut_nodes[l] && e.n1 == 0))){
+                absorbed[i] = true;
+                lines[l].absorbed_cap = i;
+                break;
+            }
+        }
+    }
+
+    //hand every element to a subcircuit
+    std::vector<int> comp_of_root(nn, -1);
+    std::vector<int> owner(ne, -1);
+    int n_comp = 0;
+    for(int i = 0; i < ne; ++i){
+        const Element& e = original.element(i);
+        if(absorbed[i])
+            continue;
+        const int end = plain(e.n1) ? e.n1 : (plain(e.n2) ? e.n2 : -1);
+        if(end < 0)
+            continue;
+        const int r = root(end);
+        if(comp_of_root[r] < 0)
+            comp_of_root[r] = n_comp++;
+        owner[i] = comp_of_root[r];
+    }
+
+    //elements hanging only between cuts and ground join whoever already sits on their cut
+    auto side_touching = [&](int node){
+        for(int i = 0; i < ne; ++i){
+            const Element& e = original.element(i);
+            if(owner[i] >= 0 && (e.n1 == node || e.n2 == node))
+                return owner[i];
+        }
+        return -1;
+    };
+    for(int i = 0; i < ne; ++i){
+        const Element& e = original.element(i);
+        if(absorbed[i] || owner[i] >= 0)
+            continue;
+        owner[i] = is_cut[e.n1] ? side_touching(e.n1) : -1;
+        if(owner[i] < 0 && is_cut[e.n2])
+            owner[i] = side_touching(e.n2);
+        if(owner[i] < 0)
+            throw std::invalid_argument("DecoupledMNA: element isn't attached to any subcircuit");
+    }
+
+    std::vector<Netlist> nets(n_comp);
+    std::vector<std::vector<int>> local(n_comp, std::vector<int>(nn, -1));
+    auto local_node = [&](int k, int n){
+        if(n == 0)
+            return 0;
+        if(local[k][n] < 0)
+            local[k][n] = nets[k].add_node();
+        return local[k][n];
+    };
+    for(int i = 0; i < ne; ++i){
+        if(owner[i] < 0)
+            continue;
+        const Element& e = original.element(i);
+        const int k = owner[i];
+        const int n1 = local_node(k, e.n1);
+        const int n2 = local_node(k, e.n2);
+        nets[k].add_copy(e, n1, n2);
+    }
+
+    //one line per cut, with a port on each side
+    ports.clear();
+    ports_of_sub.assign(n_comp, {});
+    for(std::size_t l = 0; l < cut_nodes.size(); ++l){
+        const int c = cut_nodes[l];
+        int sides[2] = {-1, -1};
+        int n_sides = 0;
+        for(int k = 0; k < n_comp; ++k){
+            if(local[k][c] < 0)
+                continue;
+            if(n_sides == 2)
+                throw std::invalid_argument("DecoupledMNA: a cut node has to separate exactly two subcircuits");
+            sides[n_sides++] = k;
+        }
+        if(n_sides != 2)
+            throw std::invalid_argument("DecoupledMNA: a cut node has to separate exactly two subcircuits");
+
+        for(int side = 0; side < 2; ++side){
+            const int k = sides[side];
+            Port port;
+            port.sub = k;
+            port.b.assign(2 * delay, 0.0f);
+            std::snprintf(port.impedance_name, sizeof(port.impedance_name), "~Z%d", static_cast<int>(ports.size()));
+
+            char source_name[16];
+            std::snprintf(source_name, sizeof(source_name), "~P%d", static_cast<int>(ports.size()));
+            //the ports are found by name later, so a user element by the same name would get them instead
+            if(original.find(source_name) >= 0 || original.find(port.impedance_name) >= 0)
+                throw std::invalid_argument(std::string("DecoupledMNA: ") + source_name + " and " + port.impedance_name
+                                            + " are taken by the ports, rename the element");
+            const int p = nets[k].add_node();
+            nets[k].add_voltage_source(source_name, p, 0, 0.0f);
+            nets[k].add_resistor(port.impedance_name, p, local[k][c], default_Z);
+            port.probe = nets[k].add_probe(local[k][c]);
+            if(p < 0 || port.probe < 0)
+                throw std::length_error("DecoupledMNA: subcircuit ran out of room for its ports");
+
+            ports_of_sub[k].push_back(static_cast<int>(ports.size()));
+            ports.push_back(port);
+        }
+        lines[l].port_a = static_cast<int>(ports.size()) - 2;
+        lines[l].port_b = static_cast<int>(ports.size()) - 1;
+        ports[lines[l].port_a].other = lines[l].port_b;
+        ports[lines[l].port_b].other = lines[l].port_a;
+    }
+
+    //the output lives wherever its node went, or on the first side of its cut
+    const int out = original.get_output();
+    output_sub = -1;
+    for(int k = 0; k < n_comp && out != 0; ++k){
+        if(local[k][out] >= 0){
+            nets[k].set_output(local[k][out]);
+            output_sub = k;
+            break;
+        }
+    }
+
+    subs.clear();
+    for(int k = 0; k < n_comp; ++k)
+        subs.push_back(std::make_unique<MNA>(nets[k]));
+
+    for(std::size_t i = 0; i < ports.size(); ++i){
+        char source_name[16];
+        std::snprintf(source_name, sizeof(source_name), "~P%d", static_cast<int>(i));
+        ports[i].source = subs[ports[i].sub]->source_index(source_name);
+    }
+
+    update_impedances();
+}
+
+
+void DecoupledMNA::update_impedances(){
+    const float T = 1.0f/samp_rate;
+    for(Line& line : lines){
+        line.impedance = default_Z;
+        if(line.absorbed_cap >= 0)
+            line.impedance = delay * T/original.element(line.absorbed_cap).value;
+
+        subs[ports[line.port_a].sub]->set_value(ports[line.port_a].impedance_name, line.impedance);
+        subs[ports[line.port_b].sub]->set_value(ports[line.port_b].impedance_name, line.impedance);
+    }
+}
+
+
+void DecoupledMNA::prepare(float sr){
+    //the lines start empty, and the port sources still hold the last sample's 2a, which the subcircuits'
+    //DC operating point would otherwise be solved around
+    for(Port& port : ports){
+        port.a = 0.0f;
+        std::fill(port.b.begin(), port.b.end(), 0.0f);
+        subs[port.sub]->set_source(port.source, 0.0f);
+    }
+    position = 0;
+
+    samp_rate = sr;
+    for(auto& sub : subs)
+        sub->prepare(sr);
+    update_impedances();
+}
+
+
+bool DecoupledMNA::set_value(const char* name, float v){
+    const int i = original.find(name);
+    if(i < 0)
+        return false;
+    original.element(i).value = v;
+
+    for(const Line& line : lines){
+        if(line.absorbed_cap == i){
+            update_impedances();
+            return true;
+        }
+    }
+
+    bool found = false;
+    for(auto& sub : subs)
+        found |= sub->set_value(name, v);
+    return found;
+}
+
+
+void DecoupledMNA::process_block(const float* in, float* out, int num_samples){
+    int done = 0;
+    while(done < num_samples){
+        //nothing inside one delay length depends on another subcircuit
+        const int count = std::min(delay, num_samples - done);
+        std::copy(in + done, in + done + count, seg_in.begin());
+        seg_out = out + done;
+        seg_count = count;
+        if(output_sub < 0)
+            std::fill(seg_out, seg_out + count, 0.0f);
+
+        if(workers.empty()){
+            run_worker(0);
+        }
+        else{
+            pending.store(static_cast<int>(workers.size()), std::memory_order_relaxed);
+            generation.fetch_add(1);
+            //only the first segment of a block should find anyone asleep. A worker counts itself in
+            //before it checks generation, so it either sees the new one or gets notified here
+            if(sleepers.load() > 0){
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                }
+                wake.notify_all();
+            }
+            run_worker(0);
+            while(pending.load(std::memory_order_acquire) > 0)
+                std::this_thread::yield();
+        }
+
+        position += count;
+        done += count;
+    }
+}
+
+
+void DecoupledMNA::run_subcircuit(int k, int count){
+    MNA& sub = *subs[k];
+    const int ring = 2 * delay;
+
+    for(int i = 0; i < count; ++i){
+        const long long n = position + i;
+        const int read = static_cast<int>(((n - delay) % ring + ring) % ring);
+        const int write = static_cast<int>(n % ring);
+
+        for(int p : ports_of_sub[k]){
+            Port& port = ports[p];
+            port.a = ports[port.other].b[read];
+            sub.set_source(port.source, 2.0f * port.a);
+        }
+
+        const float y = sub.process_sample(seg_in[i]);
+        if(k == output_sub)
+            seg_out[i] = y;
+
+        for(int p : ports_of_sub[k]){
+            Port& port = ports[p];
+            port.b[write] = sub.probe_voltage(port.probe) - port.a;
+        }
+    }
+}
+
+
+void DecoupledMNA::run_worker(int w){
+    const int stride = num_threads();
+    for(int k = w; k < num_subcircuits(); k += stride)
+        run_subcircuit(k, seg_count);
+}
+
+
+void DecoupledMNA::worker_loop(int w){
+    using clock = std::chrono::steady_clock;
+    const auto spin_time = std::chrono::microseconds(100); //covers the gap between segments, not between blocks
+    int seen = 0;
+    while(true){
+        int g = generation.load(std::memory_order_acquire);
+        const auto spin_end = clock::now() + spin_time;
+        while(g == seen && clock::now() < spin_end){
+            std::this_thread::yield();
+            g = generation.load(std::memory_order_acquire);
+        }
+        if(g == seen){
+            std::unique_lock<std::mutex> lock(mutex);
+            sleepers.fetch_add(1);
+            wake.wait(lock, [&]{ return generation.load() != seen; });
+            sleepers.fetch_sub(1);
+            g = generation.load(std::memory_order_acquire);
+        }
+        seen = g;
+
+        if(!running.load())
+            return;
+
+        run_worker(w);
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
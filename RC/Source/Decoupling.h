@@ -0,0 +1,101 @@
+
+
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MNA.h"
+
+
+/* Transmission line decoupling
+ * Cuts a big netlist at the given nodes and puts a delay line (TLM link) in place of each cut.
+ * Every side of a cut sees a Thevenin port: a source of 2a behind the line impedance Z, with
+ *     v = a + b,   a[n] = b_other_side[n - line_delay]
+ * so within line_delay samples the subcircuits don't depend on each other and each one can be its
+ * own small MNA, solved on its own core.
+ *
+ * A line of delay D*T and impedance Z looks like a capacitance of D*T/Z, so if a cut node has a
+ * capacitor to ground that capacitor gets absorbed into the line (Z = D*T/C) and the cut costs
+ * nothing but a tiny parasitic inductance. Otherwise Z falls back to default_impedance.
+ *
+ * Each port is a source ~P<i> behind a resistor ~Z<i> inside its subcircuit. Those names are taken: a
+ * circuit with an element of the same name is turned down (SPICE names can't start with ~ anyway).
+ *
+ * The subcircuits meet once per line_delay samples, so that's the most work a thread can do between two
+ * handoffs. Handing a segment over costs around a microsecond, so below min_parallel_block samples every
+ * subcircuit runs on the calling thread. That still beats one MNA of the whole circuit once it splits
+ * into a few stages, since the Newton solves get that much smaller (see rc_engine_bench). So with the
+ * default line_delay of 1 there are no workers at all, whatever num_threads says: the pool only starts for
+ * line_delay >= min_parallel_block, and a line that long is a much bigger parasitic, so it trades accuracy
+ * for the cores. Workers spin for a moment between segments (they come back to back inside a block) and
+ * then sleep until the next process_block, so nothing burns a core while no audio runs.
+ */
+class DecoupledMNA {
+
+public:
+    static constexpr int min_parallel_block = 16;
+
+    DecoupledMNA(const Netlist& circuit, const std::vector<int>& cut_nodes, int line_delay = 1,
+                 int num_threads = 0, float default_impedance = 1000.0f);
+    ~DecoupledMNA();
+
+    void prepare(float sr);
+    void process_block(const float* in, float* out, int num_samples); //in and out can be the same buffer
+    bool set_value(const char* name, float v);
+
+    int num_subcircuits() const { return static_cast<int>(subs.size()); }
+    int num_threads() const { return static_cast<int>(workers.size()) + 1; } //1 below min_parallel_block
+
+private:
+
+    struct Port {
+        int sub = 0; //which subcircuit
+        int source = -1; //its 2a source
+        int probe = -1; //its side of the cut
+        char impedance_name[16] = {}; //the Z resistor in that subcircuit
+        int other = 0; //the port on the far end of the line
+        float a = 0.0f; //incident wave for the current sample
+        std::vector<float> b; //outgoing waves, 2*line_delay long
+    };
+
+    struct Line {
+        int port_a = 0;
+        int port_b = 0;
+        int absorbed_cap = -1; //element index in the original netlist, -1 if Z is fixed
+        float impedance = 0.0f;
+    };
+
+    void split(const std::vector<int>& cut_nodes);
+    void update_impedances();
+    void run_subcircuit(int k, int count);
+    void run_worker(int w);
+    void worker_loop(int w);
+
+    Netlist original;
+    std::vector<std::unique_ptr<MNA>> subs;
+    std::vector<Port> ports;
+    std::vector<Line> lines;
+    std::vector<std::vector<int>> ports_of_sub;
+    int output_sub = -1;
+    int delay = 1;
+    float default_Z = 1000.0f;
+    float samp_rate = 44100.f;
+    long long position = 0; //global sample counter, picks the ring slots
+
+    //segment currently being rendered, handed to the workers
+    std::vector<float> seg_in; //input copied out first so in-place blocks don't race the output subcircuit
+    float* seg_out = nullptr;
+    int seg_count = 0;
+
+    std::vector<std::thread> workers;
+    std::atomic<int> generation {0};
+    std::atomic<int> pending {0};
+    std::atomic<bool> running {true};
+    std::atomic<int> sleepers {0}; //workers parked on `wake`
+    std::mutex mutex;
+    std::condition_variable wake;
+};
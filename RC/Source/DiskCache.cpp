@@ -0,0 +1,233 @@
+
+
+
+#include "DiskCache.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+constexpr char file_magic[4] = {'R', 'C', 'D', 'C'};
+
+struct FileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t circuit;
+    std::uint64_t settings;
+    float fs;
+    std::uint32_t kind;
+    std::uint64_t payload_size;
+    std::uint64_t checksum;
+    unsigned char reserved[16];
+};
+static_assert(sizeof(FileHeader) == 64, "DiskCache: the payload has to start on a cache line");
+
+template <typename T>
+std::uint64_t hash_value(const T& v, std::uint64_t seed){
+    return cache::hash_bytes(&v, sizeof(v), seed);
+}
+
+}
+
+
+std::uint64_t cache::hash_bytes(const void* data, std::size_t size, std::uint64_t seed){
+    const auto* p = static_cast<const unsigned char*>(data);
+    std::uint64_t h = seed;
+    for(std::size_t i = 0; i < size; ++i){
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+
+std::uint64_t cache::hash_netlist(const Netlist& circuit){
+    std::uint64_t h = hash_value(circuit.num_nodes(), 0xcbf29ce484222325ull);
+    h = hash_value(circuit.num_elements(), h);
+    h = hash_value(circuit.get_output(), h);
+    for(int i = 0; i < circuit.num_probes(); ++i)
+        h = hash_value(circuit.get_probe(i), h);
+
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        h = hash_value(static_cast<int>(e.type), h);
+        h = hash_value(e.n1, h);
+        h = hash_value(e.n2, h);
+        h = hash_value(e.value, h);
+        h = hash_value(e.param, h);
+        h = hash_value(e.is_input, h);
+        h = hash_value(e.noise, h);
+        h = hash_value(e.kf, h);
+        h = hash_bytes(e.name, std::strlen(e.name), h);
+    }
+    return h;
+}
+
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path){
+    std::shared_ptr<MappedFile> m(new MappedFile());
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    m->file = file;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart <= 0)
+        return nullptr;
+
+    m->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!m->mapping)
+        return nullptr;
+
+    m->bytes = static_cast<const unsigned char*>(MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0));
+    if(!m->bytes)
+        return nullptr;
+    m->length = static_cast<std::size_t>(size.QuadPart);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0){
+        ::close(fd);
+        return nullptr;
+    }
+
+    //the mapping holds its own reference to the file, so the descriptor can go straight away
+    void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED)
+        return nullptr;
+    m->bytes = static_cast<const unsigned char*>(p);
+    m->length = static_cast<std::size_t>(st.st_size);
+#endif
+    return m;
+}
+
+
+MappedFile::~MappedFile(){
+#ifdef _WIN32
+    if(bytes)
+        UnmapViewOfFile(bytes);
+    if(mapping)
+        CloseHandle(mapping);
+    if(file)
+        CloseHandle(file);
+#else
+    if(bytes)
+        munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+}
+
+
+DiskCache::DiskCache(std::string directory) : dir(std::move(directory)) {}
+
+
+std::string DiskCache::default_directory(){
+#if defined(_WIN32)
+    const char* base = std::getenv("LOCALAPPDATA");
+    return std::string(base ? base : ".") + "/RC";
+#elif defined(__APPLE__)
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/Library/Caches/RC";
+#else
+    if(const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0])
+        return std::string(xdg) + "/rc";
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/rc";
+#endif
+}
+
+
+std::string DiskCache::path(const CacheKey& key) const{
+    std::uint32_t fs_bits;
+    std::memcpy(&fs_bits, &key.fs, sizeof(fs_bits));
+
+    char name[96];
+    std::snprintf(name, sizeof(name), "%016llx-%016llx-%08x-%08x.rcc",
+                  static_cast<unsigned long long>(key.circuit), static_cast<unsigned long long>(key.settings),
+                  static_cast<unsigned>(fs_bits), static_cast<unsigned>(key.kind));
+    return dir + "/" + name;
+}
+
+
+CacheEntry DiskCache::find(const CacheKey& key) const{
+    auto file = MappedFile::open(path(key));
+    if(!file || file->size() < sizeof(FileHeader))
+        return {};
+
+    FileHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    const std::size_t size = file->size() - sizeof(FileHeader);
+    const unsigned char* payload = file->data() + sizeof(FileHeader);
+    const bool ok = std::memcmp(header.magic, file_magic, sizeof(file_magic)) == 0
+                    && header.version == format_version
+                    && header.circuit == key.circuit && header.settings == key.settings
+                    && std::memcmp(&header.fs, &key.fs, sizeof(float)) == 0 && header.kind == key.kind
+                    && header.payload_size == size
+                    && header.checksum == cache::hash_bytes(payload, size);
+    if(!ok)
+        return {};
+    return CacheEntry{payload, size, std::move(file)};
+}
+
+
+bool DiskCache::store(const CacheKey& key, const void* payload, std::size_t size) const{
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if(error)
+        return false;
+
+    FileHeader header{};
+    std::memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version = format_version;
+    header.circuit = key.circuit;
+    header.settings = key.settings;
+    header.fs = key.fs;
+    header.kind = key.kind;
+    header.payload_size = size;
+    header.checksum = cache::hash_bytes(payload, size);
+
+    //unique per writer so two processes filling the same entry don't write into each other's file
+    static std::atomic<unsigned> counter{0};
+    const std::string final_path = path(key);
+    const std::string temp_path = final_path + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()))
+                                  + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+                                  + "." + std::to_string(counter++) + ".tmp";
+
+    std::FILE* f = std::fopen(temp_path.c_str(), "wb");
+    if(!f)
+        return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && (size == 0 || std::fwrite(payload, 1, size, f) == size);
+    ok = std::fclose(f) == 0 && ok;
+
+    if(ok){
+        std::filesystem::rename(temp_path, final_path, error);
+        ok = !error;
+    }
+    if(!ok)
+        std::filesystem::remove(temp_path, error);
+    return ok;
+}
@@ -0,0 +1,126 @@
+
+
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "LookupTable.h"
+#include "Netlist.h"
+
+
+/* Disk cache
+ * Tables and other precomputed blobs that take a while to build go into one file per entry under a
+ * cache directory, and get read back with mmap. Every plugin instance and every process that finds the
+ * same entry then shares the same physical pages (the page cache) instead of each one rebuilding the
+ * table and holding its own copy.
+ *
+ * Entries are keyed by what they were built from: a hash of the circuit, the sample rate, a hash of
+ * whatever settings went into it, and a kind tag so different things built from the same circuit don't
+ * collide. A file is a 64 byte header (magic, format version, the key again, payload size and an FNV-1a
+ * checksum of the payload) followed by the payload, which starts 64 byte aligned. Anything that
+ * doesn't check out (older version, different key, truncated, corrupted) is just a miss.
+ *
+ * Writes go to a temporary file that gets renamed over the entry, so a reader never maps half of one.
+ * None of this is realtime safe, look things up at prepare.
+ */
+namespace cache {
+
+//FNV-1a, chain calls through seed to hash several things together
+std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed = 0xcbf29ce484222325ull);
+
+//structure and values of a circuit, field by field so padding never gets in
+std::uint64_t hash_netlist(const Netlist& circuit);
+
+}
+
+
+struct CacheKey {
+    std::uint64_t circuit = 0; //cache::hash_netlist, 0 for things that don't depend on one
+    float fs = 0.0f; //0 for things that don't depend on the rate
+    std::uint64_t settings = 0; //whatever else the entry was built from, hashed
+    std::uint32_t kind = 0; //what's in it, see make_kind
+};
+
+constexpr std::uint32_t make_kind(char a, char b, char c, char d){
+    return static_cast<std::uint32_t>(static_cast<unsigned char>(a))
+           | static_cast<std::uint32_t>(static_cast<unsigned char>(b)) << 8
+           | static_cast<std::uint32_t>(static_cast<unsigned char>(c)) << 16
+           | static_cast<std::uint32_t>(static_cast<unsigned char>(d)) << 24;
+}
+
+
+//read only mapping of a whole file, unmapped when the last reference goes away
+class MappedFile {
+
+public:
+    static std::shared_ptr<const MappedFile> open(const std::string& path); //nullptr if it can't
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+private:
+    MappedFile() = default;
+
+    const unsigned char* bytes = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+
+//payload of a cache hit, valid for as long as the entry (or anything made from it) holds on to file
+struct CacheEntry {
+    const unsigned char* data = nullptr;
+    std::size_t size = 0;
+    std::shared_ptr<const MappedFile> file;
+
+    explicit operator bool() const { return data != nullptr; }
+};
+
+
+class DiskCache {
+
+public:
+    static constexpr std::uint32_t format_version = 1;
+
+    explicit DiskCache(std::string directory = default_directory());
+
+    //$XDG_CACHE_HOME/rc (or ~/.cache/rc), ~/Library/Caches/RC on macOS, %LOCALAPPDATA%/RC on windows
+    static std::string default_directory();
+
+    const std::string& directory() const { return dir; }
+    std::string path(const CacheKey& key) const;
+
+    CacheEntry find(const CacheKey& key) const; //empty on a miss
+    bool store(const CacheKey& key, const void* payload, std::size_t size) const;
+
+    //the table for key out of the cache if it's there, otherwise build(table) and store it. The cached
+    //coefficients stay in the mapping, so every table loaded this way shares them. True on a hit
+    template <int Dims, typename Build>
+    bool table(const CacheKey& key, LookupTable<Dims>& table, Build&& build) const{
+        const CacheEntry entry = find(key);
+        if(entry && table.load(entry.data, entry.size, entry.file))
+            return true;
+
+        build(table);
+        std::vector<unsigned char> bytes;
+        if(table.save(bytes) && store(key, bytes.data(), bytes.size())){
+            //swap over to the mapped copy so this instance shares pages with the next one too
+            const CacheEntry stored = find(key);
+            if(stored)
+                table.load(stored.data, stored.size, stored.file);
+        }
+        return false;
+    }
+
+private:
+    std::string dir;
+};
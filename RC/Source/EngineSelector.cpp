@@ -0,0 +1,387 @@
+
+
+
+#include "EngineSelector.h"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include "DKMethod.h"
+#include "MNA.h"
+#include "WDF.h"
+
+
+namespace {
+
+using MatrixD = Eigen::MatrixXd;
+using VectorD = Eigen::VectorXd;
+
+using Render = std::function<void(const float* in, float* out, int n)>;
+
+
+struct Candidate {
+    EngineChoice engine;
+    const char* name;
+    Render render; //engine already prepared at fs
+};
+
+
+template <typename Engine>
+Render renderer(std::shared_ptr<Engine> engine){
+    return [engine](const float* in, float* out, int n){
+        for(int i = 0; i < n; ++i)
+            out[i] = engine->process_sample(in[i]);
+    };
+}
+
+
+Render mna_renderer(const Netlist& circuit, float fs, fastmath::Accuracy accuracy, bool table){
+    auto engine = std::make_shared<MNA>(circuit);
+    engine->set_accuracy(accuracy);
+    if(table)
+        engine->set_diode_table(true);
+    engine->prepare(fs);
+    return renderer(engine);
+}
+
+
+std::vector<Candidate> candidates(const Netlist& circuit, float fs){
+    std::vector<Candidate> out;
+
+    float r = 0.0f, c = 0.0f;
+    if(match_rc_lowpass(circuit, r, c)){
+        auto dk = std::make_shared<DKMethod>();
+        dk->setKnobs(r, c);
+        dk->prepare(fs);
+        out.push_back({EngineChoice::DK, "DK", renderer(dk)});
+
+        auto wdf = std::make_shared<RCLowPass>();
+        wdf->setKnobs(r, c);
+        wdf->prepare(fs);
+        out.push_back({EngineChoice::WDF, "WDF", renderer(wdf)});
+    }
+
+    out.push_back({EngineChoice::MNA, "MNA", mna_renderer(circuit, fs, fastmath::Accuracy::Full, false)});
+    if(circuit.count(ElementType::Diode) > 0){
+        out.push_back({EngineChoice::MNAMedium, "MNA (medium exp)", mna_renderer(circuit, fs, fastmath::Accuracy::Medium, false)});
+        out.push_back({EngineChoice::MNALow, "MNA (low exp)", mna_renderer(circuit, fs, fastmath::Accuracy::Low, false)});
+        out.push_back({EngineChoice::MNATable, "MNA (diode table)", mna_renderer(circuit, fs, fastmath::Accuracy::Full, true)});
+    }
+    return out;
+}
+
+
+//a few log spaced tones from 50 Hz up to the bandwidth, spread phases so the peaks don't line up
+struct Multitone {
+    static constexpr int tones = 8;
+    double frequency[tones];
+    double phase[tones];
+    double amplitude;
+
+    Multitone(float fs, float level, float bandwidth){
+        const double low = 50.0;
+        const double high = std::max(low, double(bandwidth) * fs);
+        for(int k = 0; k < tones; ++k){
+            frequency[k] = low * std::pow(high/low, k/double(tones - 1));
+            phase[k] = 3.14159265358979 * k * k/tones;
+        }
+        amplitude = level/double(tones);
+    }
+
+    double operator()(double t) const {
+        double v = 0.0;
+        for(int k = 0; k < tones; ++k)
+            v += std::sin(6.283185307179586 * frequency[k] * t + phase[k]);
+        return amplitude * v;
+    }
+};
+
+
+struct Diode {
+    int anode; //unknown, -1 for ground
+    int cathode;
+    double i_sat;
+    double n_vt;
+};
+
+
+double port_voltage(const VectorD& x, int a, int k){
+    return (a >= 0 ? x(a) : 0.0) - (k >= 0 ? x(k) : 0.0);
+}
+
+
+void stamp_diodes(const std::vector<Diode>& diodes, const VectorD& x, VectorD& f, MatrixD& D){
+    f.setZero();
+    D.setZero();
+    for(const auto& d : diodes){
+        const double e = std::exp(port_voltage(x, d.anode, d.cathode)/d.n_vt);
+        const double i = d.i_sat * (e - 1.0);
+        const double g = d.i_sat * e/d.n_vt;
+        if(d.anode >= 0){
+            f(d.anode) += i;
+            D(d.anode, d.anode) += g;
+        }
+        if(d.cathode >= 0){
+            f(d.cathode) -= i;
+            D(d.cathode, d.cathode) += g;
+        }
+        if(d.anode >= 0 && d.cathode >= 0){
+            D(d.anode, d.cathode) -= g;
+            D(d.cathode, d.anode) -= g;
+        }
+    }
+}
+
+}
+
+
+//unsimplified MNA in double, one extra row per source,
+//    A x[m] + f(x[m]) = b[m] + b[m-1] - B x[m-1] - f(x[m-1])
+//and the DC start by backward euler with a time step that grows until it's effectively infinite (pseudo
+//transient), which copes with nodes that only have capacitors on them
+std::vector<double> reference_render(const Netlist& circuit, float fs, int oversampling, int num_samples,
+                                     const std::function<double(double)>& input){
+    const int nodes = circuit.num_nodes() - 1;
+    auto unknown = [](int node){ return node - 1; };
+
+    std::vector<int> source_row(static_cast<std::size_t>(circuit.num_elements()), -1);
+    int size = nodes;
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        if(circuit.element(i).type == ElementType::VoltageSource)
+            source_row[static_cast<std::size_t>(i)] = size++;
+    }
+
+    MatrixD G = MatrixD::Zero(size, size);
+    MatrixD C = MatrixD::Zero(size, size);
+    std::vector<Diode> diodes;
+
+    auto stamp = [](MatrixD& m, int a, int b, double v){
+        if(a >= 0) m(a, a) += v;
+        if(b >= 0) m(b, b) += v;
+        if(a >= 0 && b >= 0){
+            m(a, b) -= v;
+            m(b, a) -= v;
+        }
+    };
+
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        const int a = unknown(e.n1);
+        const int b = unknown(e.n2);
+        switch(e.type){
+            case ElementType::Resistor: stamp(G, a, b, 1.0/e.value); break;
+            case ElementType::Capacitor: stamp(C, a, b, e.value); break;
+            case ElementType::Diode: diodes.push_back({a, b, e.value, e.param}); break;
+            case ElementType::VoltageSource:{
+                const int k = source_row[static_cast<std::size_t>(i)];
+                if(a >= 0){ G(a, k) += 1.0; G(k, a) += 1.0; }
+                if(b >= 0){ G(b, k) -= 1.0; G(k, b) -= 1.0; }
+                break;
+            }
+        }
+    }
+
+    auto sources = [&](double in, VectorD& b){
+        b.setZero(size);
+        for(int i = 0; i < circuit.num_elements(); ++i){
+            const Element& e = circuit.element(i);
+            if(e.type == ElementType::VoltageSource)
+                b(source_row[static_cast<std::size_t>(i)]) = e.value + (e.is_input ? in : 0.0);
+        }
+    };
+
+    VectorD f = VectorD::Zero(size);
+    MatrixD D = MatrixD::Zero(size, size);
+
+    //newton on A x + f(x) = rhs from x, diode steps limited to a few thermal voltages
+    auto solve = [&](const MatrixD& A, const VectorD& rhs, VectorD& x){
+        if(diodes.empty()){
+            x = A.partialPivLu().solve(rhs);
+            return;
+        }
+        for(int it = 0; it < 100; ++it){
+            stamp_diodes(diodes, x, f, D);
+            const VectorD dx = (A + D).partialPivLu().solve(A * x + f - rhs);
+            double scale = 1.0;
+            for(const auto& d : diodes){
+                const double dv = std::fabs(port_voltage(dx, d.anode, d.cathode));
+                if(dv > 4.0 * d.n_vt)
+                    scale = std::min(scale, 4.0 * d.n_vt/dv);
+            }
+            x -= scale * dx;
+            if(dx.cwiseAbs().maxCoeff() * scale < 1e-13)
+                break;
+        }
+        stamp_diodes(diodes, x, f, D);
+    };
+
+    const double T = 1.0/(double(fs) * oversampling);
+
+    //dc: (G + C/h) x[k] + f(x[k]) = b + (C/h) x[k-1], h from T up to a few thousand seconds
+    VectorD x = VectorD::Zero(size);
+    VectorD b(size);
+    sources(0.0, b);
+    for(double h = T; h < 1e4; h *= 10.0){
+        const MatrixD A = G + C/h;
+        for(int k = 0; k < 10; ++k){
+            const VectorD rhs = b + (C/h) * x;
+            solve(A, rhs, x);
+        }
+    }
+    stamp_diodes(diodes, x, f, D);
+
+    const MatrixD A = G + (2.0/T) * C;
+    const MatrixD B = G - (2.0/T) * C;
+    const Eigen::PartialPivLU<MatrixD> linear_lu(A);
+    const int out = unknown(circuit.get_output());
+
+    std::vector<double> y(static_cast<std::size_t>(num_samples));
+    VectorD b_prev = b;
+    VectorD f_prev = f;
+    for(int n = 0; n < num_samples; ++n){
+        for(int m = 1; m <= oversampling; ++m){
+            sources(input((double(n) * oversampling + m - oversampling) * T), b);
+            const VectorD rhs = b + b_prev - B * x - f_prev;
+            if(diodes.empty())
+                x = linear_lu.solve(rhs);
+            else
+                solve(A, rhs, x);
+            b_prev = b;
+            f_prev = f;
+        }
+        y[static_cast<std::size_t>(n)] = out >= 0 ? x(out) : 0.0;
+    }
+    return y;
+}
+
+
+bool match_rc_lowpass(const Netlist& circuit, float& r, float& c){
+    if(circuit.num_elements() != 3 || circuit.count(ElementType::Resistor) != 1 || circuit.count(ElementType::Capacitor) != 1)
+        return false;
+
+    int in = -1;
+    const int out = circuit.get_output();
+    const Element* resistor = nullptr;
+    const Element* capacitor = nullptr;
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        switch(e.type){
+            case ElementType::VoltageSource:
+                if(!e.is_input || e.value != 0.0f || e.n2 != 0)
+                    return false;
+                in = e.n1;
+                break;
+            case ElementType::Resistor: resistor = &e; break;
+            case ElementType::Capacitor: capacitor = &e; break;
+            default: return false;
+        }
+    }
+    if(in <= 0 || out <= 0 || in == out || !resistor || !capacitor)
+        return false;
+
+    const bool r_across = (resistor->n1 == in && resistor->n2 == out) || (resistor->n1 == out && resistor->n2 == in);
+    const bool c_across = (capacitor->n1 == out && capacitor->n2 == 0) || (capacitor->n1 == 0 && capacitor->n2 == out);
+    if(!r_across || !c_across)
+        return false;
+
+    r = resistor->value;
+    c = capacitor->value;
+    return true;
+}
+
+
+EngineSelection select_engine(const Netlist& circuit, float fs, const SelectionBudget& budget){
+    if(!(fs > 0.0f) || budget.oversampling < 1 || !(budget.seconds > 0.0f) || budget.timing_runs < 1
+       || !(budget.bandwidth > 0.0f && budget.bandwidth < 0.5f))
+        throw std::invalid_argument("select_engine: bad sample rate or budget");
+
+    const int settle = static_cast<int>(budget.settle_seconds * fs);
+    const int length = std::max(1, static_cast<int>(budget.seconds * fs));
+    const int total = settle + length;
+
+    const Multitone tone(fs, budget.level, budget.bandwidth);
+    const double start = settle/double(fs);
+    auto input = [&](double t){ return t < start ? 0.0 : tone(t - start); };
+
+    std::vector<float> x(static_cast<std::size_t>(total));
+    double signal_power = 0.0;
+    for(int n = 0; n < total; ++n){
+        x[static_cast<std::size_t>(n)] = static_cast<float>(input(n/double(fs)));
+        if(n >= settle)
+            signal_power += double(x[static_cast<std::size_t>(n)]) * x[static_cast<std::size_t>(n)];
+    }
+    const double signal_rms = std::sqrt(signal_power/length);
+
+    const std::vector<double> reference = reference_render(circuit, fs, budget.oversampling, total, input);
+
+    EngineSelection selection;
+    std::vector<float> y(static_cast<std::size_t>(total));
+    for(auto& candidate : candidates(circuit, fs)){
+        EngineScore score;
+        score.engine = candidate.engine;
+        score.name = candidate.name;
+
+        candidate.render(x.data(), y.data(), total);
+        double error_power = 0.0;
+        for(int n = settle; n < total; ++n){
+            const double e = y[static_cast<std::size_t>(n)] - reference[static_cast<std::size_t>(n)];
+            error_power += e * e;
+            score.max_abs_error = std::max(score.max_abs_error, std::fabs(e));
+        }
+        //a render that blew up is infinitely wrong, not nan
+        score.error = std::isfinite(error_power) ? std::sqrt(error_power/length)/signal_rms : HUGE_VAL;
+        if(!std::isfinite(score.max_abs_error))
+            score.max_abs_error = HUGE_VAL;
+
+        //state just carries on from the accuracy run, which is what it does in a real stream anyway
+        double best = HUGE_VAL;
+        for(int run = 0; run < budget.timing_runs; ++run){
+            const auto t0 = std::chrono::steady_clock::now();
+            candidate.render(x.data() + settle, y.data() + settle, length);
+            const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - t0;
+            best = std::min(best, elapsed.count()/length);
+        }
+        score.ns_per_sample = best;
+
+        score.within_budget = score.error <= budget.max_error
+                           && (budget.max_ns_per_sample <= 0.0 || score.ns_per_sample <= budget.max_ns_per_sample);
+        selection.scores.push_back(score);
+    }
+
+    std::sort(selection.scores.begin(), selection.scores.end(),
+              [](const EngineScore& a, const EngineScore& b){ return a.ns_per_sample < b.ns_per_sample; });
+
+    //the cheapest of the engines that pass, with anything within the margin of it as cheap, first in EngineChoice order
+    auto pick = [&](auto passes){
+        const EngineScore* chosen = nullptr;
+        double limit = HUGE_VAL;
+        for(const auto& s : selection.scores){
+            if(!passes(s))
+                continue;
+            if(s.ns_per_sample > limit)
+                break;
+            if(!chosen)
+                limit = s.ns_per_sample * (1.0 + budget.tie_margin);
+            if(!chosen || s.engine < chosen->engine)
+                chosen = &s;
+        }
+        return chosen;
+    };
+
+    if(const EngineScore* chosen = pick([](const EngineScore& s){ return s.within_budget; })){
+        selection.found = true;
+        selection.engine = chosen->engine;
+    }
+    else{
+        //the most accurate, but engines that are all off by the same discretization error tie, and the
+        //cheapest of those is the one to take
+        double best = HUGE_VAL;
+        for(const auto& s : selection.scores)
+            best = std::min(best, s.error);
+        selection.engine = pick([best](const EngineScore& s){ return s.error <= best * 1.01; })->engine;
+    }
+    return selection;
+}
@@ -0,0 +1,74 @@
+
+
+
+#pragma once
+#include <functional>
+#include <vector>
+#include "Netlist.h"
+
+
+/* Engine selection
+ * Picks the engine for a circuit at a sample rate, so nobody has to know the tradeoffs behind the METHOD
+ * knob. Every engine that can run the circuit renders the same multitone, its error is measured against a
+ * double precision trapezoid at oversampling x the rate (started from its DC operating point, like the
+ * engines), and its cost is timed on this machine. The cheapest one inside the error budget (and the cost
+ * budget, if there is one) wins. Timings jitter from run to run, so engines within tie_margin of the cheapest
+ * count as just as cheap and the one first in EngineChoice's order takes it: the same circuit gets the same
+ * engine every time unless one really is faster.
+ *
+ * DK and WDF only do the plugin's RC, so they only compete when the circuit is Netlist::rc_lowpass. The
+ * fast math tiers and the diode table only change anything with diodes in the circuit, so they only compete
+ * then. A new engine is one more entry in candidates() in the .cpp.
+ * Offline only: it allocates and takes a few ms for the RC, more with diodes. MNA's construction errors
+ * (circuit too big, nodes that only reach ground through diodes) come straight through.
+ */
+enum class EngineChoice {
+    DK,
+    WDF,
+    MNA,
+    MNAMedium, //fastmath::Accuracy::Medium diodes
+    MNALow,
+    MNATable //diode i-v out of a lookup table
+};
+
+
+struct SelectionBudget {
+    double max_error = 1e-2; //rms error over rms of the test signal, -40 dB
+    double max_ns_per_sample = 0.0; //0 = no cost limit
+    float level = 0.5f; //peak of the test multitone
+    float bandwidth = 0.25f; //its highest tone, as a fraction of fs. Nearer nyquist every engine here warps a lot
+    float seconds = 0.25f; //length of the part that gets compared and timed
+    float settle_seconds = 0.05f; //silence in front of it, anything that starts off slightly off DC settles there
+    int oversampling = 8; //the reference runs at this times the rate
+    int timing_runs = 5; //cost is the fastest of these
+    double tie_margin = 0.15; //costs within this fraction of the cheapest are a tie, EngineChoice order breaks it
+};
+
+
+struct EngineScore {
+    EngineChoice engine = EngineChoice::MNA;
+    const char* name = "";
+    double error = 0.0; //same measure as max_error
+    double max_abs_error = 0.0; //volts
+    double ns_per_sample = 0.0;
+    bool within_budget = false;
+};
+
+
+struct EngineSelection {
+    bool found = false; //nothing met the budget if false, engine is the most accurate one then (cheapest on a tie)
+    EngineChoice engine = EngineChoice::MNA;
+    std::vector<EngineScore> scores; //every engine that could run the circuit, cheapest first
+};
+
+
+EngineSelection select_engine(const Netlist& circuit, float fs, const SelectionBudget& budget = {});
+
+//the reference the engines get measured against: the circuit as it is (not simplified, not partitioned) in
+//double, trapezoid at oversampling x fs with input(t) evaluated at every step and every oversampling'th
+//step read out. Starts at the DC operating point with no input, like the engines after prepare()
+std::vector<double> reference_render(const Netlist& circuit, float fs, int oversampling, int num_samples,
+                                     const std::function<double(double)>& input);
+
+//R and C if the circuit is the plugin's RC (Vin -- R -- out -- C -- gnd), which is what DK and WDF can run
+bool match_rc_lowpass(const Netlist& circuit, float& r, float& c);
@@ -0,0 +1,183 @@
+
+
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+
+/* Fast math for the nonlinear elements
+ * exp, log, tanh, pow and the Wright omega function (w + log(w) = x, which is what a diode in series with
+ * a resistor solves to) in three accuracy tiers:
+ *     Low    under 1e-3 relative
+ *     Medium under 1e-5 relative
+ *     Full   under 5 ulp of float for exp, log and tanh. Omega and pow stay under 2.5e-6 relative: omega is
+ *            limited by how well log(w) resolves w + log(w), and pow (for |y log x| up to ~20) by exp turning
+ *            log's absolute error into relative error times that
+ * Everything is branch free straight line code (selects, no early returns) so the block versions at the
+ * bottom vectorize. bench/FastMathBench.cpp measures the max ulp error against libm and the speedup,
+ * tests/FastMathTest.cpp holds every tier to these bounds.
+ */
+namespace fastmath {
+
+enum class Accuracy {
+    Low,
+    Medium,
+    Full
+};
+
+
+namespace detail {
+
+inline float from_bits(std::uint32_t u) { float f; std::memcpy(&f, &u, sizeof(f)); return f; }
+inline std::uint32_t to_bits(float f) { std::uint32_t u; std::memcpy(&u, &f, sizeof(u)); return u; }
+
+//c ? a : b as a bit mask, a plain ?: on floats gets turned back into branches before the vectorizer sees it
+inline float select(bool c, float a, float b){
+    const std::uint32_t mask = 0u - static_cast<std::uint32_t>(c);
+    return from_bits((to_bits(a) & mask) | (to_bits(b) & ~mask));
+}
+
+inline float clamp(float x, float lo, float hi){
+    x = select(x < lo, lo, x);
+    return select(x > hi, hi, x);
+}
+
+//round to nearest by pushing the fraction bits out of the mantissa, no int conversion in the way
+inline float round(float x){
+    constexpr float magic = 12582912.0f; //1.5 * 2^23
+    return (x + magic) - magic;
+}
+
+}
+
+
+//e^x: x = k ln2 + r with |r| <= ln2/2, e^r from a taylor polynomial, 2^k straight into the exponent
+template <Accuracy A>
+inline float exp(float x){
+    x = detail::clamp(x, -87.0f, 88.0f);
+
+    const float k = detail::round(x * 1.44269504089f);
+    const float r = (x - k * 0.693145751953125f) - k * 1.42860682030941723e-6f; //ln2 split in two for the full tier
+
+    float p;
+    if constexpr (A == Accuracy::Low)
+        p = 1.0f + r * (1.0f + r * (0.5f + r * (1.0f/6.0f)));
+    else if constexpr (A == Accuracy::Medium)
+        p = 1.0f + r * (1.0f + r * (0.5f + r * (1.0f/6.0f + r * (1.0f/24.0f + r * (1.0f/120.0f)))));
+    else
+        p = 1.0f + r * (1.0f + r * (0.5f + r * (1.0f/6.0f + r * (1.0f/24.0f + r * (1.0f/120.0f
+              + r * (1.0f/720.0f + r * (1.0f/5040.0f)))))));
+
+    const std::uint32_t scale = detail::to_bits(k + 8388735.0f) << 23; //2^23 + 127 + k, the biased exponent sits in the low bits
+    return p * detail::from_bits(scale);
+}
+
+
+//log(x) for x > 0: x = m 2^e with m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh((m-1)/(m+1)) as a series in s^2
+template <Accuracy A>
+inline float log(float x){
+    const std::uint32_t bits = detail::to_bits(x);
+    float e = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+    float m = detail::from_bits((bits & 0x007fffffu) | 0x3f800000u); //m in [1, 2)
+
+    const bool high = m > 1.41421356f;
+    m = detail::select(high, m * 0.5f, m);
+    e = detail::select(high, e + 1.0f, e);
+
+    const float s = (m - 1.0f)/(m + 1.0f);
+    const float s2 = s * s;
+
+    float series;
+    if constexpr (A == Accuracy::Low)
+        series = 1.0f + s2 * (1.0f/3.0f);
+    else if constexpr (A == Accuracy::Medium)
+        series = 1.0f + s2 * (1.0f/3.0f + s2 * (1.0f/5.0f));
+    else
+        series = 1.0f + s2 * (1.0f/3.0f + s2 * (1.0f/5.0f + s2 * (1.0f/7.0f + s2 * (1.0f/9.0f))));
+
+    return 2.0f * s * series + e * 0.693147180559945f;
+}
+
+
+//tanh from exp, with an odd polynomial near zero where (e - 1)/(e + 1) would cancel. The low tier's exp is off
+//by up to r^4/24 and the cancellation blows that up 1/(2x) times, so its polynomial reaches out to |x| = 1/2
+template <Accuracy A>
+inline float tanh(float x){
+    const float xc = detail::clamp(x, -9.0f, 9.0f);
+    const float e = fastmath::exp<A>(2.0f * xc);
+    const float big = (e - 1.0f)/(e + 1.0f);
+
+    const float x2 = xc * xc;
+    const float small = xc * (1.0f + x2 * (-1.0f/3.0f + x2 * (2.0f/15.0f + x2 * (-17.0f/315.0f))));
+
+    constexpr float polynomial_below = A == Accuracy::Low ? 0.25f : 0.015625f; //x^2
+    return detail::select(x2 < polynomial_below, small, big);
+}
+
+
+//x^y for x > 0
+template <Accuracy A>
+inline float pow(float x, float y){
+    return fastmath::exp<A>(y * fastmath::log<A>(x));
+}
+
+
+//wright omega: D'Angelo's cubic as the first guess in the middle, series at both ends,
+//then one halley step (low) or two (medium, full). the last word on accuracy is the log tier
+template <Accuracy A>
+inline float wright_omega(float x){
+    constexpr float x1 = -2.0f; //the cubic heads for zero below here, e^x (1 - e^x) is the better start
+    constexpr float x2 = 8.0f;
+    constexpr float a = -1.314293149877800e-3f;
+    constexpr float b = 4.775931364975583e-2f;
+    constexpr float c = 3.631952663804445e-1f;
+    constexpr float d = 6.313183464296682e-1f;
+
+    const float cubic = d + x * (c + x * (b + x * a));
+    const float ex = fastmath::exp<A>(x);
+    const float lx = fastmath::log<A>(detail::select(x > 1.0f, x, 1.0f));
+    const float asymptotic = x - lx + lx/x;
+    float w = detail::select(x < x1, ex * (1.0f - ex), detail::select(x < x2, cubic, asymptotic));
+
+    //f(w) = w + log(w) - x, f' = (w + 1)/w, f'' = -1/w^2
+    auto halley = [x](float w_){
+        const float f = w_ + fastmath::log<A>(w_) - x;
+        const float w1 = w_ + 1.0f;
+        return w_ - f * w_/(w1 + 0.5f * f/w1);
+    };
+
+    w = halley(w);
+    if constexpr (A != Accuracy::Low)
+        w = halley(w);
+    return w;
+}
+
+
+//runtime tier for callers that pick it from a setting
+inline float exp(float x, Accuracy a){
+    return a == Accuracy::Low ? exp<Accuracy::Low>(x) : (a == Accuracy::Medium ? exp<Accuracy::Medium>(x) : exp<Accuracy::Full>(x));
+}
+
+inline float log(float x, Accuracy a){
+    return a == Accuracy::Low ? log<Accuracy::Low>(x) : (a == Accuracy::Medium ? log<Accuracy::Medium>(x) : log<Accuracy::Full>(x));
+}
+
+
+//block versions, these are the loops that vectorize
+template <Accuracy A>
+inline void exp(const float* in, float* out, int n) { for(int i = 0; i < n; ++i) out[i] = fastmath::exp<A>(in[i]); }
+
+template <Accuracy A>
+inline void log(const float* in, float* out, int n) { for(int i = 0; i < n; ++i) out[i] = fastmath::log<A>(in[i]); }
+
+template <Accuracy A>
+inline void tanh(const float* in, float* out, int n) { for(int i = 0; i < n; ++i) out[i] = fastmath::tanh<A>(in[i]); }
+
+template <Accuracy A>
+inline void pow(const float* x, const float* y, float* out, int n) { for(int i = 0; i < n; ++i) out[i] = fastmath::pow<A>(x[i], y[i]); }
+
+template <Accuracy A>
+inline void wright_omega(const float* in, float* out, int n) { for(int i = 0; i < n; ++i) out[i] = fastmath::wright_omega<A>(in[i]); }
+
+}
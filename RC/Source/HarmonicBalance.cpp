@@ -0,0 +1,306 @@
+
+
+
+#include "HarmonicBalance.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+
+namespace {
+
+constexpr double two_pi = 6.283185307179586;
+
+double across(const Eigen::VectorXd& x, int samples, int a, int k, int s){
+    return (a >= 0 ? x(a * samples + s) : 0.0) - (k >= 0 ? x(k * samples + s) : 0.0);
+}
+
+}
+
+
+HarmonicBalance::HarmonicBalance(const Netlist& circuit, const HarmonicBalanceSettings& options) : settings(options){
+    if(settings.harmonics < 1)
+        throw std::invalid_argument("HarmonicBalance: need at least the fundamental");
+
+    //full MNA like the adjoint, except a source from a node to ground just fixes that node's samples
+    //and both its row and the source current drop out of the solve
+    auto unknown = [](int node){ return node - 1; };
+    size = circuit.num_nodes() - 1;
+    std::vector<bool> pinned(static_cast<std::size_t>(size), false);
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        if(e.type != ElementType::VoltageSource)
+            continue;
+        if(e.n1 == e.n2) //Netlist won't build one, but elements can be rewired after the fact
+            throw std::invalid_argument("HarmonicBalance: a voltage source from a node to itself");
+
+        Source src{-1, -1, 1.0, e.value, e.is_input};
+        if(e.n2 == 0 && !pinned[static_cast<std::size_t>(unknown(e.n1))])
+            src.pinned = unknown(e.n1);
+        else if(e.n1 == 0 && !pinned[static_cast<std::size_t>(unknown(e.n2))]){
+            src.pinned = unknown(e.n2);
+            src.sign = -1.0;
+        }
+
+        if(src.pinned >= 0)
+            pinned[static_cast<std::size_t>(src.pinned)] = true;
+        else
+            src.row = size++;
+        sources.push_back(src);
+    }
+
+    for(int u = 0; u < size; ++u){
+        if(u >= static_cast<int>(pinned.size()) || !pinned[static_cast<std::size_t>(u)])
+            free.push_back(u);
+    }
+
+    G = Eigen::MatrixXd::Zero(size, size);
+    C = Eigen::MatrixXd::Zero(size, size);
+    auto stamp = [](Eigen::MatrixXd& m, int a, int b, double v){
+        if(a >= 0) m(a, a) += v;
+        if(b >= 0) m(b, b) += v;
+        if(a >= 0 && b >= 0){
+            m(a, b) -= v;
+            m(b, a) -= v;
+        }
+    };
+
+    int source = 0;
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        const int a = unknown(e.n1);
+        const int b = unknown(e.n2);
+        switch(e.type){
+            case ElementType::Resistor: stamp(G, a, b, 1.0/e.value); break;
+            case ElementType::Capacitor: stamp(C, a, b, e.value); break;
+            case ElementType::Diode: diodes.push_back({a, b, e.value, e.param}); break;
+            case ElementType::VoltageSource:{
+                const int k = sources[static_cast<std::size_t>(source++)].row;
+                if(k < 0)
+                    break;
+                if(a >= 0){ G(a, k) += 1.0; G(k, a) += 1.0; }
+                if(b >= 0){ G(b, k) -= 1.0; G(k, b) -= 1.0; }
+                break;
+            }
+        }
+    }
+
+    samples = 2 * 4 * settings.harmonics + 1;
+    output = unknown(circuit.get_output());
+}
+
+
+//time derivative over one period as an S x S matrix acting on the samples of one unknown
+Eigen::MatrixXd HarmonicBalance::differentiation(float frequency) const{
+    const int K = (samples - 1)/2;
+    const double w = two_pi * frequency;
+    const double h = two_pi/samples;
+
+    std::vector<double> W(static_cast<std::size_t>(K) + 1, 0.0);
+    for(int k = 1; k <= K; ++k){
+        if(settings.fs > 0.0f){
+            //the trapezoid's (2/T)(z-1)/(z+1) on e^{jkwt}, aliasing included since tan wraps every fs
+            const double theta = k * w/(2.0 * settings.fs);
+            const double c = std::cos(theta);
+            W[static_cast<std::size_t>(k)] = 2.0 * settings.fs * std::sin(theta)/(std::fabs(c) > 1e-3 ? c : std::copysign(1e-3, c));
+        }
+        else{
+            W[static_cast<std::size_t>(k)] = k * w;
+        }
+    }
+
+    //D_st = -(2/S) sum_k W_k sin(k (s - t) h), which only depends on s - t
+    std::vector<double> column(static_cast<std::size_t>(samples), 0.0);
+    for(int m = 0; m < samples; ++m){
+        double sum = 0.0;
+        for(int k = 1; k <= K; ++k)
+            sum += W[static_cast<std::size_t>(k)] * std::sin(k * m * h);
+        column[static_cast<std::size_t>(m)] = -2.0 * sum/samples;
+    }
+
+    Eigen::MatrixXd D(samples, samples);
+    for(int s = 0; s < samples; ++s){
+        for(int t = 0; t < samples; ++t)
+            D(s, t) = column[static_cast<std::size_t>((s - t + samples) % samples)];
+    }
+    return D;
+}
+
+
+bool HarmonicBalance::newton(float frequency, float level, Eigen::VectorXd& x) const{
+    const int S = samples;
+    const int N = size * S;
+    const Eigen::MatrixXd D = differentiation(frequency);
+
+    //linear part of the jacobian, G (x) I + C (x) D, the diodes go on top per iteration
+    Eigen::MatrixXd L = Eigen::MatrixXd::Zero(N, N);
+    for(int i = 0; i < size; ++i){
+        for(int j = 0; j < size; ++j){
+            if(G(i, j) != 0.0){
+                for(int s = 0; s < S; ++s)
+                    L(i * S + s, j * S + s) += G(i, j);
+            }
+            if(C(i, j) != 0.0)
+                L.block(i * S, j * S, S, S) += C(i, j) * D;
+        }
+    }
+
+    //floating sources drive their current rows, grounded ones just set their node
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(N);
+    for(const auto& src : sources){
+        for(int s = 0; s < S; ++s){
+            const double v = src.dc + (src.is_input ? level * std::sin(two_pi * s/S) : 0.0);
+            if(src.row >= 0)
+                b(src.row * S + s) = v;
+            else
+                x(src.pinned * S + s) = src.sign * v;
+        }
+    }
+
+    //rows and columns newton actually works on
+    const int F = static_cast<int>(free.size()) * S;
+    std::vector<int> index(static_cast<std::size_t>(F));
+    for(std::size_t u = 0; u < free.size(); ++u){
+        for(int s = 0; s < S; ++s)
+            index[u * static_cast<std::size_t>(S) + static_cast<std::size_t>(s)] = free[u] * S + s;
+    }
+
+    Eigen::MatrixXd J(N, N);
+    Eigen::MatrixXd J_free(F, F);
+    Eigen::VectorXd r(N);
+    Eigen::VectorXd r_free(F);
+    for(int it = 0; it < settings.max_iterations; ++it){
+        r = L * x - b;
+        J = L;
+        for(const auto& d : diodes){
+            for(int s = 0; s < S; ++s){
+                const double e = std::exp(across(x, S, d.anode, d.cathode, s)/d.n_vt);
+                const double i = d.i_sat * (e - 1.0);
+                const double g = d.i_sat * e/d.n_vt;
+                const int a = d.anode * S + s;
+                const int k = d.cathode * S + s;
+                if(d.anode >= 0){ r(a) += i; J(a, a) += g; }
+                if(d.cathode >= 0){ r(k) -= i; J(k, k) += g; }
+                if(d.anode >= 0 && d.cathode >= 0){ J(a, k) -= g; J(k, a) -= g; }
+            }
+        }
+
+        for(int p = 0; p < F; ++p){
+            r_free(p) = r(index[static_cast<std::size_t>(p)]);
+            for(int q = 0; q < F; ++q)
+                J_free(p, q) = J(index[static_cast<std::size_t>(p)], index[static_cast<std::size_t>(q)]);
+        }
+        const Eigen::VectorXd dx_free = J_free.partialPivLu().solve(r_free);
+        if(!dx_free.allFinite())
+            return false;
+
+        Eigen::VectorXd dx = Eigen::VectorXd::Zero(N);
+        for(int p = 0; p < F; ++p)
+            dx(index[static_cast<std::size_t>(p)]) = dx_free(p);
+
+        //keep every junction within a few thermal voltages of where it was
+        double scale = 1.0;
+        for(const auto& d : diodes){
+            for(int s = 0; s < S; ++s){
+                const double dv = std::fabs(across(dx, S, d.anode, d.cathode, s));
+                if(dv > 4.0 * d.n_vt)
+                    scale = std::min(scale, 4.0 * d.n_vt/dv);
+            }
+        }
+        x -= scale * dx;
+        if(scale * dx_free.cwiseAbs().maxCoeff() < settings.tolerance)
+            return true;
+    }
+    return false;
+}
+
+
+bool HarmonicBalance::walk(float frequency, float from, float to, Eigen::VectorXd& x, int depth) const{
+    Eigen::VectorXd trial = x;
+    if(newton(frequency, to, trial)){
+        x = trial;
+        return true;
+    }
+    if(depth >= 8)
+        return false;
+
+    const float middle = 0.5f * (from + to);
+    return walk(frequency, from, middle, x, depth + 1) && walk(frequency, middle, to, x, depth + 1);
+}
+
+
+HarmonicPoint HarmonicBalance::measure(float frequency, float level, bool converged, const Eigen::VectorXd& x) const{
+    HarmonicPoint p;
+    p.frequency = frequency;
+    p.level = level;
+    p.converged = converged;
+    p.magnitude.assign(static_cast<std::size_t>(settings.harmonics) + 1, 0.0);
+    if(output < 0)
+        return p;
+
+    for(int k = 0; k <= settings.harmonics; ++k){
+        std::complex<double> sum = 0.0;
+        for(int s = 0; s < samples; ++s)
+            sum += x(output * samples + s) * std::polar(1.0, -two_pi * k * s/samples);
+        p.magnitude[static_cast<std::size_t>(k)] = std::abs(sum) * (k == 0 ? 1.0 : 2.0)/samples;
+    }
+
+    double harmonic = 0.0;
+    for(int k = 2; k <= settings.harmonics; ++k)
+        harmonic += p.magnitude[static_cast<std::size_t>(k)] * p.magnitude[static_cast<std::size_t>(k)];
+    p.thd = p.magnitude[1] > 0.0 ? std::sqrt(harmonic)/p.magnitude[1] : 0.0;
+    return p;
+}
+
+
+HarmonicPoint HarmonicBalance::solve(float frequency, float level) const{
+    Eigen::VectorXd x = Eigen::VectorXd::Zero(size * samples);
+    const bool converged = newton(frequency, 0.0f, x) && walk(frequency, 0.0f, level, x);
+    return measure(frequency, level, converged, x);
+}
+
+
+std::vector<HarmonicPoint> HarmonicBalance::distortion_map(const std::vector<float>& frequencies, const std::vector<float>& levels) const{
+    std::vector<HarmonicPoint> result(frequencies.size() * levels.size());
+
+    //quietest first so each level starts from the one below it
+    std::vector<std::size_t> order(levels.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){ return levels[a] < levels[b]; });
+
+    const int count = static_cast<int>(frequencies.size());
+    int num_threads = settings.num_threads > 0 ? settings.num_threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    num_threads = std::max(1, std::min(num_threads, count));
+
+    auto work = [&](int first){
+        for(int f = first; f < count; f += num_threads){
+            const float frequency = frequencies[static_cast<std::size_t>(f)];
+            Eigen::VectorXd x = Eigen::VectorXd::Zero(size * samples);
+            bool ok = newton(frequency, 0.0f, x);
+            float previous = 0.0f;
+
+            for(const std::size_t l : order){
+                //once the walk breaks down, later (louder) levels start over from the dc solution
+                if(!ok){
+                    x.setZero();
+                    previous = 0.0f;
+                    ok = newton(frequency, 0.0f, x);
+                }
+                ok = ok && walk(frequency, previous, levels[l], x);
+                previous = levels[l];
+                result[static_cast<std::size_t>(f) * levels.size() + l] = measure(frequency, levels[l], ok, x);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(int t = 1; t < num_threads; ++t)
+        pool.emplace_back(work, t);
+    work(0);
+    for(auto& t : pool)
+        t.join();
+    return result;
+}
@@ -0,0 +1,84 @@
+
+
+
+#pragma once
+#include <Eigen/Dense>
+#include <vector>
+#include "Netlist.h"
+
+
+/* Harmonic balance
+ * Finds the periodic steady state of a netlist driven by a sine on its input source straight away,
+ * instead of rendering until the transient dies out. The unknowns are S samples of every node over one
+ * period, and the MNA stamps are balanced with time derivatives taken spectrally:
+ *     G x + C D x + f(x) = b,   D = F^-1 diag(j W_k) F
+ * Resistors, sources and capacitors are linear, so only the diode part needs the time samples, and
+ * Newton on the whole thing converges in a handful of iterations from the previous level's solution.
+ *
+ * W_k = k w gives the analog circuit. With fs set, W_k = (2/T) tan(k w T/2) instead, which is what the
+ * trapezoidal engines do to frequency, so the maps line up with what MNA renders at that rate.
+ *
+ * distortion_map() walks the level axis upwards for each frequency (continuation) and runs the
+ * frequencies in parallel. Offline only, everything here allocates.
+ */
+struct HarmonicBalanceSettings {
+    int harmonics = 10; //reported, the solve carries 4x as many to keep aliasing out
+    int max_iterations = 100;
+    double tolerance = 1e-10; //max newton step in volts/amps
+    float fs = 0.0f; //0 = analog, otherwise match the trapezoid at this rate
+    int num_threads = 0; //0 = all cores
+};
+
+
+struct HarmonicPoint {
+    float frequency = 0.0f;
+    float level = 0.0f; //peak of the input sine
+    bool converged = false;
+    double thd = 0.0; //sqrt(sum of harmonic powers)/fundamental
+    std::vector<double> magnitude; //peak amplitude of the output at dc, f, 2f, ... harmonics*f
+};
+
+
+class HarmonicBalance {
+
+public:
+    explicit HarmonicBalance(const Netlist& circuit, const HarmonicBalanceSettings& settings = {});
+
+    HarmonicPoint solve(float frequency, float level) const;
+
+    //every (frequency, level) pair, frequency major: result[f * levels.size() + l]
+    std::vector<HarmonicPoint> distortion_map(const std::vector<float>& frequencies, const std::vector<float>& levels) const;
+
+private:
+    struct Diode {
+        int anode; //unknown, -1 for ground
+        int cathode;
+        double i_sat;
+        double n_vt;
+    };
+
+    struct Source {
+        int row; //current row for floating sources, -1 when it pins a node instead
+        int pinned; //unknown it pins, -1 if floating
+        double sign;
+        double dc;
+        bool is_input;
+    };
+
+    //x holds the time samples (unknown major) and is both the start and the answer
+    bool newton(float frequency, float level, Eigen::VectorXd& x) const;
+    //level continuation from a converged solution at `from`, halving the step when newton gives up
+    bool walk(float frequency, float from, float to, Eigen::VectorXd& x, int depth = 0) const;
+    HarmonicPoint measure(float frequency, float level, bool converged, const Eigen::VectorXd& x) const;
+    Eigen::MatrixXd differentiation(float frequency) const;
+
+    HarmonicBalanceSettings settings;
+    Eigen::MatrixXd G; //resistors and source incidence
+    Eigen::MatrixXd C; //capacitors
+    std::vector<Diode> diodes;
+    std::vector<Source> sources;
+    int size = 0; //mna unknowns (nodes + floating source currents)
+    std::vector<int> free; //the ones newton solves for, nodes pinned by a grounded source just follow it
+    int samples = 0; //per period
+    int output = -1;
+};
@@ -0,0 +1,408 @@
+
+
+
+#include "LookupTable.h"
+#include "ByteStream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+
+TableAxis TableAxis::uniform(float lo, float hi, int num_points){
+    if(num_points < 2 || !(hi > lo))
+        throw std::invalid_argument("TableAxis: need at least two points on an increasing range");
+
+    TableAxis a;
+    a.is_uniform = true;
+    a.n_points = num_points;
+    a.lo = lo;
+    a.hi = hi;
+    a.step = (hi - lo)/static_cast<float>(num_points - 1);
+    a.inv_step = 1.0f/a.step;
+    return a;
+}
+
+
+TableAxis TableAxis::nonuniform(std::vector<float> points){
+    if(points.size() < 2 || !std::is_sorted(points.begin(), points.end())
+       || std::adjacent_find(points.begin(), points.end()) != points.end())
+        throw std::invalid_argument("TableAxis: need at least two strictly increasing points");
+
+    TableAxis a;
+    a.is_uniform = false;
+    a.n_points = static_cast<int>(points.size());
+    a.lo = points.front();
+    a.hi = points.back();
+    a.points = std::move(points);
+    return a;
+}
+
+
+int TableAxis::locate_nonuniform(float x, float& t) const{
+    //first point above x, clamped so the edge cells catch everything outside
+    const auto it = std::upper_bound(points.begin() + 1, points.end() - 1, x);
+    const int i = static_cast<int>(it - points.begin()) - 1;
+    t = (x - points[static_cast<std::size_t>(i)])/width(i);
+    t = t > 0.0f ? (t < 1.0f ? t : 1.0f) : 0.0f;
+    return i;
+}
+
+
+//copies of a view stay views of the same memory, that's the whole point of having one
+AlignedBuffer::AlignedBuffer(const AlignedBuffer& other){
+    *this = other;
+}
+
+
+AlignedBuffer& AlignedBuffer::operator=(const AlignedBuffer& other){
+    if(this != &other){
+        if(other.owner){
+            view(other.viewed, other.count, other.owner);
+        }
+        else{
+            resize(other.count);
+            if(count > 0)
+                std::memcpy(ptr, other.ptr, count * sizeof(float));
+        }
+    }
+    return *this;
+}
+
+
+AlignedBuffer::~AlignedBuffer(){
+    ::operator delete[](ptr, std::align_val_t{64});
+}
+
+
+void AlignedBuffer::view(const float* p, std::size_t n, std::shared_ptr<const void> keep_alive){
+    viewed = p;
+    count = n;
+    owner = std::move(keep_alive);
+}
+
+
+void AlignedBuffer::resize(std::size_t n){
+    viewed = nullptr;
+    owner.reset();
+    if(n > capacity){
+        ::operator delete[](ptr, std::align_val_t{64});
+        ptr = static_cast<float*>(::operator new[](n * sizeof(float), std::align_val_t{64}));
+        capacity = n;
+    }
+    count = n;
+}
+
+
+namespace {
+
+//how one axis turns grid values into polynomial coefficients for one cell:
+//coefficient a = sum over n of W[a][n] * value at node[n]
+struct AxisWeights {
+    int node[4];
+    float W[4][4];
+};
+
+AxisWeights axis_weights(const TableAxis& axis, int cell, int order){
+    AxisWeights w{};
+    const int last = axis.num_points() - 1;
+
+    if(order == 2){
+        w.node[0] = cell;
+        w.node[1] = cell + 1;
+        w.W[0][0] = 1.0f;
+        w.W[1][0] = -1.0f;
+        w.W[1][1] = 1.0f;
+        return w;
+    }
+
+    //nodes cell-1 .. cell+2, hermite on [cell, cell+1] with centered slopes (one sided at the ends)
+    for(int n = 0; n < 4; ++n)
+        w.node[n] = std::min(std::max(cell - 1 + n, 0), last);
+
+    const float h = axis.width(cell);
+    float m0[4] = {};
+    float m1[4] = {};
+    if(cell > 0){
+        const float k = h/(axis.point(cell + 1) - axis.point(cell - 1));
+        m0[0] = -k;
+        m0[2] = k;
+    }
+    else{
+        m0[1] = -1.0f;
+        m0[2] = 1.0f;
+    }
+    if(cell + 1 < last){
+        const float k = h/(axis.point(cell + 2) - axis.point(cell));
+        m1[1] = -k;
+        m1[3] = k;
+    }
+    else{
+        m1[1] = -1.0f;
+        m1[2] = 1.0f;
+    }
+
+    for(int n = 0; n < 4; ++n){
+        const float e1 = n == 1 ? 1.0f : 0.0f;
+        const float e2 = n == 2 ? 1.0f : 0.0f;
+        w.W[0][n] = e1;
+        w.W[1][n] = m0[n];
+        w.W[2][n] = -3.0f * e1 + 3.0f * e2 - 2.0f * m0[n] - m1[n];
+        w.W[3][n] = 2.0f * e1 - 2.0f * e2 + m0[n] + m1[n];
+    }
+    return w;
+}
+
+
+constexpr char file_magic[4] = {'R', 'C', 'L', 'T'};
+constexpr std::uint32_t file_version = 2; //2 pads the coefficients out to 64 bytes so they can be mapped in place
+
+struct FileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t dims;
+    std::uint32_t order;
+};
+
+struct FileAxis {
+    std::uint32_t uniform;
+    std::uint32_t num_points;
+    float lo;
+    float hi;
+};
+
+}
+
+
+template <int Dims>
+void LookupTable<Dims>::build(const Axes& grid, const std::vector<float>& values, Interpolation interpolation){
+    if(values.size() != static_cast<std::size_t>(total_points(grid)))
+        throw std::invalid_argument("LookupTable: one value per grid point");
+
+    table_axes = grid;
+    interp = interpolation;
+    order = static_cast<int>(interpolation);
+    stride = 1;
+    int num_cells = 1;
+    for(int d = 0; d < Dims; ++d){
+        stride *= order;
+        cells[d] = grid[d].num_cells();
+        num_cells *= cells[d];
+    }
+    coefficients.resize(static_cast<std::size_t>(num_cells) * static_cast<std::size_t>(stride));
+
+    int points[Dims];
+    for(int d = 0; d < Dims; ++d)
+        points[d] = grid[d].num_points();
+
+    AxisWeights w[Dims];
+    for(int cell = 0; cell < num_cells; ++cell){
+        int rest = cell;
+        for(int d = Dims - 1; d >= 0; --d){
+            w[d] = axis_weights(grid[d], rest % cells[d], order);
+            rest /= cells[d];
+        }
+
+        float* c = coefficients.data() + static_cast<std::size_t>(cell) * stride;
+        for(int a = 0; a < stride; ++a){
+            //a and n are both flat (first axis slowest) indices into order^Dims
+            double sum = 0.0;
+            for(int n = 0; n < stride; ++n){
+                double weight = 1.0;
+                int value_index = 0;
+                int ra = a;
+                int rn = n;
+                int scale = 1;
+                for(int d = Dims - 1; d >= 0; --d){
+                    weight *= w[d].W[ra % order][rn % order];
+                    value_index += w[d].node[rn % order] * scale;
+                    scale *= points[d];
+                    ra /= order;
+                    rn /= order;
+                }
+                if(weight != 0.0)
+                    sum += weight * values[static_cast<std::size_t>(value_index)];
+            }
+            c[a] = static_cast<float>(sum);
+        }
+    }
+}
+
+
+template <int Dims>
+void LookupTable<Dims>::build_hermite(const TableAxis& grid, const std::vector<float>& values, const std::vector<float>& slopes){
+    const auto n = static_cast<std::size_t>(grid.num_points());
+    if(Dims != 1 || values.size() != n || slopes.size() != n)
+        throw std::invalid_argument("LookupTable: hermite tables are 1D with one value and slope per grid point");
+
+    table_axes[0] = grid;
+    interp = Interpolation::Cubic;
+    order = 4;
+    stride = 4;
+    cells[0] = grid.num_cells();
+    coefficients.resize(static_cast<std::size_t>(cells[0]) * 4);
+
+    for(int i = 0; i < cells[0]; ++i){
+        const auto k = static_cast<std::size_t>(i);
+        const double h = grid.width(i);
+        const double v0 = values[k];
+        const double v1 = values[k + 1];
+        const double m0 = h * slopes[k];
+        const double m1 = h * slopes[k + 1];
+
+        float* c = coefficients.data() + 4 * k;
+        c[0] = static_cast<float>(v0);
+        c[1] = static_cast<float>(m0);
+        c[2] = static_cast<float>(-3.0 * v0 + 3.0 * v1 - 2.0 * m0 - m1);
+        c[3] = static_cast<float>(2.0 * v0 - 2.0 * v1 + m0 + m1);
+    }
+}
+
+
+template <int Dims>
+float LookupTable<Dims>::lookup(float x, float& slope) const{
+    float t;
+    const int cell = table_axes[0].locate(x, t);
+    const float* c = coefficients.data() + static_cast<std::size_t>(cell) * stride;
+
+    const float dt = order == 2 ? c[1] : c[1] + t * (2.0f * c[2] + t * 3.0f * c[3]);
+    slope = dt/table_axes[0].width(cell);
+    return poly(c, t);
+}
+
+
+template <int Dims>
+void LookupTable<Dims>::process(const float* in, float* out, int n) const{
+    const TableAxis& axis = table_axes[0];
+    const float* c = coefficients.data();
+    for(int i = 0; i < n; ++i){
+        float t;
+        const int cell = axis.locate(in[i], t);
+        out[i] = poly(c + cell * stride, t);
+    }
+}
+
+
+template <int Dims>
+bool LookupTable<Dims>::save(std::vector<unsigned char>& out) const{
+    out.clear();
+    ByteWriter w(out);
+    FileHeader header{};
+    std::memcpy(header.magic, file_magic, sizeof(file_magic));
+    header.version = file_version;
+    header.dims = Dims;
+    header.order = static_cast<std::uint32_t>(order);
+    w.put(header);
+
+    for(const auto& a : table_axes){
+        const FileAxis fa{a.uniform_grid() ? 1u : 0u, static_cast<std::uint32_t>(a.num_points()), a.first(), a.last()};
+        w.put(fa);
+        if(!a.uniform_grid())
+            w.put(a.grid().data(), a.grid().size());
+    }
+
+    const std::uint64_t count = coefficients.size();
+    w.put(count);
+    w.align(64);
+    w.put(coefficients.data(), coefficients.size());
+    return true;
+}
+
+
+template <int Dims>
+bool LookupTable<Dims>::load(const void* data, std::size_t size, std::shared_ptr<const void> owner){
+    //parse into temporaries first so a bad buffer leaves the table as it was
+    ByteReader in(data, size);
+    FileHeader header{};
+    bool ok = in.get(header)
+              && std::memcmp(header.magic, file_magic, sizeof(file_magic)) == 0
+              && (header.version == 1 || header.version == file_version) && header.dims == Dims
+              && (header.order == 2 || header.order == 4);
+
+    Axes grid;
+    std::uint64_t expected = 1;
+    for(int d = 0; ok && d < Dims; ++d){
+        FileAxis fa{};
+        ok = in.get(fa) && fa.num_points >= 2 && fa.num_points <= (1u << 24);
+        if(!ok)
+            break;
+        if(fa.uniform){
+            ok = fa.hi > fa.lo;
+            if(ok)
+                grid[d] = TableAxis::uniform(fa.lo, fa.hi, static_cast<int>(fa.num_points));
+        }
+        else{
+            std::vector<float> points(fa.num_points);
+            ok = in.get(points.data(), points.size())
+                 && std::is_sorted(points.begin(), points.end())
+                 && std::adjacent_find(points.begin(), points.end()) == points.end();
+            if(ok)
+                grid[d] = TableAxis::nonuniform(std::move(points));
+        }
+        expected *= static_cast<std::uint64_t>(fa.num_points - 1) * header.order;
+    }
+
+    std::uint64_t count = 0;
+    ok = ok && in.get(count) && count == expected;
+    if(ok && header.version >= 2)
+        ok = in.align(64);
+    ok = ok && count <= in.remaining()/sizeof(float);
+    if(!ok)
+        return false;
+
+    //with an owner the coefficients stay where they are (a mapped file, so every instance shares them)
+    AlignedBuffer loaded;
+    if(owner && reinterpret_cast<std::uintptr_t>(in.position()) % alignof(float) == 0){
+        loaded.view(reinterpret_cast<const float*>(in.position()), static_cast<std::size_t>(count), std::move(owner));
+    }
+    else{
+        loaded.resize(static_cast<std::size_t>(count));
+        in.get(loaded.data(), static_cast<std::size_t>(count));
+    }
+
+    table_axes = grid;
+    order = static_cast<int>(header.order);
+    interp = static_cast<Interpolation>(order);
+    stride = 1;
+    for(int d = 0; d < Dims; ++d){
+        stride *= order;
+        cells[d] = grid[d].num_cells();
+    }
+    coefficients = loaded;
+    return true;
+}
+
+
+template <int Dims>
+bool LookupTable<Dims>::save(const char* path) const{
+    std::vector<unsigned char> bytes;
+    save(bytes);
+    std::FILE* f = std::fopen(path, "wb");
+    if(!f)
+        return false;
+    const bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return std::fclose(f) == 0 && ok;
+}
+
+
+template <int Dims>
+bool LookupTable<Dims>::load(const char* path){
+    std::FILE* f = std::fopen(path, "rb");
+    if(!f)
+        return false;
+
+    std::vector<unsigned char> bytes;
+    unsigned char chunk[4096];
+    std::size_t n;
+    while((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0)
+        bytes.insert(bytes.end(), chunk, chunk + n);
+    std::fclose(f);
+    return load(bytes.data(), bytes.size());
+}
+
+
+template class LookupTable<1>;
+template class LookupTable<2>;
+template class LookupTable<3>;
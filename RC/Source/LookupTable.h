@@ -0,0 +1,210 @@
+
+
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+/* Lookup tables
+ * One table type for everything that wants to trade a function call for memory: 1D/2D/3D, uniform or
+ * non-uniform grids, linear or cubic (hermite, slopes from the neighbours) interpolation.
+ *
+ * Every cell stores the coefficients of its own interpolating polynomial back to back, so a lookup
+ * is "find the cell, then one horner" and only touches that cell's contiguous block, no gathering
+ * corner values from all over the grid. Blocks are order^dims floats (2, 4, 8, 16 or 64), and the
+ * storage is cache line aligned so the small ones never straddle a line.
+ *
+ * Inputs outside the grid are clamped to the edge cells. Building allocates, lookups don't, so build at
+ * prepare (or load a saved one) and look up on the audio thread.
+ */
+class TableAxis {
+
+public:
+    TableAxis() = default;
+    static TableAxis uniform(float lo, float hi, int num_points);
+    static TableAxis nonuniform(std::vector<float> points); //has to be increasing
+
+    int num_points() const { return n_points; }
+    int num_cells() const { return n_points - 1; }
+    float point(int i) const { return is_uniform ? lo + static_cast<float>(i) * step : points[static_cast<std::size_t>(i)]; }
+    float width(int cell) const { return is_uniform ? step : points[static_cast<std::size_t>(cell) + 1] - points[static_cast<std::size_t>(cell)]; }
+    bool uniform_grid() const { return is_uniform; }
+    float first() const { return lo; }
+    float last() const { return hi; }
+    const std::vector<float>& grid() const { return points; }
+
+    //cell holding x and where in it x sits (0..1)
+    int locate(float x, float& t) const{
+        if(is_uniform){
+            //clamped while it's still a float: converting one past int's range is undefined (INT_MIN on x86)
+            const float top = static_cast<float>(n_points - 1);
+            float u = (x - lo) * inv_step;
+            u = u > 0.0f ? u : 0.0f; //nan lands here too
+            u = u < top ? u : top;
+            int i = static_cast<int>(u);
+            i = i < n_points - 2 ? i : n_points - 2;
+            t = u - static_cast<float>(i);
+            return i;
+        }
+        return locate_nonuniform(x, t);
+    }
+
+private:
+    int locate_nonuniform(float x, float& t) const;
+
+    bool is_uniform = true;
+    int n_points = 0;
+    float lo = 0.0f;
+    float hi = 0.0f;
+    float step = 0.0f;
+    float inv_step = 0.0f;
+    std::vector<float> points; //non-uniform only
+};
+
+
+enum class Interpolation {
+    Linear = 2, //values are the coefficients per axis per cell
+    Cubic = 4
+};
+
+
+//64 byte aligned float storage that only reallocates when it has to grow,
+//or a read only view of someone else's (a mapped cache file) kept alive by keep_alive
+class AlignedBuffer {
+
+public:
+    AlignedBuffer() = default;
+    AlignedBuffer(const AlignedBuffer& other);
+    AlignedBuffer& operator=(const AlignedBuffer& other);
+    ~AlignedBuffer();
+
+    void resize(std::size_t n); //back to owned storage
+    void view(const float* p, std::size_t n, std::shared_ptr<const void> keep_alive);
+    std::size_t size() const { return count; }
+    float* data() { return owner ? nullptr : ptr; } //views are read only
+    const float* data() const { return owner ? viewed : ptr; }
+
+private:
+    float* ptr = nullptr;
+    std::size_t count = 0;
+    std::size_t capacity = 0;
+    const float* viewed = nullptr;
+    std::shared_ptr<const void> owner;
+};
+
+
+template <int Dims>
+class LookupTable {
+    static_assert(Dims >= 1 && Dims <= 3, "LookupTable: 1, 2 or 3 dimensions");
+
+public:
+    using Axes = std::array<TableAxis, Dims>;
+    using Point = std::array<float, Dims>;
+
+    //values on the grid, first axis slowest
+    void build(const Axes& grid, const std::vector<float>& values, Interpolation interpolation = Interpolation::Cubic);
+
+    //samples f(Point) on the grid
+    template <typename F>
+    void tabulate(const Axes& grid, F&& f, Interpolation interpolation = Interpolation::Cubic){
+        std::vector<float> values;
+        values.reserve(static_cast<std::size_t>(total_points(grid)));
+        Point p;
+        sample(grid, f, p, 0, values);
+        build(grid, values, interpolation);
+    }
+
+    //1D only: cubic hermite through values with the slopes given instead of estimated, which is a lot
+    //more accurate when the derivative is known (a diode's i-v, a tube's transfer curve)
+    void build_hermite(const TableAxis& grid, const std::vector<float>& values, const std::vector<float>& slopes);
+
+    bool empty() const { return coefficients.size() == 0; }
+    const Axes& axes() const { return table_axes; }
+
+    template <typename... X>
+    float operator()(X... xs) const{
+        static_assert(sizeof...(X) == Dims, "LookupTable: one coordinate per axis");
+        const float x[Dims] = {static_cast<float>(xs)...};
+        float t[Dims];
+        int cell = 0;
+        for(int d = 0; d < Dims; ++d)
+            cell = cell * cells[d] + table_axes[d].locate(x[d], t[d]);
+        return evaluate(coefficients.data() + static_cast<std::size_t>(cell) * stride, t);
+    }
+
+    //1D only: value and slope out of the same cell
+    float lookup(float x, float& slope) const;
+
+    //1D only: out[i] = table(in[i]), in and out can be the same buffer
+    void process(const float* in, float* out, int n) const;
+
+    //binary dump of the axes and coefficients, load() checks it was written by the same kind of table
+    bool save(const char* path) const;
+    bool load(const char* path);
+
+    //same format in memory. Given an owner, load() points the table at data instead of copying it,
+    //and owner has to keep data alive (the DiskCache passes its mapping)
+    bool save(std::vector<unsigned char>& out) const;
+    bool load(const void* data, std::size_t size, std::shared_ptr<const void> owner = nullptr);
+
+private:
+    static int total_points(const Axes& grid){
+        int n = 1;
+        for(const auto& a : grid)
+            n *= a.num_points();
+        return n;
+    }
+
+    template <typename F>
+    static void sample(const Axes& grid, F& f, Point& p, int d, std::vector<float>& values){
+        for(int i = 0; i < grid[d].num_points(); ++i){
+            p[d] = grid[d].point(i);
+            if(d + 1 == Dims)
+                values.push_back(f(p));
+            else
+                sample(grid, f, p, d + 1, values);
+        }
+    }
+
+    float poly(const float* c, float t) const{
+        return order == 2 ? c[0] + t * c[1] : c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+    }
+
+    //tensor product horner, last axis innermost
+    float evaluate(const float* c, const float* t) const{
+        if constexpr (Dims == 1){
+            return poly(c, t[0]);
+        }
+        else if constexpr (Dims == 2){
+            float r = 0.0f;
+            for(int a = order - 1; a >= 0; --a)
+                r = r * t[0] + poly(c + a * order, t[1]);
+            return r;
+        }
+        else{
+            float r = 0.0f;
+            for(int a = order - 1; a >= 0; --a){
+                float q = 0.0f;
+                for(int b = order - 1; b >= 0; --b)
+                    q = q * t[1] + poly(c + (a * order + b) * order, t[2]);
+                r = r * t[0] + q;
+            }
+            return r;
+        }
+    }
+
+    Axes table_axes;
+    Interpolation interp = Interpolation::Cubic;
+    int order = 4; //coefficients per axis
+    int stride = 0; //floats per cell, order^Dims
+    int cells[Dims] = {};
+    AlignedBuffer coefficients;
+};
+
+
+extern template class LookupTable<1>;
+extern template class LookupTable<2>;
+extern template class LookupTable<3>;
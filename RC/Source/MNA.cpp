@@ -1,50 +1,1234 @@
 
 
 #include "MNA.h"
+#include "ByteStream.h"
+#include "DiskCache.h"
+#include "Oversampling.h"
+#include "SmallMatrix.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+constexpr char compiled_magic[4] = {'R', 'C', 'C', 'C'};
+constexpr std::uint32_t compiled_version = 3;
+
+//the limits the arrays in a compiled circuit were sized with
+struct CompiledHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::int32_t max_size;
+    std::int32_t max_sources;
+    std::int32_t max_nonlinear;
+    std::int32_t max_noise;
+    std::int32_t max_nodes;
+    std::int32_t max_elements;
+};
+
+template <typename M>
+void put_matrix(ByteWriter& w, const M& m){
+    w.put(static_cast<std::int32_t>(m.rows()));
+    w.put(static_cast<std::int32_t>(m.cols()));
+    w.put(m.data(), static_cast<std::size_t>(m.size()));
+}
+
+//only takes the shape the rest of the file says it should have
+template <typename M>
+bool get_matrix(ByteReader& r, M& m, int rows, int cols){
+    std::int32_t R = 0, C = 0;
+    if(!r.get(R) || !r.get(C) || R != rows || C != cols)
+        return false;
+    m.resize(rows, cols);
+    return r.get(m.data(), static_cast<std::size_t>(m.size()));
+}
+
+bool consistent(const Netlist& net){
+    if(net.num_nodes() < 1 || net.num_nodes() > Netlist::max_nodes || net.num_elements() < 0
+       || net.num_elements() > Netlist::max_elements || net.num_probes() < 0 || net.num_probes() > Netlist::max_probes
+       || net.get_output() < 0 || net.get_output() >= net.num_nodes())
+        return false;
+    for(int i = 0; i < net.num_probes(); ++i){
+        if(net.get_probe(i) < 0 || net.get_probe(i) >= net.num_nodes())
+            return false;
+    }
+    for(int i = 0; i < net.num_elements(); ++i){
+        const Element& e = net.element(i);
+        if(static_cast<int>(e.type) > static_cast<int>(ElementType::Diode) || e.n1 < 0 || e.n2 < 0
+           || e.n1 >= net.num_nodes() || e.n2 >= net.num_nodes() || e.name[sizeof(e.name) - 1] != '\0'
+           || (e.type == ElementType::VoltageSource && e.n1 == e.n2))
+            return false;
+    }
+    return true;
+}
+
+bool in_range(int v, int lo, int hi) { return v >= lo && v < hi; }
+
+}
+
+
+MNA::MNA() : MNA(Netlist::rc_lowpass(10000.f, 10e-9f)) {}
+
+
+MNA::MNA(const Netlist& circuit, const SimplifyOptions& options) : original(circuit), simplify_options(options){
+    build();
+    update_coefficients();
+}
+
 
 float MNA::process_sample(float n){
-    b(1, 2) = n;
-    x = (((H - G)*x) + b + b_delay)/A_inv;
-    b_delay = b;
-    
-    return x(1, 2);
+    s = s_dc;
+    if(input_source >= 0)
+        s(input_source) += n;
+
+    if(!linear || !step_linear()){
+        float x_prev[max_size];
+        if(refine)
+            std::copy(x.data(), x.data() + n_unknowns, x_prev);
+
+        //x = M x + P s[n-1] + Q s, x can go in and out of the same kernel
+        const smallmatrix::Kernels& unknowns = smallmatrix::kernels(n_unknowns);
+        unknowns.multiply(M.data(), n_unknowns, x.data(), x.data());
+        unknowns.multiply_add(P.data(), n_sources, s_delay.data(), x.data());
+        unknowns.multiply_add(Q.data(), n_sources, s.data(), x.data());
+        if(refine)
+            refine_step(x_prev, s_delay.data(), s.data(), x.data());
+        if(noise_on && n_noise > 0)
+            add_noise();
+        if(n_nonlinear > 0)
+            solve_nonlinear();
+    }
+    if(adaptive && n_nonlinear > 0)
+        track_level();
+    s_delay = s;
+
+    float y = 0.0f;
+    for(int k = 0; k < n_unknowns; ++k)
+        y += out_x(k) * x(k);
+    for(int j = 0; j < n_sources; ++j)
+        y += out_s(j) * s(j);
+    return y;
+}
+
+
+void MNA::process_block(float* const* channels, int num_channels, int num_samples){
+    const int C = std::min(num_channels, max_channels);
+    for(int first = 0; first < C; first += group_channels)
+        process_group(channels, first, std::min(group_channels, C - first), num_samples);
+}
+
+
+void MNA::process_group(float* const* channels, int first, int C, int num_samples){
+    const int U = n_unknowns, S = n_sources, D = n_nonlinear;
+    const smallmatrix::Kernels& unknowns = smallmatrix::kernels(U);
+    const smallmatrix::Kernels& ports = smallmatrix::kernels(D);
+    const bool noisy = noise_on && n_noise > 0;
+
+    //the group's columns of the channel state, and its channels' s, which differ in the input row only
+    channels += first;
+    SourceGroupMatrix s_all = s_dc.replicate(1, C);
+    float* x_all = channel_x.data() + first * U;
+    float* s_delay_all = channel_s_delay.data() + first * S;
+    PortGroupMatrix p_all(D, C);
+    PortGroupMatrix i_sum(D, C);
+    float x_prev[max_size * group_channels];
+
+    for(int t = 0; t < num_samples; ++t){
+        if(input_source >= 0){
+            for(int c = 0; c < C; ++c)
+                s_all(input_source, c) = s_dc(input_source) + channels[c][t];
+        }
+
+        if(refine)
+            std::copy(x_all, x_all + U * C, x_prev);
+        unknowns.multiply_columns(M.data(), U, x_all, x_all, C);
+        unknowns.multiply_add_columns(P.data(), S, s_delay_all, x_all, C);
+        unknowns.multiply_add_columns(Q.data(), S, s_all.data(), x_all, C);
+        if(refine){
+            for(int c = 0; c < C; ++c)
+                refine_step(x_prev + c * U, s_delay_all + c * S, s_all.data() + c * S, x_all + c * U);
+        }
+
+        if(noisy){
+            NoiseGroupMatrix total(n_noise, C);
+            for(int c = 0; c < C; ++c){
+                NoiseVector w_c;
+                noise_currents(channel_i_nl_delay.col(first + c), channel_pink[first + c], w_c);
+                total.col(c) = w_c + channel_w_delay.col(first + c);
+                channel_w_delay.col(first + c) = w_c;
+            }
+            unknowns.multiply_add_columns(K_w.data(), n_noise, total.data(), x_all, C);
+        }
+
+        if(D > 0){
+            ports.multiply_columns(N.data(), U, x_all, p_all.data(), C);
+            ports.multiply_add_columns(N_s.data(), S, s_all.data(), p_all.data(), C);
+            for(int c = 0; c < C; ++c){
+                PortVector v = channel_v_nl.col(first + c);
+                PortVector i(D);
+                const PortVector i_delay = channel_i_nl_delay.col(first + c);
+                newton(p_all.col(c), v, i, i_delay);
+                channel_v_nl.col(first + c) = v;
+                channel_i_nl_delay.col(first + c) = i;
+                i_sum.col(c) = i + i_delay;
+            }
+            unknowns.multiply_sub_columns(K_x.data(), D, i_sum.data(), x_all, C);
+        }
+
+        for(int c = 0; c < C; ++c){
+            const float* x_c = x_all + c * U;
+            const float* s_c = s_all.data() + c * S;
+            float y = 0.0f;
+            for(int k = 0; k < U; ++k)
+                y += out_x(k) * x_c[k];
+            for(int j = 0; j < S; ++j){
+                y += out_s(j) * s_c[j];
+                s_delay_all[c * S + j] = s_c[j];
+            }
+            channels[c][t] = y;
+        }
+    }
+}
+
+
+void MNA::refine_step(const float* x_prev, const float* s_prev, const float* s_now, float* x_new) const{
+    const int U = n_unknowns;
+    double r[max_size] = {};
+    for(int c = 0; c < U; ++c){
+        const double xp = x_prev[c];
+        const double xn = x_new[c];
+        for(int k = 0; k < U; ++k)
+            r[k] += B_exact(k, c) * xp - A_exact(k, c) * xn;
+    }
+    for(int j = 0; j < n_sources; ++j){
+        const double sp = s_prev[j];
+        const double sn = s_now[j];
+        for(int k = 0; k < U; ++k)
+            r[k] += P_exact(k, j) * sp + Q_exact(k, j) * sn;
+    }
+
+    //the residual is the size of the float step's error, so float is plenty for the correction
+    float residual[max_size];
+    for(int k = 0; k < U; ++k)
+        residual[k] = static_cast<float>(r[k]);
+    smallmatrix::kernels(U).multiply_add(A_inverse.data(), U, residual, x_new);
+}
+
+
+void MNA::set_refinement(float tolerance){
+    refine_tolerance = tolerance;
+    refine = error_gain * std::numeric_limits<float>::epsilon() > refine_tolerance;
+}
+
+
+void MNA::spread_state(){
+    channel_x = x.replicate(1, max_channels);
+    channel_s_delay = s_delay.replicate(1, max_channels);
+    channel_v_nl = v_nl.replicate(1, max_channels);
+    channel_i_nl_delay = i_nl_delay.replicate(1, max_channels);
+    channel_w_delay = w_delay.replicate(1, max_channels);
 }
 
 
 void MNA::prepare(float sr){
     if(sr != samp_rate){
         samp_rate = sr;
+        for(int j = 0; j < n_noise; ++j){
+            pink[j].prepare(samp_rate);
+            for(auto& filters : channel_pink)
+                filters[j].prepare(samp_rate);
+        }
         update_coefficients();
     }
+    reset();
+}
+
+
+void MNA::set_rate(float sr){
+    if(sr == samp_rate)
+        return;
+    samp_rate = sr;
+    for(int j = 0; j < n_noise; ++j){
+        pink[j].prepare(samp_rate);
+        for(auto& filters : channel_pink)
+            filters[j].prepare(samp_rate);
+    }
+    update_coefficients();
+}
+
+
+void MNA::copy_state(const MNA& other){
+    x = other.x;
+    s = other.s;
+    s_dc = other.s_dc;
+    s_delay = other.s_delay;
+    v_nl = other.v_nl;
+    i_nl = other.i_nl;
+    i_nl_delay = other.i_nl_delay;
+    w = other.w;
+    w_delay = other.w_delay;
+    channel_x = other.channel_x;
+    channel_s_delay = other.channel_s_delay;
+    channel_v_nl = other.channel_v_nl;
+    channel_i_nl_delay = other.channel_i_nl_delay;
+    channel_w_delay = other.channel_w_delay;
+    v_center = other.v_center;
+    envelope = other.envelope;
+    linear = false; //the tangent here may be stale, this one finds its own
+    entry_countdown = 0;
+}
+
+
+//the poles are the finite eigenvalues of (G + gd) v = -p C v. With the shift sigma = 2 base_rate (so the
+//matrix is the A the engine factorizes at that rate) they come out of W = (G + gd + sigma C)^-1 C as
+//mu = 1/(sigma - p), and rows without a capacitor anywhere are mu = 0, poles at infinity that don't move
+int MNA::stable_oversampling(float base_rate, const OversamplingTarget& target) const {
+    MatrixD A, B;
+    SourceMatrixD A_s, B_s, F;
+    stamp_linear(1.0, A, B, A_s, B_s, F);
+    const double sigma = 2.0 * base_rate;
+    MatrixD G = 0.5 * (A - B);
+    const MatrixD C = 0.5 * (A + B);
+
+    for(int k = 0; k < n_nonlinear; ++k){
+        const double g = (static_cast<double>(target.junction_current) + i_sat[k])/n_vt[k];
+        G += g * N.row(k).transpose().cast<double>() * N.row(k).cast<double>();
+    }
+
+    const MatrixD W = Eigen::PartialPivLU<MatrixD>(G + sigma * C).solve(C);
+    const Eigen::EigenSolver<MatrixD> eigen(W, false);
+    std::complex<double> poles[max_size];
+    int n_poles = 0;
+    for(int i = 0; i < n_unknowns; ++i){
+        const std::complex<double> mu = eigen.eigenvalues()(i);
+        if(std::abs(mu) * sigma > 1e-10)
+            poles[n_poles++] = sigma - 1.0/mu;
+    }
+    return oversampling_for_poles(poles, n_poles, base_rate, target);
+}
+
+
+bool MNA::reset(float input){
+    s = s_dc;
+    if(input_source >= 0)
+        s(input_source) += input;
+    s_delay = s;
+    w = NoiseVector::Zero(n_noise);
+    w_delay = NoiseVector::Zero(n_noise);
+
+    const bool found = solve_operating_point();
+    if(!found)
+        x = Vector::Zero(n_unknowns);
+
+    //the diode currents the trapezoid carries over are the ones at that point
+    v_nl = N*x + N_s*s;
+    for(int k = 0; k < n_nonlinear; ++k){
+        float g;
+        i_nl(k) = junction_current(k, v_nl(k), g);
+    }
+    i_nl_delay = i_nl;
+    v_center = v_nl;
+    envelope = 0.0f;
+    linear = false;
+    entry_countdown = 0;
+    spread_state();
+    return found;
 }
 
 
 void MNA::set_knobs(float capacitor, float resistor){
-    if(capacitor != Cap){
-        Cap = capacitor;
-        update_coefficients();
+    //only refresh once even if both knobs moved
+    bool changed = false;
+    const int c = original.find("C1");
+    if(c >= 0 && capacitor != original.element(c).value){
+        original.element(c).value = capacitor;
+        changed = true;
     }
-    
-    if(resistor != Res){
-        Res = resistor;
+
+    const int r = original.find("R1");
+    if(r >= 0 && resistor != original.element(r).value){
+        original.element(r).value = resistor;
+        changed = true;
+    }
+
+    if(changed)
         update_coefficients();
+}
+
+
+bool MNA::set_value(const char* name, float v){
+    const int i = original.find(name);
+    if(i < 0)
+        return false;
+
+    if(original.element(i).value != v){
+        original.element(i).value = v;
+        update_coefficients();
+    }
+    return true;
+}
+
+
+void MNA::set_noise(bool enabled, float temp, std::uint32_t seed){
+    noise_on = enabled;
+    temperature = temp;
+    normals.prepare(n_noise, 256, seed);
+    for(int j = 0; j < n_noise; ++j){
+        pink[j].prepare(samp_rate);
+        for(auto& filters : channel_pink)
+            filters[j].prepare(samp_rate);
+    }
+    w = NoiseVector::Zero(n_noise);
+    w_delay = NoiseVector::Zero(n_noise);
+    update_coefficients();
+}
+
+
+//noise currents go through the trapezoid like every other current, so it's w[n] + w[n-1]
+void MNA::set_adaptive(bool enabled, float tolerance, float release){
+    adaptive = enabled;
+    linear_tolerance = tolerance;
+    release_ms = release;
+    envelope_release = std::exp(-1.0f/(release_ms * 0.001f * samp_rate));
+    center_coefficient = 1.0f - envelope_release;
+    linear = false;
+    envelope = 0.0f;
+    entry_countdown = 0;
+    v_center = v_nl;
+}
+
+
+void MNA::track_level(){
+    float swing = 0.0f;
+    for(int k = 0; k < n_nonlinear; ++k){
+        v_center(k) += center_coefficient * (v_nl(k) - v_center(k));
+        swing = std::fmax(swing, std::fabs(v_nl(k) - v_center(k))/n_vt[k]);
+    }
+    envelope = std::fmax(swing, envelope * envelope_release);
+
+    if(linear || --entry_countdown > 0)
+        return;
+    entry_countdown = entry_interval;
+    if(noise_on && n_noise > 0)
+        return;
+
+    //hysteresis: out at the edge of a window, back in only with the swing inside half of every one
+    linear = tangent(2.0f * envelope) && linearize();
+}
+
+
+bool MNA::tangent(float min_window){
+    const int D = n_nonlinear;
+    v_lin = v_center;
+    i_lin.resize(D);
+    g_lin.resize(D);
+    for(int k = 0; k < D; ++k){
+        float g;
+        i_lin(k) = junction_current(k, v_lin(k), g);
+        g_lin(k) = g;
+    }
+
+    //the tangent's current error is (i_lin + i_sat)(e^u - 1 - u) at u = (v - v_lin)/n_vt. Held for a while
+    //it settles through the port impedance at DC, so the window edge is where that error times the row sum
+    //of Z(0) hits the tolerance. e^u - 1 - u = a above and e^-u - 1 + u = a below, the upper edge is the
+    //nearer one and under both of these, so a window that's too narrow is out before any iterating
+    double a[max_nonlinear];
+    auto scale = [&](int k, const double* z){
+        double r = 0.0;
+        for(int j = 0; j < D; ++j)
+            r += std::fabs(z[j * D + k]);
+        a[k] = linear_tolerance/(r * (static_cast<double>(i_lin(k)) + i_sat[k]));
+        return a[k] > 0.0 && std::fmin(std::sqrt(2.0 * a[k]), std::log(1.0 + a[k] + std::sqrt(2.0 * a[k]))) > min_window;
+    };
+
+    //RC port impedances only shrink going up the real axis, so the one at 2/T, (I + K G)^-1 K with the
+    //tangents' conductances across the ports, gives a first cheap cut
+    using PortUnknownMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_size>;
+    using UnknownPortMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_nonlinear>;
+    using PortMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_nonlinear>;
+    const PortMatrixD Kd = K.cast<double>();
+    const PortMatrixD Kg = PortMatrixD(PortMatrixD::Identity(D, D) + Kd * g_lin.cast<double>().asDiagonal()).partialPivLu().solve(Kd);
+    double z[max_nonlinear * max_nonlinear];
+    std::copy(Kg.data(), Kg.data() + D * D, z);
+    for(int k = 0; k < D; ++k){
+        if(!scale(k, z))
+            return false;
+    }
+
+    MatrixD G, unused;
+    SourceMatrixD unused_s, unused_b, unused_f;
+    stamp_linear(0.0, G, unused, unused_s, unused_b, unused_f);
+    const PortUnknownMatrixD Nd = N.cast<double>();
+    G += Nd.transpose() * g_lin.cast<double>().asDiagonal() * Nd;
+    const Eigen::PartialPivLU<MatrixD> lu(G);
+    if(!(std::fabs(lu.determinant()) > 0.0))
+        return false; //no dc path, errors pile up on a capacitor with nothing to drain them
+    const PortMatrixD Z = Nd * lu.solve(UnknownPortMatrixD(Nd.transpose()));
+    if(!Z.allFinite())
+        return false;
+    std::copy(Z.data(), Z.data() + D * D, z);
+
+    for(int k = 0; k < D; ++k){
+        if(!scale(k, z))
+            return false;
+
+        //both convex, so newton from the right gets there
+        double hi = std::fmin(std::sqrt(2.0 * a[k]), std::log(1.0 + a[k] + std::sqrt(2.0 * a[k])));
+        double lo = a[k] + 1.0;
+        for(int it = 0; it < 30 && a[k] < 1e30; ++it){
+            const double step = (std::expm1(hi) - hi - a[k])/std::expm1(hi);
+            hi -= step;
+            if(step < 1e-9 * hi)
+                break;
+        }
+        for(int it = 0; it < 30 && a[k] < 1e30; ++it){
+            const double step = (std::expm1(-lo) + lo - a[k])/-std::expm1(-lo);
+            lo -= step;
+            if(step < 1e-9 * lo)
+                break;
+        }
+        if(hi <= min_window)
+            return false;
+        window_hi[k] = static_cast<float>(std::fmin(hi, 1e6) * n_vt[k]);
+        window_lo[k] = static_cast<float>(std::fmin(lo, 1e6) * n_vt[k]);
+    }
+    return true;
+}
+
+
+//the tangents folded into the update. With i = i_lin + G (v - v_lin) for this sample and the last one,
+//and v = N x + N_s s,
+//    x[n] = M x[n-1] + P s[n-1] + Q s - K_x (i[n] + i[n-1])
+//becomes (I + K_x G N) x[n] = (M - K_x G N) x[n-1] + (P - K_x G N_s) s[n-1] + (Q - K_x G N_s) s - 2 K_x (i_lin - G v_lin)
+bool MNA::linearize(){
+    const int U = n_unknowns;
+
+    using PortUnknownMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_size>;
+    using UnknownPortMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_nonlinear>;
+    using PortSourceMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_sources>;
+    const UnknownPortMatrixD KG = K_x.cast<double>() * g_lin.cast<double>().asDiagonal();
+    const MatrixD KGN = KG * PortUnknownMatrixD(N.cast<double>());
+    const SourceMatrixD KGN_s = KG * PortSourceMatrixD(N_s.cast<double>());
+    const Eigen::PartialPivLU<MatrixD> lu(MatrixD(MatrixD::Identity(U, U) + KGN));
+    if(!(std::fabs(lu.determinant()) > 1e-12))
+        return false;
+
+    M_lin = lu.solve(MatrixD(M.cast<double>() - KGN)).cast<float>();
+    P_lin = lu.solve(SourceMatrixD(P.cast<double>() - KGN_s)).cast<float>();
+    Q_lin = lu.solve(SourceMatrixD(Q.cast<double>() - KGN_s)).cast<float>();
+    const VectorD offset = -2.0 * K_x.cast<double>() * (i_lin.cast<double>() - g_lin.cast<double>().cwiseProduct(v_lin.cast<double>()));
+    c_lin = lu.solve(offset).cast<float>();
+    return M_lin.allFinite() && P_lin.allFinite() && Q_lin.allFinite() && c_lin.allFinite();
+}
+
+
+bool MNA::step_linear(){
+    const int U = n_unknowns, D = n_nonlinear;
+    const smallmatrix::Kernels& unknowns = smallmatrix::kernels(U);
+    const smallmatrix::Kernels& ports = smallmatrix::kernels(D);
+    float before[max_size];
+    std::copy(x.data(), x.data() + U, before);
+
+    unknowns.multiply(M_lin.data(), U, x.data(), x.data());
+    unknowns.multiply_add(P_lin.data(), n_sources, s_delay.data(), x.data());
+    unknowns.multiply_add(Q_lin.data(), n_sources, s.data(), x.data());
+    for(int r = 0; r < U; ++r)
+        x(r) += c_lin(r);
+
+    float v[max_nonlinear];
+    ports.multiply(N.data(), U, x.data(), v);
+    ports.multiply_add(N_s.data(), n_sources, s.data(), v);
+    for(int k = 0; k < D; ++k){
+        const float d = v[k] - v_lin(k);
+        if(d > window_hi[k] || -d > window_lo[k]){
+            std::copy(before, before + U, x.data());
+            linear = false;
+            return false;
+        }
+    }
+
+    //what the full model picks up from if the next sample is a loud one
+    for(int k = 0; k < D; ++k){
+        v_nl(k) = v[k];
+        i_nl(k) = i_lin(k) + g_lin(k) * (v[k] - v_lin(k));
+    }
+    i_nl_delay = i_nl;
+    return true;
+}
+
+
+void MNA::add_noise(){
+    noise_currents(i_nl_delay, pink, w);
+    float total[max_noise];
+    for(int j = 0; j < n_noise; ++j)
+        total[j] = w(j) + w_delay(j);
+    smallmatrix::kernels(n_unknowns).multiply_add(K_w.data(), n_noise, total, x.data());
+    w_delay = w;
+}
+
+
+void MNA::noise_currents(const PortVector& i_delay, PinkFilter* filters, NoiseVector& out){
+    const float* z = normals.next();
+    out.resize(n_noise);
+    for(int j = 0; j < n_noise; ++j){
+        const NoiseSource& ns = noise_sources[j];
+        if(ns.kind == NoiseKind::Thermal){
+            out(j) = ns.sigma * z[j];
+        }
+        else{
+            const float current = std::fabs(i_delay(ns.port));
+            if(ns.kind == NoiseKind::Shot){
+                out(j) = std::sqrt(noise::shot_current_variance(current, samp_rate)) * z[j];
+            }
+            else{
+                //pink filter is unity at 1 kHz, so scale to kf*|I|/f there
+                const float kf = reduced.element(ns.element).kf;
+                out(j) = std::sqrt(kf * current * samp_rate/2000.0f) * filters[j].process(z[j]);
+            }
+        }
+    }
+}
+
+
+int MNA::source_index(const char* name) const{
+    const int i = reduced.find(name);
+    for(int j = 0; j < n_sources; ++j){
+        if(source_element[j] == i)
+            return j;
+    }
+    return -1;
+}
+
+
+float MNA::probe_voltage(int probe) const{
+    const int node = reduced.get_probe(probe);
+    if(unknown_of_node[node] >= 0)
+        return x(unknown_of_node[node]);
+    if(pinned_by[node] >= 0)
+        return pinned_sign[node] * s(pinned_by[node]);
+    return 0.0f;
+}
+
+
+//shockley current through diode k and its conductance
+float MNA::junction_current(int k, float v, float& g) const{
+    const float u = v/n_vt[k];
+    if(!junction_table.empty() && u < junction_table.axes()[0].last()){
+        float slope;
+        const float i = i_sat[k] * junction_table.lookup(u, slope);
+        g = i_sat[k] * slope/n_vt[k];
+        return i;
+    }
+
+    const float e = fastmath::exp(u, accuracy);
+    g = i_sat[k] * e/n_vt[k];
+    return i_sat[k] * (e - 1.0f);
+}
+
+
+void MNA::set_diode_table(bool enabled, const DiskCache* cache){
+    if(!enabled){
+        junction_table = LookupTable<1>();
+        return;
+    }
+
+    //16 cells per thermal voltage keeps it within float rounding of the exp, below -24 it's flat at -1
+    //and above 24 the current is in the kiloamps so we just fall back to exp
+    constexpr float lo = -24.0f, hi = 24.0f;
+    constexpr int num_points = 48 * 16 + 1;
+    auto build = [&](LookupTable<1>& table){
+        const TableAxis grid = TableAxis::uniform(lo, hi, num_points);
+        std::vector<float> values(static_cast<std::size_t>(grid.num_points()));
+        std::vector<float> slopes(values.size());
+        for(int i = 0; i < grid.num_points(); ++i){
+            const double u = grid.point(i);
+            values[static_cast<std::size_t>(i)] = static_cast<float>(std::expm1(u));
+            slopes[static_cast<std::size_t>(i)] = static_cast<float>(std::exp(u));
+        }
+        table.build_hermite(grid, values, slopes);
+    };
+
+    if(!cache){
+        build(junction_table);
+        return;
+    }
+
+    //normalized to u = v/n_vt, so one entry serves every diode of every circuit at every rate. The version
+    //goes up whenever build() puts something else in, so nobody maps an entry an older build left behind
+    constexpr std::uint32_t junction_table_version = 1;
+    const float shape[] = {lo, hi, static_cast<float>(num_points)};
+    CacheKey key;
+    key.settings = cache::hash_bytes(shape, sizeof(shape), cache::hash_bytes(&junction_table_version, sizeof(junction_table_version)));
+    key.kind = make_kind('J', 'T', 'A', 'B');
+    cache->table(key, junction_table, build);
+}
+
+
+//newton on the diode voltages only, x holds the linear part of the update coming in
+void MNA::solve_nonlinear(){
+    const smallmatrix::Kernels& ports = smallmatrix::kernels(n_nonlinear);
+    PortVector p(n_nonlinear);
+    ports.multiply(N.data(), n_unknowns, x.data(), p.data());
+    ports.multiply_add(N_s.data(), n_sources, s.data(), p.data());
+    newton(p, v_nl, i_nl, i_nl_delay);
+
+    float total[max_nonlinear];
+    for(int k = 0; k < n_nonlinear; ++k)
+        total[k] = i_nl(k) + i_nl_delay(k);
+    smallmatrix::kernels(n_unknowns).multiply_sub(K_x.data(), n_nonlinear, total, x.data());
+    i_nl_delay = i_nl;
+}
+
+
+void MNA::newton(const PortVector& p, PortVector& v, PortVector& i, const PortVector& i_delay) const{
+    const int D = n_nonlinear;
+    const smallmatrix::Kernels& ports = smallmatrix::kernels(D);
+    float g[max_nonlinear];
+    float total[max_nonlinear];
+    float dv[max_nonlinear];
+    float J[max_nonlinear * max_nonlinear];
+
+    for(int it = 0; it < max_newton_iterations; ++it){
+        for(int k = 0; k < D; ++k){
+            i(k) = junction_current(k, v(k), g[k]);
+            total[k] = i(k) + i_delay(k);
+        }
+
+        //F(v) = p - K(i(v) + i[n-1]) - v, and the jacobian is -(I + K diag(g))
+        ports.multiply(K.data(), D, total, dv);
+        for(int k = 0; k < D; ++k)
+            dv[k] = p(k) - dv[k] - v(k);
+        if(D == 1){
+            dv[0] /= 1.0f + K(0, 0) * g[0];
+        }
+        else{
+            for(int c = 0; c < D; ++c){
+                for(int r = 0; r < D; ++r)
+                    J[c * D + r] = K(r, c) * g[c];
+                J[c * D + c] += 1.0f;
+            }
+            if(!ports.solve(J, dv))
+                break; //(near) singular, keep the last iterate rather than step off to inf
+        }
+
+        //spice style junction limiting so a big forward step can't blow up the exp
+        float step = 0.0f;
+        for(int k = 0; k < D; ++k){
+            float v_new = v(k) + dv[k];
+            if(dv[k] > 2.0f * n_vt[k] && v_new > 0.0f)
+                v_new = v(k) + n_vt[k] * fastmath::log(1.0f + dv[k]/n_vt[k], accuracy);
+            step = std::fmax(step, std::fabs(v_new - v(k)));
+            v(k) = v_new;
+        }
+
+        if(step < 1e-6f)
+            break;
+    }
+
+    for(int k = 0; k < D; ++k){
+        float g_k;
+        i(k) = junction_current(k, v(k), g_k);
+    }
+}
+
+
+//dc operating point for the sources in s: capacitors open, so
+//    G x + N^T i(N x + N_s s) = (F - G_s) s
+//newton straight away first, then gmin stepping, then source stepping if the diodes won't have it
+bool MNA::solve_operating_point(){
+    MatrixD G, unused;
+    SourceMatrixD G_s, unused_s, F;
+    stamp_linear(0.0, G, unused, G_s, unused_s, F);
+
+    using PortUnknownMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_size>;
+    using PortVectorD = Eigen::Matrix<double, Eigen::Dynamic, 1, 0, max_nonlinear, 1>;
+    const PortUnknownMatrixD Nd = N.cast<double>();
+    const VectorD b = (F - G_s) * s.cast<double>();
+    const PortVectorD p = (N_s * s).cast<double>();
+
+    //gmin only goes on node rows, a floating source's current row has to stay exact
+    VectorD node_row = VectorD::Ones(n_unknowns);
+    for(int j = 0; j < n_sources; ++j){
+        if(floating_row[j] >= 0)
+            node_row(floating_row[j]) = 0.0;
+    }
+
+    auto newton = [&](double gmin, double scale, VectorD& xd){
+        for(int it = 0; it < 200; ++it){
+            const PortVectorD v = Nd * xd + scale * p;
+            PortVectorD i(n_nonlinear), g(n_nonlinear);
+            for(int k = 0; k < n_nonlinear; ++k){
+                const double e = std::exp(v(k)/n_vt[k]);
+                i(k) = i_sat[k] * (e - 1.0);
+                g(k) = i_sat[k] * e/n_vt[k];
+            }
+
+            const VectorD r = G * xd + Nd.transpose() * i - scale * b + gmin * node_row.cwiseProduct(xd);
+            MatrixD J = G + Nd.transpose() * g.asDiagonal() * Nd;
+            J.diagonal() += gmin * node_row;
+            const VectorD dx = J.partialPivLu().solve(r);
+            if(!dx.allFinite())
+                return false;
+
+            //keep every junction within a few thermal voltages of where it was
+            double step = 1.0;
+            const PortVectorD dv = Nd * dx;
+            for(int k = 0; k < n_nonlinear; ++k){
+                if(std::fabs(dv(k)) > 4.0 * n_vt[k])
+                    step = std::fmin(step, 4.0 * n_vt[k]/std::fabs(dv(k)));
+            }
+            xd -= step * dx;
+            if(step * dx.cwiseAbs().maxCoeff() < 1e-9 * (1.0 + xd.cwiseAbs().maxCoeff()))
+                return xd.allFinite();
+        }
+        return false;
+    };
+
+    auto accept = [&](const VectorD& xd){
+        x = xd.cast<float>();
+        return true;
+    };
+
+    VectorD xd = VectorD::Zero(n_unknowns);
+    if(newton(0.0, 1.0, xd))
+        return accept(xd);
+
+    //a node that only sees capacitors has no dc path, so the last rung (1e-12) is kept if 0 fails
+    constexpr double gmin_floor = 1e-12;
+    xd.setZero();
+    bool ok = true;
+    for(double gmin = 1e-2; ok && gmin >= gmin_floor; gmin *= 0.1)
+        ok = newton(gmin, 1.0, xd);
+    if(ok){
+        VectorD exact = xd;
+        return accept(newton(0.0, 1.0, exact) ? exact : xd);
+    }
+
+    xd.setZero();
+    ok = true;
+    for(int step = 1; ok && step <= 20; ++step)
+        ok = newton(gmin_floor, step/20.0, xd);
+    if(ok){
+        VectorD exact = xd;
+        return accept(newton(0.0, 1.0, exact) ? exact : xd);
+    }
+    return false;
+}
+
+
+bool MNA::save(std::vector<unsigned char>& out) const{
+    out.clear();
+    ByteWriter w(out);
+    const CompiledHeader header{{compiled_magic[0], compiled_magic[1], compiled_magic[2], compiled_magic[3]}, compiled_version,
+                                max_size, max_sources, max_nonlinear, max_noise, Netlist::max_nodes, Netlist::max_elements};
+    w.put(header);
+
+    w.put(original);
+    w.put(simplify_options);
+    w.put(reduced);
+    w.put(reduction);
+    w.put(unknown_of_node, Netlist::max_nodes);
+    w.put(pinned_by, Netlist::max_nodes);
+    w.put(pinned_sign, Netlist::max_nodes);
+    w.put(source_element, max_sources);
+    w.put(floating_row, max_sources);
+    w.put(diode_element, max_nonlinear);
+    w.put(n_unknowns);
+    w.put(n_sources);
+    w.put(n_nonlinear);
+    w.put(input_source);
+    w.put(samp_rate);
+    w.put(T);
+
+    put_matrix(w, M);
+    put_matrix(w, P);
+    put_matrix(w, Q);
+    put_matrix(w, out_x);
+    put_matrix(w, out_s);
+    put_matrix(w, A_exact);
+    put_matrix(w, B_exact);
+    put_matrix(w, P_exact);
+    put_matrix(w, Q_exact);
+    put_matrix(w, A_inverse);
+    w.put(error_gain);
+    put_matrix(w, N);
+    put_matrix(w, N_s);
+    put_matrix(w, K_x);
+    put_matrix(w, K);
+    w.put(i_sat, max_nonlinear);
+    w.put(n_vt, max_nonlinear);
+
+    w.put(noise_sources, max_noise);
+    w.put(n_noise);
+    w.put(temperature);
+    put_matrix(w, K_w);
+
+    put_matrix(w, x);
+    put_matrix(w, s);
+    put_matrix(w, s_dc);
+    put_matrix(w, s_delay);
+    put_matrix(w, v_nl);
+    put_matrix(w, i_nl);
+    put_matrix(w, i_nl_delay);
+    return true;
+}
+
+
+bool MNA::load(const void* data, std::size_t size){
+    ByteReader r(data, size);
+    CompiledHeader header{};
+    if(!r.get(header) || std::memcmp(header.magic, compiled_magic, sizeof(compiled_magic)) != 0
+       || header.version != compiled_version || header.max_size != max_size || header.max_sources != max_sources
+       || header.max_nonlinear != max_nonlinear || header.max_noise != max_noise
+       || header.max_nodes != Netlist::max_nodes || header.max_elements != Netlist::max_elements)
+        return false;
+
+    //fill a copy, so a bad file never leaves this one half loaded
+    MNA c(*this);
+    bool ok = r.get(c.original) && r.get(c.simplify_options) && r.get(c.reduced) && r.get(c.reduction)
+              && consistent(c.original) && consistent(c.reduced) && c.reduction.valid() && c.reduction.consistent()
+              && c.reduction.n_original == c.original.num_elements() && c.reduction.n_reduced == c.reduced.num_elements()
+              && r.get(c.unknown_of_node, Netlist::max_nodes) && r.get(c.pinned_by, Netlist::max_nodes)
+              && r.get(c.pinned_sign, Netlist::max_nodes) && r.get(c.source_element, max_sources)
+              && r.get(c.floating_row, max_sources) && r.get(c.diode_element, max_nonlinear)
+              && r.get(c.n_unknowns) && r.get(c.n_sources) && r.get(c.n_nonlinear) && r.get(c.input_source)
+              && r.get(c.samp_rate) && r.get(c.T)
+              && in_range(c.n_unknowns, 0, max_size + 1) && in_range(c.n_sources, 0, max_sources + 1)
+              && in_range(c.n_nonlinear, 0, max_nonlinear + 1) && in_range(c.input_source, -1, c.n_sources)
+              && c.samp_rate > 0.0f;
+    if(!ok)
+        return false;
+
+    //every index has to land inside what it indexes, the audio path doesn't check
+    for(int n = 0; n < Netlist::max_nodes; ++n)
+        ok = ok && in_range(c.unknown_of_node[n], -1, c.n_unknowns) && in_range(c.pinned_by[n], -1, c.n_sources);
+    for(int j = 0; j < c.n_sources; ++j){
+        ok = ok && in_range(c.source_element[j], 0, c.reduced.num_elements()) && in_range(c.floating_row[j], -1, c.n_unknowns)
+             && c.reduced.element(c.source_element[j]).type == ElementType::VoltageSource;
+    }
+    for(int k = 0; k < c.n_nonlinear; ++k)
+        ok = ok && in_range(c.diode_element[k], 0, c.reduced.num_elements()) && c.reduced.element(c.diode_element[k]).type == ElementType::Diode;
+
+    const int U = c.n_unknowns, S = c.n_sources, D = c.n_nonlinear;
+    ok = ok && get_matrix(r, c.M, U, U) && get_matrix(r, c.P, U, S) && get_matrix(r, c.Q, U, S)
+         && get_matrix(r, c.out_x, U, 1) && get_matrix(r, c.out_s, S, 1)
+         && get_matrix(r, c.A_exact, U, U) && get_matrix(r, c.B_exact, U, U) && get_matrix(r, c.P_exact, U, S)
+         && get_matrix(r, c.Q_exact, U, S) && get_matrix(r, c.A_inverse, U, U) && r.get(c.error_gain)
+         && get_matrix(r, c.N, D, U) && get_matrix(r, c.N_s, D, S) && get_matrix(r, c.K_x, U, D) && get_matrix(r, c.K, D, D)
+         && r.get(c.i_sat, max_nonlinear) && r.get(c.n_vt, max_nonlinear)
+         && r.get(c.noise_sources, max_noise) && r.get(c.n_noise) && r.get(c.temperature)
+         && in_range(c.n_noise, 0, max_noise + 1);
+    for(int j = 0; ok && j < c.n_noise; ++j){
+        const NoiseSource& ns = c.noise_sources[j];
+        ok = in_range(static_cast<int>(ns.kind), 0, 3) && in_range(ns.element, 0, c.reduced.num_elements())
+             && (ns.kind == NoiseKind::Thermal || in_range(ns.port, 0, D));
+    }
+    ok = ok && get_matrix(r, c.K_w, U, c.n_noise)
+         && get_matrix(r, c.x, U, 1) && get_matrix(r, c.s, S, 1) && get_matrix(r, c.s_dc, S, 1) && get_matrix(r, c.s_delay, S, 1)
+         && get_matrix(r, c.v_nl, D, 1) && get_matrix(r, c.i_nl, D, 1) && get_matrix(r, c.i_nl_delay, D, 1);
+    if(!ok)
+        return false;
+
+    //accuracy, the diode table and the refinement tolerance stay what they were here, noise starts off
+    //like in a fresh engine
+    c.set_refinement(c.refine_tolerance);
+    c.noise_on = false;
+    for(int j = 0; j < c.n_noise; ++j){
+        c.pink[j].prepare(c.samp_rate);
+        for(auto& filters : c.channel_pink)
+            filters[j].prepare(c.samp_rate);
+    }
+    c.w = NoiseVector::Zero(c.n_noise);
+    c.w_delay = NoiseVector::Zero(c.n_noise);
+    c.v_center = c.v_nl;
+    c.envelope = 0.0f;
+    c.linear = false;
+    c.entry_countdown = 0;
+    c.spread_state();
+    *this = c;
+    return true;
+}
+
+
+//works out which node becomes which unknown. The simplified topology only depends on the
+//structure of the original netlist, not on its values, so this only has to run once
+void MNA::build(){
+    reduced = simplify(original, simplify_options, &reduction);
+    if(!reduction.valid())
+        throw std::length_error("MNA: simplification took too many steps to replay");
+
+    for(int n = 0; n < Netlist::max_nodes; ++n){
+        unknown_of_node[n] = -1;
+        pinned_by[n] = -1;
+        pinned_sign[n] = 0.0f;
+    }
+
+    //sources first: grounded ones pin their node, the rest need a current unknown
+    n_sources = 0;
+    input_source = -1;
+    for(int i = 0; i < reduced.num_elements(); ++i){
+        const Element& e = reduced.element(i);
+        if(e.type != ElementType::VoltageSource)
+            continue;
+        if(n_sources >= max_sources)
+            throw std::length_error("MNA: too many voltage sources");
+
+        const int j = n_sources++;
+        source_element[j] = i;
+        floating_row[j] = -1;
+        if(e.is_input && input_source < 0)
+            input_source = j;
+
+        if(e.n2 == 0 && pinned_by[e.n1] < 0){
+            pinned_by[e.n1] = j;
+            pinned_sign[e.n1] = 1.0f;
+        }
+        else if(e.n1 == 0 && pinned_by[e.n2] < 0){
+            pinned_by[e.n2] = j;
+            pinned_sign[e.n2] = -1.0f;
+        }
+    }
+
+    n_unknowns = 0;
+    for(int n = 1; n < reduced.num_nodes(); ++n){
+        if(pinned_by[n] < 0)
+            unknown_of_node[n] = n_unknowns++;
+    }
+
+    for(int j = 0; j < n_sources; ++j){
+        const Element& e = reduced.element(source_element[j]);
+        const bool pins = (e.n2 == 0 && pinned_by[e.n1] == j) || (e.n1 == 0 && pinned_by[e.n2] == j);
+        if(!pins)
+            floating_row[j] = n_unknowns++;
+    }
+
+    if(n_unknowns > max_size)
+        throw std::length_error("MNA: circuit is still too big after simplification");
+
+    n_nonlinear = 0;
+    for(int i = 0; i < reduced.num_elements(); ++i){
+        if(reduced.element(i).type != ElementType::Diode)
+            continue;
+        if(n_nonlinear >= max_nonlinear)
+            throw std::length_error("MNA: too many nonlinear elements");
+        diode_element[n_nonlinear++] = i;
+    }
+
+    //the partition inverts A, the circuit with its diodes taken out, so every node has to reach ground
+    //through something other than a diode. Floating behind diodes it's only the diodes that pin it down,
+    //and K comes out singular (or, with a gmin, too stiff for a float newton)
+    int group[Netlist::max_nodes];
+    for(int n = 0; n < Netlist::max_nodes; ++n)
+        group[n] = n;
+    auto root = [&](int n){
+        while(group[n] != n)
+            n = group[n] = group[group[n]];
+        return n;
+    };
+    for(int i = 0; i < reduced.num_elements(); ++i){
+        const Element& e = reduced.element(i);
+        if(e.type != ElementType::Diode)
+            group[root(e.n1)] = root(e.n2);
+    }
+    for(int k = 0; k < n_nonlinear; ++k){
+        const Element& e = reduced.element(diode_element[k]);
+        if(root(e.n1) != root(0) || root(e.n2) != root(0))
+            throw std::invalid_argument(std::string("MNA: a node on ") + e.name + " only reaches ground through diodes");
+    }
+    v_nl = PortVector::Zero(n_nonlinear);
+    i_nl = PortVector::Zero(n_nonlinear);
+    i_nl_delay = PortVector::Zero(n_nonlinear);
+    v_center = PortVector::Zero(n_nonlinear);
+    linear = false;
+
+    n_noise = 0;
+    auto add_noise_source = [&](NoiseKind kind, int element, int port){
+        if(n_noise >= max_noise)
+            throw std::length_error("MNA: too many noise sources");
+        noise_sources[n_noise++] = NoiseSource{kind, element, port, 0.0f};
+    };
+    for(int i = 0; i < reduced.num_elements(); ++i){
+        const Element& e = reduced.element(i);
+        if(e.type == ElementType::Resistor && (e.noise & NoiseThermal))
+            add_noise_source(NoiseKind::Thermal, i, -1);
+    }
+    for(int k = 0; k < n_nonlinear; ++k){
+        const Element& e = reduced.element(diode_element[k]);
+        if(e.noise & NoiseShot)
+            add_noise_source(NoiseKind::Shot, diode_element[k], k);
+        if(e.noise & NoiseFlicker)
+            add_noise_source(NoiseKind::Flicker, diode_element[k], k);
+    }
+    w = NoiseVector::Zero(n_noise);
+    w_delay = NoiseVector::Zero(n_noise);
+
+    x = Vector::Zero(n_unknowns);
+    s = SourceVector::Zero(n_sources);
+    s_dc = SourceVector::Zero(n_sources);
+    s_delay = SourceVector::Zero(n_sources);
+    spread_state();
+
+    out_x = Vector::Zero(n_unknowns);
+    out_s = SourceVector::Zero(n_sources);
+    const int out = reduced.get_output();
+    if(unknown_of_node[out] >= 0)
+        out_x(unknown_of_node[out]) = 1.0f;
+    else if(pinned_by[out] >= 0)
+        out_s(pinned_by[out]) = pinned_sign[out];
+}
+
+
+void MNA::stamp_linear(double capacitor_scale, MatrixD& A, MatrixD& B, SourceMatrixD& A_s, SourceMatrixD& B_s, SourceMatrixD& F) const {
+    A = MatrixD::Zero(n_unknowns, n_unknowns); //G + H on the unknowns
+    B = MatrixD::Zero(n_unknowns, n_unknowns); //H - G on the unknowns
+    A_s = SourceMatrixD::Zero(n_unknowns, n_sources); //same thing for columns pinned by sources
+    B_s = SourceMatrixD::Zero(n_unknowns, n_sources);
+    F = SourceMatrixD::Zero(n_unknowns, n_sources); //floating source voltages on the rhs
+
+    //adds g to (row, col) of G and h to (row, col) of H, routing pinned columns to the source side
+    auto stamp = [&](int row_node, int col_node, double g, double h){
+        const int row = unknown_of_node[row_node];
+        if(row < 0)
+            return;
+        const int col = unknown_of_node[col_node];
+        if(col >= 0){
+            A(row, col) += g + h;
+            B(row, col) += h - g;
+        }
+        else if(pinned_by[col_node] >= 0){
+            const int j = pinned_by[col_node];
+            A_s(row, j) += (g + h) * pinned_sign[col_node];
+            B_s(row, j) += (h - g) * pinned_sign[col_node];
+        }
+    };
+
+    auto stamp_branch = [&](int n1, int n2, double g, double h){
+        stamp(n1, n1, g, h);
+        stamp(n2, n2, g, h);
+        stamp(n1, n2, -g, -h);
+        stamp(n2, n1, -g, -h);
+    };
+
+    for(int i = 0; i < reduced.num_elements(); ++i){
+        const Element& e = reduced.element(i);
+        if(e.type == ElementType::Resistor)
+            stamp_branch(e.n1, e.n2, 1.0/e.value, 0.0);
+        else if(e.type == ElementType::Capacitor)
+            stamp_branch(e.n1, e.n2, 0.0, capacitor_scale * e.value);
+    }
+
+    for(int j = 0; j < n_sources; ++j){
+        const Element& e = reduced.element(source_element[j]);
+        const int k = floating_row[j];
+        if(k < 0)
+            continue;
+
+        //source current enters n1 and leaves n2, and the row says V(n1) - V(n2) = E
+        auto couple = [&](int node, double sign){
+            const int u = unknown_of_node[node];
+            if(u >= 0){
+                A(u, k) += sign;
+                B(u, k) -= sign;
+                A(k, u) += sign;
+                B(k, u) -= sign;
+            }
+            else if(pinned_by[node] >= 0){
+                A_s(k, pinned_by[node]) += sign * pinned_sign[node];
+                B_s(k, pinned_by[node]) -= sign * pinned_sign[node];
+            }
+        };
+        couple(e.n1, 1.0);
+        couple(e.n2, -1.0);
+        F(k, j) = 1.0;
     }
 }
 
 
 void MNA::update_coefficients(){
-    //lol this is def not the best way to do this and im pretty sure its not memory safe
-    G = Eigen::Matrix<float, 3, 3> {{1/Res, -1/Res, 1},
-        {-1/Res, 1/Res, 0},
-        {1, 0, 0}};
-    
-    C = Eigen::Matrix<float, 3, 3> {{0, 0, 0},
-        {0, Cap, 0},
-        {0, 0, 0}};
-    
-    H = (2*C)/T;
-    A = G + H;
-    A_inv = A.inverse();
     T = 1/samp_rate;
+    reduction.apply(original, reduced); //same shape as in build(), just fresh values
+
+    //stamp in double, the RESISTOR/CAPACITOR ranges make these badly scaled in float
+    MatrixD A, B;
+    SourceMatrixD A_s, B_s, F;
+    stamp_linear(2.0/T, A, B, A_s, B_s, F);
+    for(int j = 0; j < n_sources; ++j)
+        s_dc(j) = reduced.element(source_element[j]).value;
+
+    const Eigen::PartialPivLU<MatrixD> lu(A);
+    const MatrixD Md = lu.solve(B);
+    M = Md.cast<float>();
+    P = lu.solve(B_s + F).cast<float>();
+    Q = lu.solve(F - A_s).cast<float>();
+
+    //keep the exact step around for refinement, and work out whether it's needed at these values: an
+    //error e in one step turns into (I - M)^-1 e once it's gone round the recursion
+    A_exact = A;
+    B_exact = B;
+    P_exact = B_s + F;
+    Q_exact = F - A_s;
+    A_inverse = lu.inverse().cast<float>();
+    error_gain = 0.0f;
+    if(n_unknowns > 0){
+        const Eigen::PartialPivLU<MatrixD> settle(MatrixD::Identity(n_unknowns, n_unknowns) - Md);
+        const double gain = settle.inverse().cwiseAbs().rowwise().sum().maxCoeff() * Md.cwiseAbs().rowwise().sum().maxCoeff();
+        error_gain = settle.rcond() > 1e-15 && std::isfinite(gain) ? static_cast<float>(gain) : std::numeric_limits<float>::infinity();
+    }
+    set_refinement(refine_tolerance);
+
+    //nonlinear partition: diode voltage = N x + N_s s, and its current leaves the anode row
+    using PortUnknownMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_size>;
+    PortUnknownMatrixD Nd = PortUnknownMatrixD::Zero(n_nonlinear, n_unknowns);
+    N_s = PortSourceMatrix::Zero(n_nonlinear, n_sources);
+    for(int k = 0; k < n_nonlinear; ++k){
+        const Element& e = reduced.element(diode_element[k]);
+        i_sat[k] = e.value;
+        n_vt[k] = e.param;
+
+        auto incidence = [&](int node, double sign){
+            if(unknown_of_node[node] >= 0)
+                Nd(k, unknown_of_node[node]) += sign;
+            else if(pinned_by[node] >= 0)
+                N_s(k, pinned_by[node]) += static_cast<float>(sign) * pinned_sign[node];
+        };
+        incidence(e.n1, 1.0);
+        incidence(e.n2, -1.0);
+    }
+
+    const MatrixD K_xd = lu.solve(Nd.transpose());
+    N = Nd.cast<float>();
+    K_x = K_xd.cast<float>();
+    K = (Nd * K_xd).cast<float>();
+
+    //noise currents: thermal ones sit across their resistor, diode ones across their port
+    using UnknownNoiseMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_noise>;
+    UnknownNoiseMatrixD E = UnknownNoiseMatrixD::Zero(n_unknowns, n_noise);
+    for(int j = 0; j < n_noise; ++j){
+        NoiseSource& ns = noise_sources[j];
+        const Element& e = reduced.element(ns.element);
+        if(ns.kind == NoiseKind::Thermal){
+            ns.sigma = std::sqrt(noise::thermal_current_variance(e.value, temperature, samp_rate));
+            if(unknown_of_node[e.n1] >= 0)
+                E(unknown_of_node[e.n1], j) += 1.0;
+            if(unknown_of_node[e.n2] >= 0)
+                E(unknown_of_node[e.n2], j) -= 1.0;
+        }
+        else{
+            E.col(j) = Nd.row(ns.port).transpose();
+        }
+    }
+    K_w = lu.solve(E).cast<float>();
 
+    //the tangent was of the old values, the full model carries on until it's quiet again
+    envelope_release = std::exp(-1.0f/(release_ms * 0.001f * samp_rate));
+    center_coefficient = 1.0f - envelope_release;
+    linear = false;
+    entry_countdown = 0;
 }
@@ -1,59 +1,284 @@
 
 
+
 #pragma once
 #include <Eigen/Dense>
+#include <vector>
+#include "FastMath.h"
+#include "LookupTable.h"
+#include "Netlist.h"
+#include "NetlistSimplify.h"
+#include "Noise.h"
 
+class DiskCache;
+struct OversamplingTarget;
 
+/* MNA
+ * Trapezoidal modified nodal analysis built from a netlist:
+ *     (G + 2C/T) x[n] = (2C/T - G) x[n-1] + u[n] + u[n-1]
+ * The netlist is simplified first, and nodes pinned by a grounded source are moved over to the
+ * source side instead of getting their own row and source-current unknown. What's left gets
+ * solved once per coefficient change into
+ *     x[n] = M x[n-1] + P s[n-1] + Q s[n]
+ * where s holds the source voltages (DC value + audio input), so the RC from the plugin is a 1x1 system.
+ *
+ * Diodes get split off into a small nonlinear partition. With v the diode voltages and i(v) their currents,
+ * the linear block is solved ahead of time so that per sample only
+ *     v = p - K (i(v) + i[n-1]),   K = N A^-1 N^T  (Schur complement of the linear block)
+ * needs Newton, which is as big as the number of diodes no matter how big the rest of the circuit is.
+ * A has to be invertible on its own, so every node needs a way to ground that isn't a diode (a resistor,
+ * capacitor or source), the constructor throws std::invalid_argument otherwise.
+ *
+ * Elements flagged noisy in the netlist become noise current sources next to them (thermal for resistors,
+ * shot and 1/f for diodes), injected through A^-1 E the same way the trapezoid treats any other current.
+ *
+ * prepare() and reset() start from the DC operating point instead of all zeros, so biased circuits
+ * don't spend their first second charging coupling caps.
+ *
+ * Channels of one instance share the component values, so they share M, P and Q too. process_block() keeps
+ * a state per channel, one contiguous column each, and steps the channels group_channels at a time against
+ * the one copy of the coefficients each sample. Newton stays per channel, the diode conductances differ.
+ *
+ * With set_adaptive() quiet passages run on the small signal model instead: diodes replaced by their
+ * tangent at the point they sit at, folded into the coefficients, so a sample costs what the RC's does.
+ * The tangent's current error grows like e^u - 1 - u away from that point, so each diode gets a window
+ * of voltages where that error, through the DC port impedance, moves the diodes by less than the tolerance. The full model
+ * takes over on the sample that would leave a window (that sample is redone with Newton), and the linear
+ * one only comes back once an envelope of the diode swing has stayed inside half the windows. Both run
+ * on the same state, so handing over is exact and there's nothing to crossfade.
+ *
+ * Eigen holds the matrices and does the coefficient updates. The per sample products and the Newton
+ * solves go through the fixed size kernels in SmallMatrix.h instead, straight on the Eigen storage.
+ */
 class MNA {
-    
+
 public:
-    MNA() = default;
-    
+    static constexpr int max_size = 16; //unknowns after simplification
+    static constexpr int max_sources = 8;
+    static constexpr int max_nonlinear = 8; //diodes after simplification
+    static constexpr int max_newton_iterations = 16;
+    static constexpr int max_noise = 16;
+    static constexpr int max_channels = 32; //for process_block
+    static constexpr int group_channels = 8; //stepped together, so a group's columns stay in L1
+
+    MNA(); //the RC lowpass, 10k and 10n
+    explicit MNA(const Netlist& circuit, const SimplifyOptions& options = {});
+
     float process_sample(float n);
-    void prepare(float sr);
+    //every channel in place, each with its own state (separate from the one process_sample() runs on).
+    //There's state for max_channels, channels past that are left as they are, so callers turn wider
+    //layouts away up front: the plugin's bus check and process_channels() in the python bindings do
+    void process_block(float* const* channels, int num_channels, int num_samples);
+    void prepare(float sr); //also resets
+    //new rate without the reset: the state is node voltages and branch currents, which mean the same
+    //thing at any rate, so this picks up where it was. For switching oversampling factors
+    void set_rate(float sr);
+    void copy_state(const MNA& other); //other has to have been built from the same netlist
+    //jumps straight to the DC operating point for a constant input instead of letting it settle,
+    //false (and a zero state) if it couldn't find one. Not realtime safe
+    bool reset(float input = 0.0f);
     void set_knobs(float capacitor, float resistor);
-    
+    bool set_value(const char* name, float v); //any element in the original netlist, ones simplify() dropped do nothing
+    void set_noise(bool enabled, float temperature = 300.0f, std::uint32_t seed = 0x5eed); //not realtime safe
+
+    //for driving the circuit from outside: sources are looked up by name in the simplified netlist,
+    //set_source overrides the DC value until the next coefficient update
+    int source_index(const char* name) const;
+    void set_source(int j, float v) { s_dc(j) = v; }
+    float probe_voltage(int probe) const; //voltage at the netlist's probe nodes after the last sample
+
+    //exp/log tier for the diodes, Low is plenty for a clipper that's going to be oversampled anyway
+    void set_accuracy(fastmath::Accuracy a) { accuracy = a; }
+    //or read the junction i-v (and its slope) out of a table instead, not realtime safe. With a cache the
+    //table comes out of (or goes into) it, and instances share one mapped copy
+    void set_diode_table(bool enabled, const DiskCache* cache = nullptr);
+
+    //level adaptive switching to the small signal model, see above. tolerance is in volts at the diodes,
+    //release how long (ms) the swing has to die down before the linear model comes back. process_sample()
+    //only, and never while noise is on (the shot and 1/f noise follow the full diode currents)
+    void set_adaptive(bool enabled, float tolerance = 1e-4f, float release_ms = 50.0f);
+    bool running_linear() const { return linear; }
+
+    //mixed precision: the per sample step is float products with M, P and Q, and rounding errors in those
+    //pile up through (I - M)^-1, which gets large when poles sit close to DC at this rate (the wide ends of
+    //the RESISTOR/CAPACITOR ranges). Every coefficient update estimates that gain, and when float epsilon
+    //times it passes tolerance each sample also gets one residual of the trapezoid equations in double,
+    //pushed back through a float A^-1. 0 always refines, infinity never does. Realtime safe, the linear
+    //model of set_adaptive() doesn't refine
+    void set_refinement(float tolerance = 1e-5f);
+    bool refining() const { return refine; }
+
+    //compiled circuit: the netlist, its simplified form, the node mapping, the coefficients at the current
+    //rate and the current state, so load() is a copy instead of simplify + build + factorize + DC solve.
+    //load() leaves the engine as it was unless data is a compiled circuit with this build's limits.
+    //Accuracy and the diode table carry over, noise is off until set_noise()
+    bool save(std::vector<unsigned char>& out) const;
+    bool load(const void* data, std::size_t size);
+
+    //smallest power of two oversampling of base_rate at which the trapezoid still gets this circuit's
+    //poles right, diodes linearized at their stiffest (see Oversampling.h). Eigen solve on the fixed size
+    //matrices, so fine for the audio thread after a knob change, just not every sample
+    int stable_oversampling(float base_rate, const OversamplingTarget& target) const;
+
+    int num_unknowns() const { return n_unknowns; }
+    int num_nonlinear() const { return n_nonlinear; }
+
 private:
-    
+
+    void build();
     void update_coefficients();
-    
-    //RC values
-    float Res = 10000.f;
-    float Cap = 10000.f;
-    
+    bool solve_operating_point();
+    void solve_nonlinear();
+    float junction_current(int k, float v, float& g) const;
+    void add_noise();
+    void track_level(); //after a full model sample, switches to the linear one when it's quiet enough
+    //the diodes' tangents at v_center and the windows they're good for, false if one comes out narrower
+    //than min_window thermal voltages
+    bool tangent(float min_window);
+    bool linearize(); //and the small signal model from them, false if it can't be had
+    bool step_linear(); //false (and x as it was) if the diodes left their windows
+
+    using MatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_size>;
+    using VectorD = Eigen::Matrix<double, Eigen::Dynamic, 1, 0, max_size, 1>;
+    using SourceMatrixD = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_sources>;
+
+    //G + H into A and H - G into B (H = capacitor_scale * C), same split for pinned columns, and the
+    //floating source voltages into F. capacitor_scale = 2/T for the trapezoid, 0 for DC
+    void stamp_linear(double capacitor_scale, MatrixD& A, MatrixD& B, SourceMatrixD& A_s, SourceMatrixD& B_s, SourceMatrixD& F) const;
+
+    using Matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_size>;
+    using Vector = Eigen::Matrix<float, Eigen::Dynamic, 1, 0, max_size, 1>;
+    using SourceMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_sources>;
+    using SourceVector = Eigen::Matrix<float, Eigen::Dynamic, 1, 0, max_sources, 1>;
+    using PortMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_nonlinear>;
+    using PortVector = Eigen::Matrix<float, Eigen::Dynamic, 1, 0, max_nonlinear, 1>;
+    using PortUnknownMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_size>;
+    using UnknownPortMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_nonlinear>;
+    using PortSourceMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_sources>;
+    using UnknownNoiseMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_noise>;
+    using NoiseVector = Eigen::Matrix<float, Eigen::Dynamic, 1, 0, max_noise, 1>;
+
+    //diode voltages v (warm start in, solution out) and currents i for the linear part p, one channel's worth
+    void newton(const PortVector& p, PortVector& v, PortVector& i, const PortVector& i_delay) const;
+    void noise_currents(const PortVector& i_delay, PinkFilter* filters, NoiseVector& out); //this sample's w
+    void spread_state(); //every channel to the state process_sample() is at
+    //process_block() for channels first..first + count - 1, count <= group_channels
+    void process_group(float* const* channels, int first, int count, int num_samples);
+    //a column per channel
+    using ChannelMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_size, max_channels>;
+    using SourceChannelMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_sources, max_channels>;
+    using PortChannelMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, max_channels>;
+    using NoiseChannelMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_noise, max_channels>;
+    //and per group, for the scratch that only lives through one sample
+    using SourceGroupMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_sources, group_channels>;
+    using PortGroupMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_nonlinear, group_channels>;
+    using NoiseGroupMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, max_noise, group_channels>;
+
+    enum class NoiseKind { Thermal, Shot, Flicker };
+    struct NoiseSource {
+        NoiseKind kind = NoiseKind::Thermal;
+        int element = 0; //in reduced
+        int port = -1; //diode port for shot/flicker
+        float sigma = 0.0f; //thermal only, the others follow the diode current
+    };
+
+    //circuit
+    Netlist original; //knobs write into this one
+    Netlist reduced; //and this is what actually gets simulated
+    Reduction reduction; //how original's values turn into reduced's, so a knob change doesn't simplify again
+    SimplifyOptions simplify_options;
+
+    //node bookkeeping, filled in by build()
+    int unknown_of_node[Netlist::max_nodes]; //-1 for ground and pinned nodes
+    int pinned_by[Netlist::max_nodes]; //source index pinning the node, -1 if none
+    float pinned_sign[Netlist::max_nodes];
+    int source_element[max_sources]; //element index in reduced for each source
+    int floating_row[max_sources]; //extra current unknown for sources not tied to ground, -1 otherwise
+    int diode_element[max_nonlinear]; //element index in reduced for each nonlinear port
+    int n_unknowns = 0;
+    int n_sources = 0;
+    int n_nonlinear = 0;
+    int input_source = -1;
+
     //Extra things
     float samp_rate = 44100;
     float T = 1/samp_rate;
-    float Vs = 0; //this will be our input
-    float n_delay = 0;
-    
-    //Matrices
-    Eigen::Matrix<float, 3, 3> G {
-        {1/Res, -1/Res, 1},
-        {-1/Res, 1/Res, 0},
-        {1, 0, 0}};
-    
-    Eigen::Matrix<float, 1, 3> b {
-        {0},
-        {0},
-        {0}}; //This is Vs, our initial input
-    
-    Eigen::Matrix<float, 1, 3> b_delay {
-        {0},
-        {0},
-        {0}}; //This is Vs, our initial input
-    
-    Eigen::Matrix<float, 1, 3> x { //the unknown vector...Vb (or the second on in the vector) will be our Vout
-        {0}, //start with all zeroes
-        {0},
-        {0}};
-    
-    Eigen::Matrix<float, 3, 3> C {
-        {0, 0, 0},
-        {0, Cap, 0},
-        {0, 0, 0}};
-    
-    Eigen::Matrix<float, 3, 3> H = (2*C)/T;
-    Eigen::Matrix<float, 3, 3> A = G + H;
-    Eigen::Matrix<float, 3, 3> A_inv = A.inverse();
+
+    //discretized system
+    Matrix M;
+    SourceMatrix P;
+    SourceMatrix Q;
+    Vector out_x; //output = out_x.x + out_s.s
+    SourceVector out_s;
+
+    //refinement: A x[n] = B x[n-1] + P_exact s[n-1] + Q_exact s in double, see set_refinement()
+    MatrixD A_exact;
+    MatrixD B_exact;
+    SourceMatrixD P_exact;
+    SourceMatrixD Q_exact;
+    Matrix A_inverse;
+    float error_gain = 0.0f; //||(I - M)^-1|| ||M||, infinite with a pole at DC
+    float refine_tolerance = 1e-5f;
+    bool refine = false;
+    //x_new from the float step, made to satisfy the equations above to double residual
+    void refine_step(const float* x_prev, const float* s_prev, const float* s_now, float* x_new) const;
+
+    //nonlinear partition
+    PortUnknownMatrix N; //diode voltages from the unknowns...
+    PortSourceMatrix N_s; //...and from pinned nodes
+    UnknownPortMatrix K_x; //A^-1 N^T, how diode currents push the unknowns around
+    PortMatrix K; //N A^-1 N^T
+    float i_sat[max_nonlinear];
+    float n_vt[max_nonlinear];
+    fastmath::Accuracy accuracy = fastmath::Accuracy::Full;
+    LookupTable<1> junction_table; //e^u - 1 against u = v/n_vt, shared by every diode
+
+    //noise
+    NoiseSource noise_sources[max_noise];
+    int n_noise = 0;
+    bool noise_on = false;
+    float temperature = 300.0f;
+    UnknownNoiseMatrix K_w; //A^-1 E, where E says which rows each noise current lands on
+    NoiseBlock normals;
+    PinkFilter pink[max_noise];
+
+    //level adaptive
+    static constexpr int entry_interval = 32; //samples between checks for going linear
+    bool adaptive = false;
+    bool linear = false;
+    float linear_tolerance = 1e-4f;
+    float release_ms = 50.0f;
+    float envelope_release = 0.0f; //per sample decay of the envelope
+    float center_coefficient = 0.0f; //one pole smoothing of v_center, same time constant
+    float envelope = 0.0f; //diode swing around v_center in thermal voltages, peak held with release
+    int entry_countdown = 0;
+    PortVector v_center; //where the diodes sit on average, and so where the linearization goes
+    PortVector v_lin; //tangent point, current and conductance
+    PortVector i_lin;
+    PortVector g_lin;
+    float window_lo[max_nonlinear]; //volts below/above v_lin the tangent is good for
+    float window_hi[max_nonlinear];
+    Matrix M_lin; //x[n] = M_lin x[n-1] + P_lin s[n-1] + Q_lin s + c_lin
+    SourceMatrix P_lin;
+    SourceMatrix Q_lin;
+    Vector c_lin;
+
+    //state
+    Vector x;
+    SourceVector s;
+    SourceVector s_dc;
+    SourceVector s_delay;
+    PortVector v_nl; //last diode voltages, also the warm start for newton
+    PortVector i_nl;
+    PortVector i_nl_delay;
+    NoiseVector w;
+    NoiseVector w_delay;
+
+    //state of the process_block() channels
+    ChannelMatrix channel_x;
+    SourceChannelMatrix channel_s_delay;
+    PortChannelMatrix channel_v_nl;
+    PortChannelMatrix channel_i_nl_delay;
+    NoiseChannelMatrix channel_w_delay;
+    PinkFilter channel_pink[max_channels][max_noise];
 };
@@ -0,0 +1,419 @@
+
+
+
+#include "ModelReduction.h"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "SmallMatrix.h"
+
+
+ReducedModel reduce_balanced(const Netlist& circuit, float fs, double max_error, int max_order){
+    using Eigen::MatrixXd;
+    using Eigen::VectorXd;
+
+    if(circuit.count(ElementType::Diode) > 0)
+        throw std::invalid_argument("balanced truncation: only for linear circuits, this one has diodes");
+
+    //unknowns: nodes 1..N, then one current per source
+    const int num_nodes = circuit.num_nodes() - 1;
+    std::vector<int> sources;
+    int input = -1;
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        if(e.type != ElementType::VoltageSource)
+            continue;
+        if(e.is_input)
+            input = static_cast<int>(sources.size());
+        sources.push_back(i);
+    }
+    if(input < 0)
+        throw std::invalid_argument("balanced truncation: the circuit has no INPUT source");
+    const int num_sources = static_cast<int>(sources.size());
+    const int n = num_nodes + num_sources;
+
+    MatrixXd G = MatrixXd::Zero(n, n);
+    MatrixXd Cm = MatrixXd::Zero(n, n);
+    MatrixXd b = MatrixXd::Zero(n, num_sources);
+    VectorXd e_dc(num_sources);
+
+    auto stamp = [](MatrixXd& m, int n1, int n2, double v){
+        if(n1 > 0)
+            m(n1 - 1, n1 - 1) += v;
+        if(n2 > 0)
+            m(n2 - 1, n2 - 1) += v;
+        if(n1 > 0 && n2 > 0){
+            m(n1 - 1, n2 - 1) -= v;
+            m(n2 - 1, n1 - 1) -= v;
+        }
+    };
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        if(e.type == ElementType::Resistor){
+            if(!(e.value > 0.0f))
+                throw std::invalid_argument("balanced truncation: resistors have to be positive");
+            stamp(G, e.n1, e.n2, 1.0/e.value);
+        }
+        else if(e.type == ElementType::Capacitor){
+            stamp(Cm, e.n1, e.n2, e.value);
+        }
+    }
+    //source current leaves n1 through the source and comes back at n2, and its row says V(n1) - V(n2) = e
+    for(int j = 0; j < num_sources; ++j){
+        const Element& e = circuit.element(sources[static_cast<std::size_t>(j)]);
+        const int k = num_nodes + j;
+        if(e.n1 > 0){
+            G(e.n1 - 1, k) += 1.0;
+            G(k, e.n1 - 1) += 1.0;
+        }
+        if(e.n2 > 0){
+            G(e.n2 - 1, k) -= 1.0;
+            G(k, e.n2 - 1) -= 1.0;
+        }
+        b(k, j) = 1.0;
+        e_dc(j) = e.value;
+    }
+
+    //split into the span of C (states) and its null space (algebraic), both orthonormal
+    const Eigen::SelfAdjointEigenSolver<MatrixXd> c_eigen(Cm);
+    const double c_largest = std::fmax(c_eigen.eigenvalues().cwiseAbs().maxCoeff(), 1e-300);
+    std::vector<int> state_columns, algebraic_columns;
+    for(int i = 0; i < n; ++i)
+        (c_eigen.eigenvalues()(i) > 1e-12 * c_largest ? state_columns : algebraic_columns).push_back(i);
+    const int nr = static_cast<int>(state_columns.size());
+    const int na = static_cast<int>(algebraic_columns.size());
+    MatrixXd V_r(n, nr), V_0(n, na);
+    VectorXd c_r(nr);
+    for(int i = 0; i < nr; ++i){
+        V_r.col(i) = c_eigen.eigenvectors().col(state_columns[static_cast<std::size_t>(i)]);
+        c_r(i) = c_eigen.eigenvalues()(state_columns[static_cast<std::size_t>(i)]);
+    }
+    for(int i = 0; i < na; ++i)
+        V_0.col(i) = c_eigen.eigenvectors().col(algebraic_columns[static_cast<std::size_t>(i)]);
+
+    //the algebraic part follows the states and the sources instantly
+    const MatrixXd G_00 = V_0.transpose() * G * V_0;
+    const Eigen::FullPivLU<MatrixXd> lu_00(G_00);
+    if(na > 0 && !lu_00.isInvertible())
+        throw std::invalid_argument("balanced truncation: no unique solution (a floating node, or sources in a loop)");
+    const MatrixXd G_0r = V_0.transpose() * G * V_r;
+    const MatrixXd solved_0r = na > 0 ? MatrixXd(lu_00.solve(G_0r)) : MatrixXd::Zero(0, nr);
+    const MatrixXd solved_0b = na > 0 ? MatrixXd(lu_00.solve(MatrixXd(V_0.transpose() * b))) : MatrixXd::Zero(0, num_sources);
+    const MatrixXd G_s = V_r.transpose() * G * V_r - G_0r.transpose() * solved_0r; //G is symmetric
+    const MatrixXd B_s = V_r.transpose() * b - G_0r.transpose() * solved_0b;
+    const MatrixXd X_y = V_r - V_0 * solved_0r; //unknowns from the states...
+    const MatrixXd X_e = V_0 * solved_0b; //...and from the sources
+
+    //scaled by sqrt(c) it's z' = -S z + ..., S symmetric, and its eigenvectors are the modes
+    const VectorXd scale = c_r.cwiseSqrt().cwiseInverse();
+    MatrixXd S = scale.asDiagonal() * G_s * scale.asDiagonal();
+    S = 0.5 * (S + S.transpose());
+    const Eigen::SelfAdjointEigenSolver<MatrixXd> s_eigen(S);
+    const VectorXd mu_all = s_eigen.eigenvalues();
+    const MatrixXd beta_all = s_eigen.eigenvectors().transpose() * scale.asDiagonal() * B_s;
+    const MatrixXd X_m_all = X_y * scale.asDiagonal() * s_eigen.eigenvectors();
+
+    //a mode at mu = 0 is charge stuck on a capacitor with no way off. Fine if nothing can ever put any there
+    const double mu_largest = nr > 0 ? std::fmax(mu_all.cwiseAbs().maxCoeff(), 1e-300) : 1.0;
+    const double beta_largest = nr > 0 ? std::fmax(beta_all.cwiseAbs().maxCoeff(), 1e-300) : 1.0;
+    std::vector<int> modes;
+    for(int i = 0; i < nr; ++i){
+        if(mu_all(i) > 1e-12 * mu_largest)
+            modes.push_back(i);
+        else if(beta_all.row(i).cwiseAbs().maxCoeff() > 1e-9 * beta_largest)
+            throw std::invalid_argument("balanced truncation: a capacitor has no DC path to discharge through");
+    }
+    const int nm = static_cast<int>(modes.size());
+    VectorXd mu(nm);
+    MatrixXd beta(nm, num_sources), X_m(n, nm), Phi(nr, nm);
+    for(int i = 0; i < nm; ++i){
+        const int mode = modes[static_cast<std::size_t>(i)];
+        mu(i) = mu_all(mode);
+        beta.row(i) = beta_all.row(mode);
+        X_m.col(i) = X_m_all.col(mode);
+        Phi.col(i) = s_eigen.eigenvectors().col(mode);
+    }
+
+    const int out = circuit.get_output();
+    const VectorXd gamma = out > 0 ? VectorXd(X_m.row(out - 1).transpose()) : VectorXd::Zero(nm);
+    const double delta = out > 0 ? X_e(out - 1, input) : 0.0;
+
+    //operating point with the input at 0
+    const VectorXd m_dc = (beta * e_dc).cwiseQuotient(mu);
+    const VectorXd x_dc = X_m * m_dc + X_e * e_dc;
+
+    //closed form gramians of the input column, then the square root method
+    const VectorXd b_in = beta.col(input);
+    MatrixXd Wc(nm, nm), Wo(nm, nm);
+    for(int j = 0; j < nm; ++j){
+        for(int i = 0; i < nm; ++i){
+            Wc(i, j) = b_in(i) * b_in(j)/(mu(i) + mu(j));
+            Wo(i, j) = gamma(i) * gamma(j)/(mu(i) + mu(j));
+        }
+    }
+    auto square_root = [](const MatrixXd& W){
+        const Eigen::SelfAdjointEigenSolver<MatrixXd> eigen(W);
+        return MatrixXd(eigen.eigenvectors() * eigen.eigenvalues().cwiseMax(0.0).cwiseSqrt().asDiagonal());
+    };
+    const MatrixXd Lc = square_root(Wc);
+    const MatrixXd Lo = square_root(Wo);
+    const Eigen::JacobiSVD<MatrixXd> svd(Lo.transpose() * Lc, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    const VectorXd sigma = svd.singularValues();
+
+    ReducedModel model;
+    model.fs = fs;
+    model.full_order = nm;
+    for(int i = 0; i < nm && i < Netlist::max_nodes; ++i)
+        model.hankel[i] = sigma(i);
+
+    //smallest order under the bound, as long as the states it keeps are actually there
+    const int cap = std::min(std::clamp(max_order, 0, ReducedModel::max_order), nm);
+    std::vector<double> tail(static_cast<std::size_t>(nm) + 1, 0.0);
+    for(int i = nm - 1; i >= 0; --i)
+        tail[static_cast<std::size_t>(i)] = tail[static_cast<std::size_t>(i) + 1] + sigma(i);
+    int r = 0;
+    while(r < cap && 2.0 * tail[static_cast<std::size_t>(r)] > max_error && sigma(r) > 1e-12 * sigma(0))
+        ++r;
+    model.order = r;
+    model.error_bound = 2.0 * tail[static_cast<std::size_t>(r)];
+
+    const VectorXd root = sigma.head(r).cwiseSqrt().cwiseInverse();
+    const MatrixXd Tb = Lc * svd.matrixV().leftCols(r) * root.asDiagonal(); //modes from balanced states
+    const MatrixXd Ti = root.asDiagonal() * svd.matrixU().leftCols(r).transpose() * Lo.transpose(); //and back
+    const MatrixXd Ar = -Ti * mu.asDiagonal() * Tb;
+    const VectorXd Br = Ti * b_in;
+    const VectorXd Cr = Tb.transpose() * gamma;
+
+    //trapezoid, x[n] = M x[n-1] + q (u[n] + u[n-1]), then w = x - q u for the one step form
+    const double h = 0.5/static_cast<double>(fs);
+    const MatrixXd I = MatrixXd::Identity(r, r);
+    const Eigen::PartialPivLU<MatrixXd> lu(MatrixXd(I - h * Ar));
+    const MatrixXd M = lu.solve(MatrixXd(I + h * Ar));
+    const VectorXd q = h * lu.solve(Br);
+    const MatrixXd Ad = M;
+    const VectorXd Bd = (M + I) * q;
+
+    for(int c = 0; c < r; ++c){
+        for(int row = 0; row < r; ++row)
+            model.A[c * r + row] = static_cast<float>(Ad(row, c));
+        model.B[c] = static_cast<float>(Bd(c));
+        model.C[c] = static_cast<float>(Cr(c));
+        model.q[c] = static_cast<float>(q(c));
+    }
+    model.D = static_cast<float>(Cr.dot(q) + delta);
+    model.y_dc = static_cast<float>((out > 0 ? x_dc(out - 1) : 0.0));
+
+    //node voltages from the balanced states, and the states from node voltages (V_r has nothing on the
+    //source current rows, so the node columns are all of it)
+    const MatrixXd to_unknowns = X_m * Tb;
+    const VectorXd unknowns_u = to_unknowns * q + X_e.col(input);
+    const MatrixXd from_unknowns = Ti * Phi.transpose() * c_r.cwiseSqrt().asDiagonal() * V_r.transpose();
+    for(int node = 1; node <= num_nodes; ++node){
+        for(int c = 0; c < r; ++c){
+            model.to_nodes[c * Netlist::max_nodes + node] = static_cast<float>(to_unknowns(node - 1, c));
+            model.from_nodes[node * ReducedModel::max_order + c] = static_cast<float>(from_unknowns(c, node - 1));
+        }
+        model.node_u[node] = static_cast<float>(unknowns_u(node - 1));
+        model.x_dc[node] = static_cast<float>(x_dc(node - 1));
+    }
+    return model;
+}
+
+
+ReducedEngine::ReducedEngine(const Netlist& c, double error, int order)
+    : circuit(c), max_error(error), max_order(order) {
+    for(int i = 0; i < Netlist::max_elements; ++i)
+        values[i].store(i < circuit.num_elements() ? circuit.element(i).value : 0.0f);
+    current = new ReducedModel(reduce_balanced(circuit, sample_rate.load(), max_error, max_order)); //throws for a bad circuit
+    //what this model was built from, set before the thread runs so a set_value() from now on still counts
+    built = requested.load();
+    built_for = sample_rate.load();
+    worker = std::thread(&ReducedEngine::worker_loop, this);
+}
+
+
+ReducedEngine::~ReducedEngine(){
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if(worker.joinable())
+        worker.join();
+    delete current;
+    delete pending.exchange(nullptr);
+    delete retired.exchange(nullptr);
+}
+
+
+void ReducedEngine::prepare(float fs){
+    sample_rate.store(fs);
+    {
+        //what's reduced below, so the worker doesn't do it again. A set_value() from here on still counts
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        built = requested.load();
+        built_for = fs;
+    }
+    //nothing is playing, so the audio side's model can be swapped right here
+    if(ReducedModel* m = reduce()){
+        delete current;
+        current = m;
+    }
+    delete pending.exchange(nullptr);
+    collect();
+    reset();
+}
+
+
+void ReducedEngine::reset(){
+    //w = 0 is the operating point for no input, that's what y_dc and x_dc are
+    std::fill(std::begin(w), std::end(w), 0.0f);
+    last_input = 0.0f;
+}
+
+
+float ReducedEngine::process_sample(float u){
+    //only one swap in flight at a time: the last model has been collected
+    if(pending.load(std::memory_order_relaxed) && !retired.load(std::memory_order_acquire)){
+        if(ReducedModel* next = pending.exchange(nullptr, std::memory_order_acq_rel)){
+            if(next->fs != sample_rate.load(std::memory_order_relaxed))
+                retired.store(next, std::memory_order_release); //made for the old rate, another one is coming
+            else
+                swap_in(next);
+            wake_worker(); //to delete the one retired
+        }
+    }
+
+    const ReducedModel& m = *current;
+    float y = m.y_dc + m.D * u;
+    for(int k = 0; k < m.order; ++k)
+        y += m.C[k] * w[k];
+
+    const smallmatrix::Kernels& kernels = smallmatrix::kernels(m.order);
+    kernels.multiply(m.A, m.order, w, w);
+    for(int k = 0; k < m.order; ++k)
+        w[k] += m.B[k] * u;
+    last_input = u;
+    return y;
+}
+
+
+//the new model starts from the node voltages the old one is at
+void ReducedEngine::swap_in(ReducedModel* next){
+    const ReducedModel& old = *current;
+    float nodes[Netlist::max_nodes];
+    for(int node = 0; node < Netlist::max_nodes; ++node){
+        float v = old.node_u[node] * last_input + old.x_dc[node] - next->x_dc[node];
+        for(int k = 0; k < old.order; ++k)
+            v += old.to_nodes[k * Netlist::max_nodes + node] * w[k];
+        nodes[node] = v;
+    }
+    for(int k = 0; k < next->order; ++k){
+        float v = -next->q[k] * last_input;
+        for(int node = 0; node < Netlist::max_nodes; ++node)
+            v += next->from_nodes[node * ReducedModel::max_order + k] * nodes[node];
+        w[k] = v;
+    }
+    for(int k = next->order; k < ReducedModel::max_order; ++k)
+        w[k] = 0.0f;
+
+    retired.store(current, std::memory_order_release);
+    current = next;
+    swaps.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+bool ReducedEngine::set_value(const char* name, float v){
+    const int i = circuit.find(name);
+    if(i < 0)
+        return false;
+    if(values[i].load(std::memory_order_relaxed) != v){
+        values[i].store(v, std::memory_order_relaxed);
+        requested.fetch_add(1);
+        wake_worker();
+    }
+    return true;
+}
+
+
+void ReducedEngine::set_knobs(float capacitor, float resistor){
+    set_value("C1", capacitor);
+    set_value("R1", resistor);
+}
+
+
+std::string ReducedEngine::last_error() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+
+ReducedModel* ReducedEngine::reduce(){
+    Netlist net = circuit;
+    for(int i = 0; i < net.num_elements(); ++i)
+        net.element(i).value = values[i].load(std::memory_order_relaxed);
+    try{
+        std::unique_ptr<ReducedModel> m(new ReducedModel(reduce_balanced(net, sample_rate.load(), max_error, max_order)));
+        std::lock_guard<std::mutex> lock(mutex);
+        error.clear();
+        return m.release();
+    }
+    catch(const std::exception& e){
+        std::lock_guard<std::mutex> lock(mutex);
+        error = e.what();
+        return nullptr;
+    }
+}
+
+
+void ReducedEngine::collect(){
+    delete retired.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+
+bool ReducedEngine::has_work() const{
+    return stopping || requested.load() != built || sample_rate.load() != built_for || retired.load() != nullptr;
+}
+
+
+//the worker counts itself asleep before it checks for work, so a change made after that check finds
+//it asleep and gets through the lock only once the worker is waiting, like DecoupledMNA's workers
+void ReducedEngine::wake_worker(){
+    if(sleeping.load()){
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+        }
+        wake.notify_all();
+    }
+}
+
+
+void ReducedEngine::worker_loop(){
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    while(true){
+        sleeping.store(true);
+        wake.wait(lock, [&]{ return has_work(); });
+        sleeping.store(false);
+        if(stopping)
+            return;
+
+        //values keep coming while a knob turns, so reduce for whatever they are when this starts
+        const int wanted = requested.load();
+        const float rate = sample_rate.load();
+        const bool stale = wanted != built || rate != built_for;
+        built = wanted;
+        built_for = rate;
+        lock.unlock();
+
+        collect();
+        if(stale){
+            if(ReducedModel* m = reduce())
+                delete pending.exchange(m, std::memory_order_acq_rel); //one the audio thread never took
+        }
+        lock.lock();
+    }
+}
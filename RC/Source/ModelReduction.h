@@ -0,0 +1,127 @@
+
+
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Netlist.h"
+
+
+/* Balanced truncation
+ * Model order reduction for linear circuits (R, C and sources) that are too big for MNA, or big enough
+ * that their per sample cost hurts: long RC ladders, passive tone networks. The circuit is written out as
+ *     C x' + G x = b e
+ * over every node of the original netlist plus a current per source, the rows without any capacitance
+ * get eliminated, and what's left is symmetric (RC networks only have real poles) so it diagonalizes.
+ * In those modal coordinates both Gramians of the input to output system have a closed form,
+ *     Wc_ij = b_i b_j/(mu_i + mu_j),   Wo_ij = c_i c_j/(mu_i + mu_j)
+ * and the square root method balances them. The order is the smallest one whose discarded Hankel
+ * singular values keep 2 * sum(sigma_discarded), a bound on the error at any frequency in volts out
+ * per volt in, under max_error. The reduced model gets the same trapezoidal (bilinear) discretization
+ * MNA uses, which keeps the Hankel singular values and so the bound, and runs as
+ *     w = A w + B u,   y = C w + D u + y_dc
+ * at a cost that only depends on the order.
+ *
+ * Inductors would make the poles complex and the closed form Gramians wrong, but the netlist has none.
+ */
+struct ReducedModel {
+    static constexpr int max_order = 16;
+
+    float fs = 0.0f; //what it's discretized for
+    int order = 0;
+    int full_order = 0; //capacitor states of the circuit
+    double error_bound = 0.0; //2 * the sum of the discarded hankel singular values
+    double hankel[Netlist::max_nodes] = {}; //every one of them, largest first, full_order long
+
+    float A[max_order * max_order] = {}; //column major
+    float B[max_order] = {};
+    float C[max_order] = {};
+    float D = 0.0f;
+    float y_dc = 0.0f; //output with the input at 0 and every source at its DC value
+
+    //node voltages = to_nodes w + node_u u + x_dc, and back: w = from_nodes (node voltages - x_dc) - q u.
+    //Both column major, node 0 (ground) included so node numbers index straight in
+    float to_nodes[Netlist::max_nodes * max_order] = {}; //max_nodes x order
+    float node_u[Netlist::max_nodes] = {};
+    float x_dc[Netlist::max_nodes] = {};
+    float from_nodes[max_order * Netlist::max_nodes] = {}; //order x max_nodes
+    float q[max_order] = {};
+};
+
+
+//not realtime safe. Throws std::invalid_argument for circuits with diodes, without an input, with a
+//resistor that isn't positive or a capacitor that can never discharge
+ReducedModel reduce_balanced(const Netlist& circuit, float fs, double max_error = 1e-4,
+                             int max_order = ReducedModel::max_order);
+
+
+/* The reduced model as an engine
+ * set_value() only hands the value to a worker thread, which re-reduces the circuit and posts the new
+ * model through a one slot mailbox. process_sample() picks it up between samples and carries the state
+ * over through the node voltages (which mean the same thing in both models, like MNA's state across a
+ * knob change), and the model it replaced goes back through a second slot for the worker to delete. So
+ * the audio thread never allocates or frees, and until the new model is in the old one keeps playing. The
+ * worker sleeps until there's something to do; waking it is the only time the audio thread touches a
+ * lock, one nobody else holds while the worker sleeps.
+ */
+class ReducedEngine {
+
+public:
+    explicit ReducedEngine(const Netlist& circuit, double max_error = 1e-4, int max_order = ReducedModel::max_order);
+    ~ReducedEngine();
+
+    ReducedEngine(const ReducedEngine&) = delete;
+    ReducedEngine& operator=(const ReducedEngine&) = delete;
+
+    void prepare(float fs); //reduces on the calling thread, also resets. Not realtime safe
+
+    //audio thread
+    void reset();
+    float process_sample(float u);
+    bool set_value(const char* name, float v); //any element in the netlist, false if it isn't there
+    void set_knobs(float capacitor, float resistor); //"C1" and "R1", like the other engines
+
+    int order() const { return current ? current->order : 0; } //of the model playing now
+    double error_bound() const { return current ? current->error_bound : 0.0; }
+    int generation() const { return swaps.load(std::memory_order_relaxed); } //models swapped in so far
+    std::string last_error() const; //empty after a good reduction
+
+private:
+    void worker_loop();
+    bool has_work() const; //with wake_mutex held
+    void wake_worker(); //audio thread
+    ReducedModel* reduce(); //nullptr (and last_error set) if it didn't work
+    void swap_in(ReducedModel* next);
+    void collect(); //deletes whatever the audio thread retired
+
+    const Netlist circuit; //names and topology, the values live in `values`
+    const double max_error;
+    const int max_order;
+
+    //audio thread's
+    ReducedModel* current = nullptr;
+    float w[ReducedModel::max_order] = {};
+    float last_input = 0.0f;
+
+    //handed between the two threads
+    std::atomic<float> values[Netlist::max_elements];
+    std::atomic<int> requested{0}; //bumped by every set_value
+    std::atomic<ReducedModel*> pending{nullptr};
+    std::atomic<ReducedModel*> retired{nullptr};
+    std::atomic<float> sample_rate{44100.0f};
+    std::atomic<int> swaps{0};
+
+    //worker
+    std::thread worker;
+    std::mutex wake_mutex; //guards the wakeup and the three below
+    std::condition_variable wake;
+    std::atomic<bool> sleeping{false};
+    bool stopping = false;
+    int built = 0; //the requested count and rate the latest model was reduced for
+    float built_for = 0.0f;
+    mutable std::mutex mutex; //guards the error string
+    std::string error;
+};
@@ -0,0 +1,158 @@
+
+
+#include "Netlist.h"
+#include <cctype>
+#include <cstring>
+
+
+int Netlist::add_node(){
+    if(node_count >= max_nodes)
+        return -1;
+    return node_count++;
+}
+
+
+int Netlist::add_resistor(const char* name, int n1, int n2, float r){
+    return add_element(ElementType::Resistor, name, n1, n2, r, false);
+}
+
+
+int Netlist::add_capacitor(const char* name, int n1, int n2, float c){
+    return add_element(ElementType::Capacitor, name, n1, n2, c, false);
+}
+
+
+int Netlist::add_voltage_source(const char* name, int n1, int n2, float v, bool is_input){
+    return add_element(ElementType::VoltageSource, name, n1, n2, v, is_input);
+}
+
+
+int Netlist::add_diode(const char* name, int anode, int cathode, float is, float n_vt){
+    return add_element(ElementType::Diode, name, anode, cathode, is, false, n_vt);
+}
+
+
+int Netlist::add_copy(const Element& e, int n1, int n2){
+    const int i = add_element(e.type, e.name, n1, n2, e.value, e.is_input, e.param);
+    if(i >= 0){
+        elements[i].noise = e.noise;
+        elements[i].kf = e.kf;
+    }
+    return i;
+}
+
+
+int Netlist::add_element(ElementType type, const char* name, int n1, int n2, float value, bool is_input, float param){
+    if(element_count >= max_elements || n1 < 0 || n2 < 0 || n1 >= node_count || n2 >= node_count)
+        return -1;
+    if(type == ElementType::VoltageSource && n1 == n2)
+        return -1;
+    //a cut off name could end up the same as another one and find() would hand back the wrong element
+    const std::size_t length = std::strlen(name);
+    if(length >= sizeof(Element::name))
+        return -1;
+
+    Element& e = elements[element_count];
+    e = Element{};
+    e.type = type;
+    e.n1 = n1;
+    e.n2 = n2;
+    e.value = value;
+    e.is_input = is_input;
+    e.param = param;
+    std::memcpy(e.name, name, length);
+    return element_count++;
+}
+
+
+void Netlist::remove_element(int index){
+    //order doesn't matter to the engines so just move the last one into the hole
+    elements[index] = elements[element_count - 1];
+    --element_count;
+}
+
+
+int Netlist::find(const char* name) const{
+    auto same = [name](const char* element_name){
+        for(std::size_t k = 0; k < sizeof(Element::name); ++k){
+            const int a = std::tolower(static_cast<unsigned char>(element_name[k]));
+            const int b = std::tolower(static_cast<unsigned char>(name[k]));
+            if(a != b)
+                return false;
+            if(a == 0)
+                return true;
+        }
+        return false; //name is longer than anything that fits
+    };
+    for(int i = 0; i < element_count; ++i){
+        if(same(elements[i].name))
+            return i;
+    }
+    return -1;
+}
+
+
+bool Netlist::set_value(const char* name, float v){
+    const int i = find(name);
+    if(i < 0)
+        return false;
+    elements[i].value = v;
+    return true;
+}
+
+
+bool Netlist::set_noise(const char* name, std::uint8_t flags, float kf){
+    const int i = find(name);
+    if(i < 0)
+        return false;
+    elements[i].noise = flags;
+    elements[i].kf = kf;
+    return true;
+}
+
+
+int Netlist::add_probe(int node){
+    if(probe_count >= max_probes || node < 0 || node >= node_count)
+        return -1;
+    probes[probe_count] = node;
+    return probe_count++;
+}
+
+
+bool Netlist::is_probe(int node) const{
+    for(int i = 0; i < probe_count; ++i){
+        if(probes[i] == node)
+            return true;
+    }
+    return false;
+}
+
+
+int Netlist::count(ElementType type) const{
+    int c = 0;
+    for(int i = 0; i < element_count; ++i)
+        c += (elements[i].type == type);
+    return c;
+}
+
+
+int Netlist::degree(int node) const{
+    int d = 0;
+    for(int i = 0; i < element_count; ++i){
+        d += (elements[i].n1 == node);
+        d += (elements[i].n2 == node);
+    }
+    return d;
+}
+
+
+Netlist Netlist::rc_lowpass(float r, float c){
+    Netlist net;
+    const int in = net.add_node();
+    const int out = net.add_node();
+    net.add_voltage_source("Vin", in, 0, 0.0f, true);
+    net.add_resistor("R1", in, out, r);
+    net.add_capacitor("C1", out, 0, c);
+    net.set_output(out);
+    return net;
+}
@@ -0,0 +1,99 @@
+
+
+
+#pragma once
+#include <array>
+#include <cstdint>
+
+
+/* Netlist
+ * A flat list of two-terminal elements hooked up between numbered nodes (node 0 is ground).
+ * Everything lives in fixed size arrays so copying/simplifying one never touches the heap,
+ * which means the engines can rebuild themselves from a netlist when a knob moves.
+ */
+enum class ElementType : std::uint8_t {
+    Resistor,
+    Capacitor,
+    VoltageSource,
+    Diode //shockley diode from n1 (anode) to n2 (cathode)
+};
+
+
+//optional noise an element contributes, see Noise.h
+enum NoiseFlags : std::uint8_t {
+    NoiseNone = 0,
+    NoiseThermal = 1, //resistors: johnson noise
+    NoiseShot = 2, //diodes: shot noise on the junction current
+    NoiseFlicker = 4 //diodes: 1/f noise, psd = kf * |I| / f
+};
+
+
+struct Element {
+    ElementType type = ElementType::Resistor;
+    int n1 = 0; //positive terminal
+    int n2 = 0; //negative terminal
+    float value = 0.0f; //ohms, farads or volts (for sources this is the DC value), saturation current for diodes
+    float param = 0.0f; //diodes only: emission coefficient * thermal voltage
+    bool is_input = false; //sources only: the audio input gets added on top of value
+    std::uint8_t noise = NoiseNone;
+    float kf = 0.0f; //flicker noise coefficient
+    char name[16] = {}; //Netlist::max_name characters and the terminator
+};
+
+
+class Netlist {
+
+public:
+    static constexpr int max_nodes = 64;
+    static constexpr int max_elements = 128;
+    static constexpr int max_probes = 8;
+    static constexpr int max_name = static_cast<int>(sizeof(Element::name)) - 1;
+
+    Netlist() = default;
+
+    //build a circuit...every add returns the element index or -1 if we ran out of room, the name is
+    //longer than max_name characters or it's a voltage source from a node to itself (0 V = nothing across
+    //nothing, no solve can satisfy it)
+    int add_node();
+    int add_resistor(const char* name, int n1, int n2, float r);
+    int add_capacitor(const char* name, int n1, int n2, float c);
+    int add_voltage_source(const char* name, int n1, int n2, float v, bool is_input = false);
+    int add_diode(const char* name, int anode, int cathode, float is = 2.52e-9f, float n_vt = 1.752f * 0.02585f);
+    int add_copy(const Element& e, int n1, int n2); //same element, different nodes
+
+    void remove_element(int index);
+    int find(const char* name) const; //case insensitive like SPICE, "r1" finds R1
+    bool set_value(const char* name, float v);
+    bool set_noise(const char* name, std::uint8_t flags, float kf = 0.0f);
+
+    int num_nodes() const { return node_count; }
+    int num_elements() const { return element_count; }
+    int count(ElementType type) const;
+    const Element& element(int i) const { return elements[i]; }
+    Element& element(int i) { return elements[i]; }
+
+    int get_output() const { return output_node; }
+    void set_output(int node) { output_node = node; }
+
+    //extra nodes someone wants to read, simplification keeps them around like the output
+    int add_probe(int node);
+    int num_probes() const { return probe_count; }
+    int get_probe(int i) const { return probes[i]; }
+    bool is_probe(int node) const;
+
+    //how many element terminals land on this node
+    int degree(int node) const;
+
+    //the circuit in the plugin: Vin -- R1 -- out -- C1 -- gnd
+    static Netlist rc_lowpass(float r, float c);
+
+private:
+    int add_element(ElementType type, const char* name, int n1, int n2, float value, bool is_input, float param = 0.0f);
+
+    std::array<Element, max_elements> elements {};
+    int element_count = 0;
+    int node_count = 1; //ground is always there
+    int output_node = 0;
+    std::array<int, max_probes> probes {};
+    int probe_count = 0;
+};
@@ -0,0 +1,212 @@
+
+
+#include "NetlistReloader.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include "SpiceParser.h"
+
+
+NetlistReloader::NetlistReloader(float crossfade) : crossfade_ms(crossfade) {}
+
+
+NetlistReloader::~NetlistReloader(){
+    stop();
+    delete current;
+    delete fading_out;
+    delete pending.exchange(nullptr);
+    delete retired.exchange(nullptr);
+}
+
+
+void NetlistReloader::watch(const std::string& file, int poll_ms){
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watched = file;
+        error.clear();
+        stopping = false;
+    }
+    watcher = std::thread(&NetlistReloader::watch_loop, this, file, std::max(10, poll_ms));
+}
+
+
+void NetlistReloader::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if(watcher.joinable())
+        watcher.join();
+}
+
+
+void NetlistReloader::prepare(float fs, int num_channels){
+    num_channels = std::max(1, num_channels);
+    sample_rate.store(fs);
+    channel_count.store(num_channels);
+    fade_length = std::max(1, static_cast<int>(crossfade_ms * 0.001f * fs));
+
+    //nothing is playing, so this is the one place the audio side's engines can be touched from here
+    if(fading_out){
+        delete fading_out;
+        fading_out = nullptr;
+    }
+    if(current && current->fs != fs){
+        for(auto& engine : current->engines)
+            engine->prepare(fs);
+        current->fs = fs;
+    }
+    if(current && current->channels() != num_channels)
+        current->fit(num_channels, cache);
+    wake.notify_all(); //and the watcher rebuilds anything still pending at the old rate or channel count
+}
+
+
+void NetlistReloader::reset(){
+    if(current){
+        for(auto& engine : current->engines)
+            engine->reset();
+    }
+    if(fading_out && !retired.load(std::memory_order_acquire)){
+        retired.store(fading_out, std::memory_order_release);
+        fading_out = nullptr;
+    }
+}
+
+
+void NetlistReloader::process(float* const* channels, int num_channels, int num_samples){
+    //only one swap in flight at a time: the last fade has finished and its engine has been collected
+    if(!fading_out && !retired.load(std::memory_order_acquire)){
+        if(Build* next = pending.exchange(nullptr, std::memory_order_acq_rel)){
+            if(next->fs != sample_rate.load(std::memory_order_relaxed) || next->channels() != channel_count.load(std::memory_order_relaxed)){
+                retired.store(next, std::memory_order_release);
+                rebuild.store(true, std::memory_order_release);
+            }
+            else{
+                fading_out = current;
+                current = next;
+                fade_position = 0;
+                swaps.fetch_add(1, std::memory_order_relaxed);
+                latency_samples.store(current->engines.front()->latency(), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    if(!current)
+        return;
+
+    //each channel through its own engine, and during a swap through its own pair of them. A channel past
+    //what prepare() was told about has no engine and is left alone
+    const float step = 1.0f/static_cast<float>(fade_length);
+    num_channels = std::min(num_channels, current->channels());
+    for(int c = 0; c < num_channels; ++c){
+        float* x = channels[c];
+        OversampledMNA& engine = *current->engines[static_cast<std::size_t>(c)];
+        if(!fading_out || c >= fading_out->channels()){
+            for(int n = 0; n < num_samples; ++n)
+                x[n] = engine.process_sample(x[n]);
+            continue;
+        }
+        OversampledMNA& old = *fading_out->engines[static_cast<std::size_t>(c)];
+        for(int n = 0; n < num_samples; ++n){
+            const float g = std::min(1.0f, static_cast<float>(fade_position + n + 1) * step);
+            const float in = x[n];
+            x[n] = g * engine.process_sample(in) + (1.0f - g) * old.process_sample(in);
+        }
+    }
+
+    if(fading_out){
+        fade_position += num_samples;
+        if(fade_position >= fade_length){
+            retired.store(fading_out, std::memory_order_release);
+            fading_out = nullptr;
+        }
+    }
+}
+
+
+std::string NetlistReloader::path() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    return watched;
+}
+
+
+std::string NetlistReloader::last_error() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+
+void NetlistReloader::collect(){
+    delete retired.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+
+void NetlistReloader::Build::fit(int num_channels, const DiskCache& cache){
+    engines.resize(std::min(engines.size(), static_cast<std::size_t>(num_channels)));
+    const bool diodes = circuit.count(ElementType::Diode) > 0;
+    while(channels() < num_channels){
+        auto engine = std::make_unique<OversampledMNA>(circuit);
+        engine->set_adaptive(true); //quiet passages on the small signal model
+        if(diodes)
+            engine->set_diode_table(true, &cache);
+        engine->prepare(fs); //coefficients and the DC operating point, all off the audio thread
+        engines.push_back(std::move(engine));
+    }
+}
+
+
+NetlistReloader::Build* NetlistReloader::compile(const std::string& file, float fs, int num_channels){
+    try{
+        std::unique_ptr<Build> b(new Build{read_spice(file.c_str()), {}, fs});
+        b->fit(num_channels, cache);
+        std::lock_guard<std::mutex> lock(mutex);
+        error.clear();
+        return b.release();
+    }
+    catch(const std::exception& e){
+        std::lock_guard<std::mutex> lock(mutex);
+        error = e.what();
+        return nullptr;
+    }
+}
+
+
+void NetlistReloader::watch_loop(std::string file, int poll_ms){
+    namespace fs = std::filesystem;
+    fs::file_time_type last_time{};
+    std::uintmax_t last_size = 0;
+    float built_for = 0.0f;
+    int built_channels = 0;
+    bool first = true;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopping){
+        lock.unlock();
+        collect();
+
+        //a missing file reads as min() and size 0, so it counts as a change when it shows up
+        std::error_code ec;
+        const fs::file_time_type time = fs::last_write_time(file, ec);
+        const std::uintmax_t size = ec ? 0 : fs::file_size(file, ec);
+        const float rate = sample_rate.load();
+        const int num_channels = channel_count.load();
+        const bool changed = time != last_time || size != last_size;
+        if(first || changed || rate != built_for || num_channels != built_channels || rebuild.exchange(false)){
+            first = false;
+            last_time = time;
+            last_size = size;
+            built_for = rate;
+            built_channels = num_channels;
+            if(Build* b = compile(file, rate, num_channels))
+                delete pending.exchange(b, std::memory_order_acq_rel); //one the audio thread never took
+        }
+
+        lock.lock();
+        wake.wait_for(lock, std::chrono::milliseconds(poll_ms), [&]{ return stopping; });
+    }
+}
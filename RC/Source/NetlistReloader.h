@@ -0,0 +1,99 @@
+
+
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DiskCache.h"
+#include "Netlist.h"
+#include "Oversampling.h"
+
+
+/* Netlist hot reload
+ * An MNA engine built from a SPICE file that follows the file while the plugin runs. A watcher thread
+ * polls the file, and when it changes parses, simplifies, builds, prepares and DC solves the new engine
+ * there. The finished engine goes through a one slot mailbox, and process() picks it up at the start of a
+ * block and crossfades into it. The engine it replaced goes back through a second slot for the watcher to
+ * delete, so the audio thread never allocates, frees or waits on a lock.
+ *
+ * A file that doesn't parse (or doesn't fit in MNA) leaves the running engine alone, last_error() says why.
+ * Until the first good build process() leaves the audio untouched.
+ *
+ * Every channel gets its own engine (the circuit has state, so channels can't take turns on one), all
+ * built and prepared by the watcher for the channel count prepare() was given.
+ *
+ * Circuits with diodes run them off the junction table (MNA::set_diode_table), which comes out of the
+ * disk cache in DiskCache::default_directory(): every channel, every plugin instance and every process
+ * maps the same copy, and only the first one ever builds it.
+ *
+ * The engines oversample as much as the circuit needs (see Oversampling.h), so a file full of diodes and
+ * small caps stays stable. That costs OversampledMNA's fixed latency on everything that comes out, which
+ * latency() reports so the host can line it up.
+ */
+class NetlistReloader {
+
+public:
+    explicit NetlistReloader(float crossfade_ms = 20.0f);
+    ~NetlistReloader();
+
+    NetlistReloader(const NetlistReloader&) = delete;
+    NetlistReloader& operator=(const NetlistReloader&) = delete;
+
+    //not realtime safe
+    void watch(const std::string& path, int poll_ms = 250);
+    void stop();
+    void prepare(float fs, int num_channels = 2); //audio stopped, like any prepare
+
+    //audio thread
+    void reset();
+    void process(float* const* channels, int num_channels, int num_samples); //num_channels up to prepare()'s
+
+    std::string path() const;
+    std::string last_error() const; //empty after a good build
+    int generation() const { return swaps.load(std::memory_order_relaxed); } //engines swapped in so far
+    int latency() const { return latency_samples.load(std::memory_order_relaxed); } //of what process() puts out, 0 before the first build
+
+private:
+    struct Build {
+        Netlist circuit;
+        std::vector<std::unique_ptr<OversampledMNA>> engines; //one per channel
+        float fs;
+
+        void fit(int num_channels, const DiskCache& cache); //adds prepared engines for any channels missing, not realtime safe
+        int channels() const { return static_cast<int>(engines.size()); }
+    };
+
+    void watch_loop(std::string file, int poll_ms);
+    Build* compile(const std::string& file, float fs, int num_channels); //nullptr (and last_error set) if it didn't work
+    void collect(); //deletes whatever the audio thread retired
+
+    //audio thread's
+    Build* current = nullptr;
+    Build* fading_out = nullptr;
+    int fade_position = 0;
+    int fade_length = 1;
+    float crossfade_ms;
+
+    //handed between the two threads
+    std::atomic<Build*> pending{nullptr};
+    std::atomic<Build*> retired{nullptr};
+    std::atomic<bool> rebuild{false}; //pending was built for a different rate or channel count
+    std::atomic<float> sample_rate{44100.0f};
+    std::atomic<int> channel_count{2};
+    std::atomic<int> swaps{0};
+    std::atomic<int> latency_samples{0};
+    const DiskCache cache; //only read, so both threads can build from it
+
+    //watcher
+    std::thread watcher;
+    mutable std::mutex mutex; //guards the strings and the wakeup
+    std::condition_variable wake;
+    bool stopping = false;
+    std::string watched;
+    std::string error;
+};
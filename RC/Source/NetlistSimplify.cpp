@@ -0,0 +1,424 @@
+
+
+#include "NetlistSimplify.h"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+namespace {
+
+//the netlist being simplified and, in step with its elements, the register each one's value is in
+struct Work {
+    Netlist net;
+    std::int16_t value_of[Netlist::max_elements];
+    Reduction* reduction; //the steps go in here
+    int n_registers = 0;
+
+    Work(const Netlist& original, Reduction* r) : net(original), reduction(r){
+        for(int i = 0; i < net.num_elements(); ++i)
+            value_of[i] = static_cast<std::int16_t>(i);
+        n_registers = net.num_elements();
+        reduction->n_steps = 0;
+        reduction->n_original = net.num_elements();
+    }
+
+    void remove(int i){ //the same shuffle Netlist does, the last one into the hole
+        value_of[i] = value_of[net.num_elements() - 1];
+        net.remove_element(i);
+    }
+
+    //records one step and returns the register it writes, once the recording is full it keeps
+    //going without one
+    std::int16_t step(Reduction::Op op, int a, int b, int c = -1, float ca = 1.0f, float cb = 1.0f){
+        if(!reduction->valid() || reduction->n_steps >= Reduction::max_steps){
+            reduction->n_steps = -1;
+            return -1;
+        }
+        Reduction::Step& st = reduction->steps[reduction->n_steps++];
+        st.op = op;
+        st.a = static_cast<std::int16_t>(a);
+        st.b = static_cast<std::int16_t>(b);
+        st.c = static_cast<std::int16_t>(c);
+        st.ca = ca;
+        st.cb = cb;
+        return static_cast<std::int16_t>(n_registers++);
+    }
+};
+
+bool is_passive(const Element& e){
+    return e.type == ElementType::Resistor || e.type == ElementType::Capacitor;
+}
+
+bool same_nodes(const Element& a, const Element& b){
+    return (a.n1 == b.n1 && a.n2 == b.n2) || (a.n1 == b.n2 && a.n2 == b.n1);
+}
+
+//merging only keeps the noise right if both make the same kind at the same strength, a quiet 1k next to a
+//noisy 1k isn't a noisy 500 ohm
+bool same_noise(const Element& a, const Element& b){
+    return a.noise == b.noise && a.kf == b.kf;
+}
+
+int other_end(const Element& e, int node){
+    return e.n1 == node ? e.n2 : e.n1;
+}
+
+//nodes that have to survive every pass
+bool is_pinned(const Netlist& net, int node){
+    if(node == 0 || node == net.get_output() || net.is_probe(node))
+        return true;
+    for(int i = 0; i < net.num_elements(); ++i){
+        const Element& e = net.element(i);
+        if(e.type == ElementType::VoltageSource && (e.n1 == node || e.n2 == node))
+            return true;
+    }
+    return false;
+}
+
+
+bool remove_self_loops(Work& w){
+    const Netlist& net = w.net;
+    bool changed = false;
+    for(int i = net.num_elements() - 1; i >= 0; --i){
+        if(net.element(i).n1 == net.element(i).n2){
+            w.remove(i);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+
+bool remove_dangling(Work& w){
+    const Netlist& net = w.net;
+    bool changed = false;
+    for(int i = net.num_elements() - 1; i >= 0; --i){
+        const Element& e = net.element(i);
+        const bool loose1 = e.n1 != 0 && e.n1 != net.get_output() && !net.is_probe(e.n1) && net.degree(e.n1) == 1;
+        const bool loose2 = e.n2 != 0 && e.n2 != net.get_output() && !net.is_probe(e.n2) && net.degree(e.n2) == 1;
+        if(loose1 || loose2){ //no current can flow through it so nothing else can see it
+            w.remove(i);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+
+//an R or C straight across an ideal source only changes the source current, which nobody reads
+bool remove_shunted_by_source(Work& w){
+    const Netlist& net = w.net;
+    bool changed = false;
+    for(int i = net.num_elements() - 1; i >= 0; --i){
+        if(!is_passive(net.element(i)))
+            continue;
+        for(int j = 0; j < net.num_elements(); ++j){
+            if(net.element(j).type == ElementType::VoltageSource && same_nodes(net.element(i), net.element(j))){
+                w.remove(i);
+                changed = true;
+                break;
+            }
+        }
+    }
+    return changed;
+}
+
+
+//two ideal sources across the same pair of nodes only have a solution if they say the same thing
+void check_parallel_sources(const Element& a, const Element& b){
+    const float sign = (a.n1 == b.n1) ? 1.0f : -1.0f;
+    const bool agree = a.is_input == b.is_input && (!a.is_input || sign > 0.0f) && a.value == sign * b.value;
+    if(!agree)
+        throw std::invalid_argument(std::string("simplify: '") + a.name + "' and '" + b.name + "' are in parallel and disagree");
+}
+
+
+bool merge_parallel(Work& w, bool passives, bool sources){
+    Netlist& net = w.net;
+    for(int i = 0; i < net.num_elements(); ++i){
+        for(int j = i + 1; j < net.num_elements(); ++j){
+            Element& a = net.element(i);
+            const Element& b = net.element(j);
+            if(a.type != b.type || !same_nodes(a, b) || !same_noise(a, b))
+                continue;
+
+            const int va = w.value_of[i];
+            const int vb = w.value_of[j];
+            if(a.type == ElementType::Resistor && passives){
+                a.value = (a.value * b.value)/(a.value + b.value); //at one temperature that's the same thermal noise
+                w.value_of[i] = w.step(Reduction::Op::ProductOverSum, va, vb);
+            }
+            else if(a.type == ElementType::Capacitor && passives){
+                a.value += b.value;
+                w.value_of[i] = w.step(Reduction::Op::Sum, va, vb);
+            }
+            else if(a.type == ElementType::Diode && passives && a.n1 == b.n1 && a.param == b.param){
+                //identical diodes side by side are one diode with the currents added. Shot and flicker noise
+                //both go with the current, so the halves' noise adds up to the whole's and kf stays
+                a.value += b.value;
+                w.value_of[i] = w.step(Reduction::Op::Sum, va, vb);
+            }
+            else if(a.type == ElementType::VoltageSource){
+                check_parallel_sources(a, b);
+                if(!sources)
+                    continue;
+                //they agree, so either one will do
+            }
+            else{
+                continue;
+            }
+
+            w.remove(j);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool merge_series(Work& w, bool passives, bool sources){
+    Netlist& net = w.net;
+    for(int node = 1; node < net.num_nodes(); ++node){
+        if(node == net.get_output() || net.is_probe(node) || net.degree(node) != 2)
+            continue;
+
+        int ia = -1;
+        int ib = -1;
+        for(int i = 0; i < net.num_elements(); ++i){
+            const Element& e = net.element(i);
+            if(e.n1 == node || e.n2 == node){
+                if(ia < 0)
+                    ia = i;
+                else
+                    ib = i;
+            }
+        }
+        if(ia < 0 || ib < 0)
+            continue;
+
+        Element& a = net.element(ia);
+        const Element& b = net.element(ib);
+        if(a.type != b.type || !same_noise(a, b))
+            continue;
+
+        if(a.type == ElementType::VoltageSource){
+            if(!sources || (a.is_input && b.is_input))
+                continue;
+
+            //walk p -> node -> q adding up the drops, keeping the input source's polarity
+            const float sa = (a.n2 == node) ? 1.0f : -1.0f;
+            const float sb = (b.n1 == node) ? 1.0f : -1.0f;
+            int p = other_end(a, node);
+            int q = other_end(b, node);
+            float v = sa * a.value + sb * b.value;
+            const bool input = a.is_input || b.is_input;
+            const float s_in = a.is_input ? sa : (b.is_input ? sb : 1.0f);
+            if(s_in < 0.0f){
+                std::swap(p, q);
+                v = -v;
+            }
+            a.n1 = p;
+            a.n2 = q;
+            a.value = v;
+            a.is_input = input;
+            w.value_of[ia] = w.step(Reduction::Op::Sum, w.value_of[ia], w.value_of[ib], -1, sa * s_in, sb * s_in);
+        }
+        else{
+            if(!passives || !is_passive(a))
+                continue;
+
+            if(a.type == ElementType::Resistor){
+                a.value += b.value;
+                w.value_of[ia] = w.step(Reduction::Op::Sum, w.value_of[ia], w.value_of[ib]);
+            }
+            else{
+                a.value = (a.value * b.value)/(a.value + b.value);
+                w.value_of[ia] = w.step(Reduction::Op::ProductOverSum, w.value_of[ia], w.value_of[ib]);
+            }
+
+            const int p = other_end(a, node);
+            const int q = other_end(b, node);
+            a.n1 = p;
+            a.n2 = q;
+        }
+
+        w.remove(ib);
+        return true;
+    }
+    return false;
+}
+
+
+//star-mesh transform, the netlist version of a Kron reduction on one node
+bool kron_reduce(Work& w, int max_degree){
+    Netlist& net = w.net;
+    for(int node = 1; node < net.num_nodes(); ++node){
+        if(is_pinned(net, node))
+            continue;
+
+        const int d = net.degree(node);
+        if(d < 3 || d > max_degree)
+            continue;
+
+        //a uniform temperature resistive network keeps its thermal noise through kron, but only if every
+        //resistor in the star is noisy or every one is quiet
+        int star[Netlist::max_elements];
+        int count = 0;
+        bool uniform = true;
+        for(int i = 0; i < net.num_elements() && uniform; ++i){
+            const Element& e = net.element(i);
+            if(e.n1 == node || e.n2 == node){
+                uniform = e.type == ElementType::Resistor && (count == 0 || same_noise(e, net.element(star[0])));
+                star[count++] = i;
+            }
+        }
+        if(!uniform)
+            continue;
+
+        //make sure the mesh fits before we start tearing the star out
+        const int mesh = count * (count - 1)/2;
+        if(net.num_elements() - count + mesh > Netlist::max_elements)
+            continue;
+
+        int ends[Netlist::max_elements];
+        int values[Netlist::max_elements];
+        float g[Netlist::max_elements];
+        float g_sum = 0.0f;
+        int g_sum_value = -1;
+        const std::uint8_t noise = net.element(star[0]).noise;
+        for(int k = 0; k < count; ++k){
+            const Element& e = net.element(star[k]);
+            ends[k] = other_end(e, node);
+            values[k] = w.value_of[star[k]];
+            g[k] = 1.0f/e.value;
+            g_sum += g[k];
+            g_sum_value = w.step(Reduction::Op::AddConductance, g_sum_value, values[k]);
+        }
+
+        for(int k = count - 1; k >= 0; --k) //indices are ascending so removing backwards keeps them valid
+            w.remove(star[k]);
+
+        for(int i = 0; i < count; ++i){
+            for(int j = i + 1; j < count; ++j){
+                char name[16];
+                std::snprintf(name, sizeof(name), "K%d_%d_%d", node, ends[i], ends[j]);
+                const int r = net.add_resistor(name, ends[i], ends[j], g_sum/(g[i] * g[j]));
+                net.element(r).noise = noise;
+                w.value_of[r] = w.step(Reduction::Op::Mesh, g_sum_value, values[i], values[j]);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+
+//drop node numbers nobody uses anymore so the engines size their systems to what's left
+Netlist compact(const Netlist& net){
+    int map[Netlist::max_nodes];
+    for(int n = 0; n < Netlist::max_nodes; ++n)
+        map[n] = -1;
+
+    Netlist out;
+    map[0] = 0;
+    auto remap = [&](int n){
+        if(map[n] < 0)
+            map[n] = out.add_node();
+        return map[n];
+    };
+
+    for(int i = 0; i < net.num_elements(); ++i){
+        const Element& e = net.element(i);
+        const int n1 = remap(e.n1);
+        const int n2 = remap(e.n2);
+        out.add_copy(e, n1, n2);
+    }
+    out.set_output(remap(net.get_output()));
+    for(int i = 0; i < net.num_probes(); ++i)
+        out.add_probe(remap(net.get_probe(i)));
+    return out;
+}
+
+}
+
+
+bool Reduction::consistent() const{
+    if(n_steps < -1 || n_steps > max_steps || n_original < 0 || n_original > Netlist::max_elements
+       || n_reduced < 0 || n_reduced > Netlist::max_elements)
+        return false;
+    if(!valid())
+        return true;
+
+    auto readable = [](int reg, int written){ return reg >= 0 && reg < written; };
+    for(int k = 0; k < n_steps; ++k){
+        const Step& st = steps[k];
+        const int written = n_original + k;
+        bool ok = false;
+        switch(st.op){
+            case Op::Sum:
+            case Op::ProductOverSum: ok = readable(st.a, written) && readable(st.b, written); break;
+            case Op::AddConductance: ok = (st.a == -1 || readable(st.a, written)) && readable(st.b, written); break;
+            case Op::Mesh: ok = readable(st.a, written) && readable(st.b, written) && readable(st.c, written); break;
+        }
+        if(!ok)
+            return false;
+    }
+    for(int i = 0; i < n_reduced; ++i){
+        if(!readable(value_of[i], n_original + n_steps))
+            return false;
+    }
+    return true;
+}
+
+
+void Reduction::apply(const Netlist& original, Netlist& reduced) const{
+    //same float arithmetic in the same order as the passes, so the values come out the same as simplify()'s
+    float r[max_registers];
+    for(int i = 0; i < n_original; ++i)
+        r[i] = original.element(i).value;
+
+    for(int k = 0; k < n_steps; ++k){
+        const Step& st = steps[k];
+        float& out = r[n_original + k];
+        switch(st.op){
+            case Op::Sum: out = st.ca * r[st.a] + st.cb * r[st.b]; break;
+            case Op::ProductOverSum: out = (r[st.a] * r[st.b])/(r[st.a] + r[st.b]); break;
+            case Op::AddConductance: out = (st.a < 0 ? 0.0f : r[st.a]) + 1.0f/r[st.b]; break;
+            case Op::Mesh: out = r[st.a]/((1.0f/r[st.b]) * (1.0f/r[st.c])); break;
+        }
+    }
+
+    for(int i = 0; i < n_reduced; ++i)
+        reduced.element(i).value = r[value_of[i]];
+}
+
+
+Netlist simplify(const Netlist& net, const SimplifyOptions& options, Reduction* reduction){
+    Reduction scratch;
+    Work work(net, reduction ? reduction : &scratch);
+
+    bool changed = true;
+    while(changed){
+        changed = remove_self_loops(work);
+
+        if(options.remove_dangling)
+            changed |= remove_dangling(work);
+
+        if(options.merge_sources)
+            changed |= remove_shunted_by_source(work);
+
+        changed |= merge_parallel(work, options.series_parallel, options.merge_sources);
+        changed |= merge_series(work, options.series_parallel, options.merge_sources);
+
+        if(options.kron_reduce && !changed)
+            changed = kron_reduce(work, options.max_kron_degree);
+    }
+
+    //compact() keeps the element order
+    work.reduction->n_reduced = work.net.num_elements();
+    for(int i = 0; i < work.net.num_elements(); ++i)
+        work.reduction->value_of[i] = work.value_of[i];
+    return compact(work.net);
+}
@@ -0,0 +1,69 @@
+
+
+
+#pragma once
+#include "Netlist.h"
+
+
+/* Netlist simplification
+ * Shrinks a netlist before any engine gets built from it. Every pass keeps the voltage at the
+ * output node identical, it just gets rid of unknowns the engines would otherwise carry around:
+ *  - dangling elements (one end hanging in the air) and self loops
+ *  - resistors/capacitors sitting directly across an ideal source
+ *  - series and parallel resistors/capacitors, and identical diodes in parallel
+ *  - ideal sources in parallel (same nodes) or in series (through an otherwise unused node). Parallel ones
+ *    have to agree: the same signed value, and either both or neither carrying the input. Anything else
+ *    has no solution and throws std::invalid_argument, whether or not merge_sources is on
+ *  - Kron reduction (star-mesh) of internal nodes that only touch resistors, so no state lives there
+ * Ground, the output node, probes and source terminals are never removed.
+ */
+struct SimplifyOptions {
+    bool remove_dangling = true;
+    bool series_parallel = true;
+    bool merge_sources = true;
+    bool kron_reduce = true;
+    int max_kron_degree = 3; //star-mesh on a node with d resistors makes d(d-1)/2 new ones, so keep d small
+};
+
+
+/* Reduction
+ * The arithmetic simplify() did on the values, recorded on the way so a knob change can redo just that
+ * on new values instead of searching the netlist all over again. Which elements merge only depends on
+ * the structure (types, nodes, noise, diode params), never on values, so the same steps hold for any
+ * values. apply() wants the netlist simplify() was given with nothing but values changed, and the
+ * netlist simplify() returned for it. Fixed size and heap free like Netlist, so apply() is fine on the
+ * audio thread. A reduction too long to record comes out invalid, then it's simplify() again.
+ */
+struct Reduction {
+    static constexpr int max_steps = 4 * Netlist::max_elements;
+    static constexpr int max_registers = Netlist::max_elements + max_steps;
+
+    enum class Op : std::uint8_t {
+        Sum, //ca a + cb b: series R, parallel C, diodes side by side, sources in series
+        ProductOverSum, //a b/(a + b): parallel R, series C
+        AddConductance, //a + 1/b, a < 0 starts from 0: the sum of a star's conductances for kron
+        Mesh //a/((1/b)(1/c)), a the star's conductance sum: one resistor of the mesh
+    };
+    struct Step {
+        Op op = Op::Sum;
+        std::int16_t a = -1; //registers, the first n_original hold the original values in element order
+        std::int16_t b = -1;
+        std::int16_t c = -1;
+        float ca = 1.0f;
+        float cb = 1.0f;
+    };
+
+    Step steps[max_steps];
+    int n_steps = -1; //-1 while invalid
+    int n_original = 0;
+    int n_reduced = 0;
+    std::int16_t value_of[Netlist::max_elements]; //register holding each reduced element's value
+
+    bool valid() const { return n_steps >= 0; }
+    //every register read has already been written, for one that came off disk
+    bool consistent() const;
+    void apply(const Netlist& original, Netlist& reduced) const;
+};
+
+
+Netlist simplify(const Netlist& net, const SimplifyOptions& options = {}, Reduction* reduction = nullptr);
@@ -0,0 +1,93 @@
+
+
+#include "Noise.h"
+#include "FastMath.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+
+void CounterRNG::fill_uniform(float* out, int n){
+    constexpr std::uint32_t mult = 0xD256D193u;
+    constexpr std::uint32_t weyl = 0x9E3779B9u;
+    constexpr int chunk = 64;
+
+    std::uint32_t x0[chunk];
+    std::uint32_t x1[chunk];
+
+    for(int start = 0; start < n; start += 2 * chunk){
+        const int pairs = std::min(chunk, (n - start + 1)/2);
+
+        //every lane is its own counter, all ten rounds are the same straight line code per lane
+        for(int i = 0; i < pairs; ++i){
+            const std::uint64_t c = counter + static_cast<std::uint64_t>(i);
+            x0[i] = static_cast<std::uint32_t>(c);
+            x1[i] = static_cast<std::uint32_t>(c >> 32);
+        }
+
+        std::uint32_t k = key;
+        for(int round = 0; round < 10; ++round){
+            for(int i = 0; i < pairs; ++i){
+                const std::uint64_t product = static_cast<std::uint64_t>(mult) * x0[i];
+                const std::uint32_t hi = static_cast<std::uint32_t>(product >> 32);
+                const std::uint32_t lo = static_cast<std::uint32_t>(product);
+                x0[i] = hi ^ k ^ x1[i];
+                x1[i] = lo;
+            }
+            k += weyl;
+        }
+
+        //top 24 bits -> (0, 1], never exactly 0 so log() downstream is safe
+        constexpr float scale = 1.0f/16777216.0f;
+        const int count = std::min(2 * pairs, n - start);
+        for(int i = 0; i < count; ++i){
+            const std::uint32_t bits = (i & 1) ? x1[i >> 1] : x0[i >> 1];
+            out[start + i] = static_cast<float>((bits >> 8) + 1u) * scale;
+        }
+
+        counter += static_cast<std::uint64_t>(pairs);
+    }
+}
+
+
+void CounterRNG::fill_normal(float* out, int n){
+    fill_uniform(out, n);
+
+    constexpr float two_pi = 6.28318530718f;
+    for(int i = 0; i + 1 < n; i += 2){
+        const float r = std::sqrt(-2.0f * fastmath::log<fastmath::Accuracy::Full>(out[i]));
+        const float phase = two_pi * out[i + 1];
+        out[i] = r * std::cos(phase);
+        out[i + 1] = r * std::sin(phase);
+    }
+}
+
+
+void PinkFilter::prepare(float fs){
+    //magnitude of the filter at 1 kHz, so we can scale it to unity there
+    const std::complex<float> z = std::polar(1.0f, -6.28318530718f * 1000.0f/fs);
+    const std::complex<float> h = 0.0990460f/(1.0f - 0.99765f * z)
+                                + 0.2965164f/(1.0f - 0.96300f * z)
+                                + 1.0526913f/(1.0f - 0.57000f * z)
+                                + 0.1848f;
+    gain = 1.0f/std::abs(h);
+    b0 = b1 = b2 = 0.0f;
+}
+
+
+void NoiseBlock::prepare(int num_streams, int length, std::uint32_t seed){
+    streams = num_streams;
+    block_length = length;
+    rng = CounterRNG(seed);
+
+    //keep the buffer even so box-muller always has its pairs
+    const int total = streams * block_length;
+    normals.assign(total + (total & 1), 0.0f);
+    read = block_length; //fill on first use
+}
+
+
+void NoiseBlock::refill(){
+    rng.fill_normal(normals.data(), static_cast<int>(normals.size()));
+    read = 0;
+}
@@ -0,0 +1,87 @@
+
+
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+
+/* Component noise
+ * A counter based RNG (Philox2x32-10): output only depends on (key, counter), so a whole block comes out of
+ * plain loops over independent counters that the compiler can vectorize, and nothing has to be carried
+ * from one number to the next. Engines pull normals from a NoiseBlock that gets refilled a block at a time
+ * instead of calling into <random> every sample.
+ */
+namespace noise {
+
+constexpr float boltzmann = 1.380649e-23f;
+constexpr float electron_charge = 1.602176634e-19f;
+
+//one-sided white noise spread over 0..fs/2: variance = psd * fs/2
+inline float thermal_voltage_variance(float r, float temperature, float fs) { return 2.0f * boltzmann * temperature * r * fs; }
+inline float thermal_current_variance(float r, float temperature, float fs) { return 2.0f * boltzmann * temperature * fs/r; }
+inline float shot_current_variance(float i, float fs) { return electron_charge * (i < 0.0f ? -i : i) * fs; }
+
+}
+
+
+class CounterRNG {
+
+public:
+    explicit CounterRNG(std::uint32_t seed = 0x5eed) : key{seed} {}
+
+    void seek(std::uint64_t c) { counter = c; }
+    void fill_uniform(float* out, int n); //(0, 1]
+    void fill_normal(float* out, int n); //n has to be even, box-muller works in pairs
+
+private:
+    std::uint32_t key;
+    std::uint64_t counter = 0;
+};
+
+
+/* Pink (1/f) noise from white, Paul Kellet's three pole filter.
+ * Normalized at prepare so the output PSD matches the input PSD at 1 kHz.
+ */
+class PinkFilter {
+
+public:
+    void prepare(float fs);
+    float process(float white){
+        b0 = 0.99765f * b0 + white * 0.0990460f;
+        b1 = 0.96300f * b1 + white * 0.2965164f;
+        b2 = 0.57000f * b2 + white * 1.0526913f;
+        return gain * (b0 + b1 + b2 + white * 0.1848f);
+    }
+
+private:
+    float b0 = 0.0f;
+    float b1 = 0.0f;
+    float b2 = 0.0f;
+    float gain = 1.0f;
+};
+
+
+/* Unit normals for `streams` independent noise sources, generated block_length samples ahead. */
+class NoiseBlock {
+
+public:
+    void prepare(int streams, int block_length = 256, std::uint32_t seed = 0x5eed);
+
+    const float* next(){ //one normal per stream for this sample
+        if(read >= block_length)
+            refill();
+        return normals.data() + (read++) * streams;
+    }
+
+    int num_streams() const { return streams; }
+
+private:
+    void refill();
+
+    CounterRNG rng;
+    std::vector<float> normals;
+    int streams = 0;
+    int block_length = 0;
+    int read = 0;
+};
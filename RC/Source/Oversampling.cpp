@@ -0,0 +1,306 @@
+
+
+#include "Oversampling.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+
+int oversampling_for_poles(const std::complex<double>* poles, int num_poles, float fs, const OversamplingTarget& target){
+    const double pi = 3.14159265358979;
+    int factor = 1;
+    for(; factor < target.max_factor; factor *= 2){
+        const double half_T = 0.5/(static_cast<double>(fs) * factor);
+        bool good = true;
+        for(int i = 0; i < num_poles && good; ++i){
+            const std::complex<double> p = poles[i];
+            if(p.real() >= 0.0)
+                continue;
+
+            const std::complex<double> z = (1.0 + p * half_T)/(1.0 - p * half_T);
+            if(z.real() < -target.max_ringing)
+                good = false;
+
+            const double u = std::abs(p) * half_T;
+            if(std::abs(p) <= pi * fs && 1.0 - std::atan(u)/u > target.accuracy)
+                good = false;
+        }
+        if(good)
+            break;
+    }
+    return factor;
+}
+
+
+const float* HalfBand::taps(){
+    //h[m] = sinc((m - 15)/2)/2 under a kaiser window, the odd offsets from the middle are the ones left
+    static const std::array<float, phase_taps> t = []{
+        auto bessel_i0 = [](double x){
+            double sum = 1.0, term = 1.0;
+            for(int k = 1; k < 32; ++k){
+                term *= (x/(2.0 * k)) * (x/(2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        const double pi = 3.14159265358979;
+        const double beta = 8.0;
+        double h[phase_taps];
+        double sum = 0.0;
+        for(int k = 0; k < phase_taps; ++k){
+            const double d = 2.0 * k - delay; //odd
+            const double r = d/delay;
+            const double window = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r)))/bessel_i0(beta);
+            h[k] = std::sin(pi * d/2.0)/(pi * d) * window;
+            sum += h[k];
+        }
+        std::array<float, phase_taps> out{};
+        for(int k = 0; k < phase_taps; ++k)
+            out[static_cast<std::size_t>(k)] = static_cast<float>(0.5 * h[k]/sum); //exactly unity at dc
+        return out;
+    }();
+    return t.data();
+}
+
+
+void HalfBand::clear(){
+    std::fill(std::begin(even), std::end(even), 0.0f);
+    std::fill(std::begin(odd), std::end(odd), 0.0f);
+    position = 0;
+}
+
+
+void HalfBand::up(float x, float* out){
+    position = (position == 0 ? phase_taps : position) - 1;
+    even[position] = even[position + phase_taps] = x;
+
+    const float* h = taps();
+    const float* past = even + position;
+    float y = 0.0f;
+    for(int k = 0; k < phase_taps; ++k)
+        y += h[k] * past[k];
+    out[0] = 2.0f * y;
+    out[1] = past[delay/2]; //the middle tap, 1/2 times the zero stuffing gain of 2
+}
+
+
+float HalfBand::down(const float* in){
+    position = (position == 0 ? phase_taps : position) - 1;
+    even[position] = even[position + phase_taps] = in[0];
+    odd[position] = odd[position + phase_taps] = in[1];
+
+    const float* h = taps();
+    const float* past = even + position;
+    float y = 0.0f;
+    for(int k = 0; k < phase_taps; ++k)
+        y += h[k] * past[k];
+    return y + 0.5f * odd[position + delay/2 + 1];
+}
+
+
+namespace {
+
+//delay through the up (or down) stages of a 2^stages factor, in samples at the base rate
+double stage_delay(int stages){
+    double d = 0.0;
+    for(int j = 1; j <= stages; ++j)
+        d += HalfBand::delay/std::ldexp(1.0, j);
+    return d;
+}
+
+}
+
+
+void OversampledMNA::Path::configure(int new_factor, int top_stages){
+    factor = new_factor;
+    stages = 0;
+    while((1 << stages) < factor)
+        ++stages;
+    //pre lines the engines up in time (so state can move between them), post makes the totals match
+    const double missing = stage_delay(top_stages) - stage_delay(stages);
+    pre_length = static_cast<int>(std::lround(missing));
+    post_length = static_cast<int>(std::lround(2.0 * missing)) - pre_length;
+    clear();
+}
+
+
+void OversampledMNA::Path::clear(){
+    for(int j = 0; j < max_stages; ++j){
+        up[j].clear();
+        down[j].clear();
+    }
+    std::fill(std::begin(pre), std::end(pre), 0.0f);
+    std::fill(std::begin(post), std::end(post), 0.0f);
+    pre_position = 0;
+    post_position = 0;
+}
+
+
+void OversampledMNA::Path::prime(float x){
+    if(pre_length > 0){
+        std::swap(x, pre[pre_position]);
+        pre_position = (pre_position + 1) % pre_length;
+    }
+    float a[max_factor], b[max_factor];
+    a[0] = x;
+    for(int j = 0, n = 1; j < stages; ++j, n *= 2){
+        for(int i = 0; i < n; ++i)
+            up[j].up(a[i], b + 2 * i);
+        std::copy(b, b + 2 * n, a);
+    }
+}
+
+
+float OversampledMNA::Path::run(float x){
+    if(pre_length > 0){
+        std::swap(x, pre[pre_position]);
+        pre_position = (pre_position + 1) % pre_length;
+    }
+
+    float a[max_factor], b[max_factor];
+    a[0] = x;
+    int n = 1;
+    for(int j = 0; j < stages; ++j, n *= 2){
+        for(int i = 0; i < n; ++i)
+            up[j].up(a[i], b + 2 * i);
+        std::copy(b, b + 2 * n, a);
+    }
+
+    for(int i = 0; i < n; ++i)
+        a[i] = engine.process_sample(a[i]);
+
+    for(int j = stages - 1; j >= 0; --j){
+        n /= 2;
+        for(int i = 0; i < n; ++i)
+            b[i] = down[j].down(a + 2 * i);
+        std::copy(b, b + n, a);
+    }
+
+    float y = a[0];
+    if(post_length > 0){
+        std::swap(y, post[post_position]);
+        post_position = (post_position + 1) % post_length;
+    }
+    return y;
+}
+
+
+OversampledMNA::OversampledMNA(const Netlist& circuit, const OversamplingTarget& t, float fade_ms)
+    : target(t), crossfade_ms(fade_ms), first(circuit), second(circuit) {
+    int top = 1;
+    while(top * 2 <= std::min(target.max_factor, max_factor))
+        top *= 2;
+    target.max_factor = top;
+    top_stages = 0;
+    while((1 << top_stages) < top)
+        ++top_stages;
+    latency_samples = static_cast<int>(std::lround(2.0 * stage_delay(top_stages)));
+}
+
+
+void OversampledMNA::prepare(float sr){
+    fs = sr;
+    fade_length = std::max(1, static_cast<int>(crossfade_ms * 0.001f * fs));
+    fade_position = -1;
+    analyse();
+
+    Path& p = *path[active];
+    p.configure(wanted, top_stages);
+    p.engine.prepare(fs * wanted);
+    reset();
+}
+
+
+void OversampledMNA::reset(float input){
+    fade_position = -1;
+    Path& p = *path[active];
+    p.clear();
+
+    //filters full of the input and the engine at its operating point for it, so nothing moves
+    for(int i = 0; i < history_length; ++i)
+        p.prime(input);
+    p.engine.reset(input);
+    for(int i = 0; i < history_length; ++i)
+        p.run(input);
+
+    std::fill(std::begin(history), std::end(history), input);
+    history_position = 0;
+}
+
+
+void OversampledMNA::analyse(){
+    wanted = path[active]->engine.stable_oversampling(fs, target);
+}
+
+
+void OversampledMNA::start_switch(){
+    Path& incoming = *path[1 - active];
+    incoming.configure(wanted, top_stages);
+    incoming.engine.set_rate(fs * wanted);
+
+    //same recent input through its own up stages, then the engine carries on from where the other one is
+    for(int i = 0; i < history_length; ++i)
+        incoming.prime(history[(history_position + i) % history_length]);
+    incoming.engine.copy_state(path[active]->engine);
+
+    hold = history_length;
+    fade_position = 0;
+}
+
+
+float OversampledMNA::process_sample(float x){
+    if(fade_position < 0 && wanted != path[active]->factor)
+        start_switch();
+
+    history[history_position] = x;
+    history_position = (history_position + 1) % history_length;
+
+    float y = path[active]->run(x);
+    if(fade_position >= 0){
+        const float z = path[1 - active]->run(x);
+        if(hold > 0){
+            --hold;
+        }
+        else{
+            const float g = static_cast<float>(fade_position)/static_cast<float>(fade_length);
+            y = g * z + (1.0f - g) * y;
+            if(++fade_position >= fade_length){
+                active = 1 - active;
+                fade_position = -1;
+            }
+        }
+    }
+    return y;
+}
+
+
+void OversampledMNA::set_knobs(float capacitor, float resistor){
+    if(capacitor == knob_c && resistor == knob_r)
+        return;
+    knob_c = capacitor;
+    knob_r = resistor;
+    first.engine.set_knobs(capacitor, resistor);
+    second.engine.set_knobs(capacitor, resistor);
+    analyse();
+}
+
+
+bool OversampledMNA::set_value(const char* name, float v){
+    const bool found = first.engine.set_value(name, v);
+    second.engine.set_value(name, v);
+    if(found)
+        analyse();
+    return found;
+}
+
+
+void OversampledMNA::set_adaptive(bool enabled, float tolerance, float release_ms){
+    first.engine.set_adaptive(enabled, tolerance, release_ms);
+    second.engine.set_adaptive(enabled, tolerance, release_ms);
+}
+
+
+void OversampledMNA::set_diode_table(bool enabled, const DiskCache* cache){
+    first.engine.set_diode_table(enabled, cache);
+    second.engine.set_diode_table(enabled, cache);
+}
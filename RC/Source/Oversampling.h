@@ -0,0 +1,139 @@
+
+
+
+#pragma once
+#include <complex>
+#include "MNA.h"
+
+
+/* Stability driven oversampling
+ * The trapezoid maps a pole p of the circuit to z = (1 + pT/2)/(1 - pT/2). Poles in the audio band come
+ * out with their frequency warped by atan(u)/u, u = |p| T/2, and stiff poles (a conducting diode across
+ * a small cap) land near z = -1, where they ring at nyquist instead of decaying. Both only depend on |p| T,
+ * so the cure is a shorter T, and how much shorter follows from the poles: the smallest power of two
+ * factor that gets every in band pole within `accuracy` and keeps every pole's z above -max_ringing.
+ * Diodes are linearized at junction_current, about the hardest they conduct in use, since a conducting
+ * junction is what makes a circuit stiff.
+ *
+ * Most knob settings don't need the worst case factor, so OversampledMNA redoes the analysis whenever a
+ * value changes and switches over when the answer changes.
+ */
+struct OversamplingTarget {
+    float accuracy = 1e-2f; //relative frequency error of the poles below nyquist
+    float max_ringing = 0.5f; //z >= -max_ringing, so a stiff mode at least halves every sample
+    float junction_current = 1e-3f; //amps
+    int max_factor = 16; //power of two
+};
+
+
+//smallest power of two (up to target.max_factor) that meets the target for these poles at fs. Poles in
+//the right half plane are left out, no factor fixes those
+int oversampling_for_poles(const std::complex<double>* poles, int num_poles, float fs, const OversamplingTarget& target);
+
+
+/* Half band filter
+ * 31 taps, kaiser windowed, for going up or down an octave. Every other tap is zero apart from the
+ * middle one, so each direction is one 16 tap dot product plus a delayed copy. 15 samples of delay at the
+ * higher rate either way.
+ */
+class HalfBand {
+
+public:
+    static constexpr int delay = 15;
+
+    HalfBand() { clear(); }
+    void clear();
+    void up(float x, float* out); //one sample in, two out at twice the rate
+    float down(const float* in); //two in, one out at half the rate
+
+private:
+    static constexpr int phase_taps = 16;
+    static const float* taps(); //the 16 odd offset taps, summing to 1/2
+
+    //newest first from position, written twice so a dot product never wraps
+    float even[2 * phase_taps];
+    float odd[2 * phase_taps];
+    int position = 0;
+};
+
+
+/* Oversampled MNA
+ * An MNA engine that runs at whatever factor stable_oversampling() says, through half band stages up and
+ * down. A knob change that changes the factor brings up the second engine at the new rate with the first
+ * one's state (node voltages and currents carry over between rates), primes its filters from the recent
+ * input, and crossfades once they've filled. Every factor is delayed to line up with the largest, so the
+ * latency is the same whatever factor is running and nothing combs during the fade.
+ * Same interface as MNA, realtime safe apart from prepare() and reset().
+ */
+class OversampledMNA {
+
+public:
+    static constexpr int max_factor = 16;
+
+    explicit OversampledMNA(const Netlist& circuit, const OversamplingTarget& target = {}, float crossfade_ms = 10.0f);
+    OversampledMNA(const OversampledMNA&) = delete; //path points into itself
+    OversampledMNA& operator=(const OversampledMNA&) = delete;
+
+    void prepare(float fs); //also resets
+    void reset(float input = 0.0f);
+    float process_sample(float x);
+    void set_knobs(float capacitor, float resistor);
+    bool set_value(const char* name, float v);
+    void set_adaptive(bool enabled, float tolerance = 1e-4f, float release_ms = 50.0f); //MNA::set_adaptive() on both paths
+    void set_diode_table(bool enabled, const DiskCache* cache = nullptr); //and MNA::set_diode_table(), not realtime safe
+
+    int factor() const { return path[active]->factor; }
+    int latency() const { return latency_samples; } //samples at the base rate, the same at every factor
+
+private:
+    static constexpr int max_stages = 4;
+    static constexpr int history_length = 64; //enough input to fill any factor's up stages
+    static constexpr int max_delay = 16;
+
+    struct Path {
+        explicit Path(const Netlist& circuit) : engine(circuit) {}
+        void configure(int new_factor, int top_stages);
+        void clear();
+        void prime(float x); //input side only, for filling the filters before a switch
+        float run(float x);
+
+        MNA engine;
+        int factor = 1;
+        int stages = 0;
+        HalfBand up[max_stages];
+        HalfBand down[max_stages];
+        //delays that line this factor up with the largest one, before the engine and after it
+        float pre[max_delay] = {};
+        float post[max_delay] = {};
+        int pre_length = 0;
+        int post_length = 0;
+        int pre_position = 0;
+        int post_position = 0;
+    };
+
+    void analyse(); //wanted = what the circuit needs now
+    void start_switch();
+
+    OversamplingTarget target;
+    float crossfade_ms;
+    float fs = 44100.0f;
+    int top_stages = 4;
+    int latency_samples = 0;
+
+    Path first;
+    Path second;
+    Path* path[2] = {&first, &second};
+    int active = 0;
+    int wanted = 1;
+
+    //switching: the new path runs silent for `hold` samples while its filters fill, then fades in
+    int hold = 0;
+    int fade_position = -1; //-1 when not switching
+    int fade_length = 1;
+
+    float history[history_length] = {};
+    int history_position = 0;
+
+    float knob_c = -1.0f;
+    float knob_r = -1.0f;
+};
@@ -8,7 +8,7 @@ RCThreeWaysAudioProcessorEditor::RCThreeWaysAudioProcessorEditor (RCThreeWaysAud
 {
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (500, 300);
+    setSize (500, 340);
     
     
     //Method Knob
@@ -50,11 +50,29 @@ RCThreeWaysAudioProcessorEditor::RCThreeWaysAudioProcessorEditor (RCThreeWaysAud
     cLabel.attachToComponent(&cKnob, false);
     addAndMakeVisible(cLabel);
     
-    
+    //Netlist file for method 4
+    netlistButton.onClick = [this]{
+        netlistChooser = std::make_unique<juce::FileChooser>("Netlist to watch", juce::File(), "*.cir;*.sp;*.net;*.txt");
+        netlistChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                    [this](const juce::FileChooser& chooser){
+                                        if(chooser.getResult().existsAsFile())
+                                            audioProcessor.load_netlist(chooser.getResult());
+                                    });
+    };
+    addAndMakeVisible(netlistButton);
+    addAndMakeVisible(netlistStatus);
+    timerCallback();
+    startTimerHz(4);
 }
 
 RCThreeWaysAudioProcessorEditor::~RCThreeWaysAudioProcessorEditor()
 {
+    stopTimer();
+}
+
+void RCThreeWaysAudioProcessorEditor::timerCallback()
+{
+    netlistStatus.setText(audioProcessor.netlist_status(), juce::NotificationType::dontSendNotification);
 }
 
 //==============================================================================
@@ -71,11 +89,16 @@ void RCThreeWaysAudioProcessorEditor::resized()
     // subcomponents in your editor..
     
     
-    auto knobW = getWidth() * 0.33f;
-    auto knobH = getHeight() * 0.7f;
-    auto knobY = (getHeight() * 0.5f) - knobH/2.f;
+    auto area = getLocalBounds();
+    auto netlistRow = area.removeFromBottom(40).reduced(10, 8);
+    netlistButton.setBounds(netlistRow.removeFromLeft(100));
+    netlistStatus.setBounds(netlistRow.withTrimmedLeft(10));
+    
+    auto knobW = area.getWidth() * 0.33f;
+    auto knobH = area.getHeight() * 0.7f;
+    auto knobY = (area.getHeight() * 0.5f) - knobH/2.f;
     
-    methodKnob.setBounds((getWidth()*0.20)-knobW/2.f, knobY, knobW, knobH);
-    rKnob.setBounds((getWidth()*0.5)-knobW/2.f, knobY, knobW, knobH);
-    cKnob.setBounds((getWidth()*0.80)-knobW/2.f, knobY, knobW, knobH);
+    methodKnob.setBounds((area.getWidth()*0.20)-knobW/2.f, knobY, knobW, knobH);
+    rKnob.setBounds((area.getWidth()*0.5)-knobW/2.f, knobY, knobW, knobH);
+    cKnob.setBounds((area.getWidth()*0.80)-knobW/2.f, knobY, knobW, knobH);
 }
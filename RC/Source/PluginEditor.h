@@ -7,7 +7,8 @@
 //==============================================================================
 /**
 */
-class RCThreeWaysAudioProcessorEditor  : public juce::AudioProcessorEditor
+class RCThreeWaysAudioProcessorEditor  : public juce::AudioProcessorEditor,
+                                         private juce::Timer
 {
 public:
     RCThreeWaysAudioProcessorEditor (RCThreeWaysAudioProcessor&);
@@ -18,6 +19,8 @@ public:
     void resized() override;
 
 private:
+    void timerCallback() override;
+
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     RCThreeWaysAudioProcessor& audioProcessor;
@@ -35,6 +38,10 @@ private:
     juce::Label cLabel;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> capacitorAttachment;
 
+    juce::TextButton netlistButton { "Netlist..." };
+    juce::Label netlistStatus;
+    std::unique_ptr<juce::FileChooser> netlistChooser;
+
     
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RCThreeWaysAudioProcessorEditor)
@@ -20,6 +20,7 @@ RCThreeWaysAudioProcessor::RCThreeWaysAudioProcessor()
 
 RCThreeWaysAudioProcessor::~RCThreeWaysAudioProcessor()
 {
+    cancelPendingUpdate();
 }
 
 //==============================================================================
@@ -92,6 +93,37 @@ void RCThreeWaysAudioProcessor::prepareToPlay (double sampleRate, int samplesPer
     
     DK.prepare(sampleRate);
     WavDig.prepare(sampleRate);
+    Nodal.prepare(sampleRate);
+    HotNetlist.prepare(sampleRate, getTotalNumInputChannels());
+    
+    // METHOD 0 is the cheapest engine that's accurate enough for the RC. DK, WDF and MNA all run it with
+    // the same trapezoid, so the knobs move their errors together and never change which one wins: it's
+    // picked once per topology and rate, here off the audio thread, and turning a knob can't swap engines
+    if (sampleRate != auto_rate) {
+        auto_rate = sampleRate;
+        try {
+            switch (select_engine(Netlist::rc_lowpass(10000.0f, 10e-9f), sampleRate).engine) {
+                case EngineChoice::DK: auto_method = 1; break;
+                case EngineChoice::WDF: auto_method = 2; break;
+                default: auto_method = 3; break;
+            }
+        }
+        catch (const std::exception&) {
+            auto_method = 2;
+        }
+    }
+
+    // before the first block, so the host knows from the start (processBlock keeps it current)
+    const int meth = static_cast<int> (apvts.getRawParameterValue("METHOD") -> load());
+    wanted_latency.store (meth == 4 ? HotNetlist.latency() : 0);
+    setLatencySamples (wanted_latency.load());
+}
+
+void RCThreeWaysAudioProcessor::handleAsyncUpdate()
+{
+    const int latency = wanted_latency.load();
+    if (latency != getLatencySamples())
+        setLatencySamples (latency);
 }
 
 void RCThreeWaysAudioProcessor::releaseResources()
@@ -100,6 +132,36 @@ void RCThreeWaysAudioProcessor::releaseResources()
     // spare memory, etc.
 }
 
+void RCThreeWaysAudioProcessor::reset()
+{
+    // transport jumped or playback restarted, so start the engines from their
+    // DC operating point rather than wherever the last block left them
+    DK.reset();
+    WavDig.reset();
+    Nodal.reset();
+    HotNetlist.reset();
+}
+
+
+void RCThreeWaysAudioProcessor::load_netlist (const juce::File& file)
+{
+    HotNetlist.watch (file.getFullPathName().toStdString());
+}
+
+
+juce::String RCThreeWaysAudioProcessor::netlist_status() const
+{
+    const auto path = HotNetlist.path();
+    if (path.empty())
+        return "no netlist";
+
+    const auto error = HotNetlist.last_error();
+    const auto name = juce::File (path).getFileName();
+    if (! error.empty())
+        return name + ": " + juce::String (error);
+    return name + " (build " + juce::String (HotNetlist.generation()) + ")";
+}
+
 #ifndef JucePlugin_PreferredChannelConfigurations
 bool RCThreeWaysAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
@@ -107,6 +169,12 @@ bool RCThreeWaysAudioProcessor::isBusesLayoutSupported (const BusesLayout& layou
     juce::ignoreUnused (layouts);
     return true;
   #else
+    // METHOD 3 keeps one state per channel and has room for MNA::max_channels of them, the rest would
+    // come out dry. Mono and stereo are well inside that, this keeps it so if more layouts are let in
+    if (layouts.getMainInputChannelSet().size() > MNA::max_channels
+     || layouts.getMainOutputChannelSet().size() > MNA::max_channels)
+        return false;
+
     // This is the place where you check if the layout is supported.
     // In this template code we only support mono or stereo.
     // Some plugin hosts, such as certain GarageBand versions, will only
@@ -135,12 +203,22 @@ void RCThreeWaysAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
     
     
     int meth = apvts.getRawParameterValue("METHOD") -> load();
+    if(meth == 0)
+        meth = auto_method;
     auto res {apvts.getRawParameterValue("RESISTOR") -> load()};
     auto cap {apvts.getRawParameterValue("CAPACITOR") -> load()};
 //    std::cout << meth << std::endl;
     
+    // only the netlist engine oversamples, and it's late by its filters' delay from its first build on.
+    // Reported whenever that changes, METHOD moving to or from 4 included, so the host lines it back up.
+    // Not from here though: the host may do anything in that callback, so it goes to the message thread
+    const int latency = meth == 4 ? HotNetlist.latency() : 0;
+    if (wanted_latency.exchange (latency) != latency)
+        triggerAsyncUpdate();
+    
     DK.setKnobs(res, cap);
     WavDig.setKnobs(res, cap);
+    Nodal.set_knobs(cap, res);
     
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
@@ -152,7 +230,7 @@ void RCThreeWaysAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
             {
                 auto* ch = buffer.getWritePointer (channel);
                 for(int n = 0; n < buffer.getNumSamples(); ++n){
-                    DK.process_sample(ch[n]);
+                    ch[n] = DK.process_sample(ch[n]);
                 }
             }
         
@@ -163,12 +241,19 @@ void RCThreeWaysAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
             {
                 auto* ch = buffer.getWritePointer (channel);
                 for(int n = 0; n < buffer.getNumSamples(); ++n){
-                    WavDig.process_sample(ch[n]);
+                    ch[n] = WavDig.process_sample(ch[n]);
                 }
             }
             std::cout << cap << std::endl;
             break; //do nothing
-        case 3: break; //do nothing
+        case 3:
+            // all channels at once, one state each
+            Nodal.process_block(buffer.getArrayOfWritePointers(), totalNumInputChannels, buffer.getNumSamples());
+            break;
+        case 4:
+            // swaps in rebuilt engines by itself, the R/C knobs don't apply to a loaded netlist
+            HotNetlist.process(buffer.getArrayOfWritePointers(), totalNumInputChannels, buffer.getNumSamples());
+            break;
     }
     
     
@@ -213,7 +298,9 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 juce::AudioProcessorValueTreeState::ParameterLayout RCThreeWaysAudioProcessor::create_params(){
     
     std::vector<std::unique_ptr<juce::RangedAudioParameter>> params;
-    params.push_back(std::make_unique<juce::AudioParameterInt> (juce::ParameterID("METHOD", 1), "capacitor", 1, 3, 2));
+    // 0 (auto) went in below the old 1..4, which moved every METHOD's normalised value: version 2 so hosts
+    // know automation recorded against version 1 doesn't line up
+    params.push_back(std::make_unique<juce::AudioParameterInt> (juce::ParameterID("METHOD", 2), "capacitor", 0, 4, 0));
     params.push_back(std::make_unique<juce::AudioParameterInt> (juce::ParameterID("RESISTOR", 2), "resistor", 0, 20000, 1000));
     params.push_back(std::make_unique<juce::AudioParameterInt> (juce::ParameterID("CAPACITOR", 2), "capacitor", 0, 20000, 1000));
     return {params.begin(), params.end()};
@@ -4,11 +4,15 @@
 #include <JuceHeader.h>
 #include "DKMethod.h"
 #include "WDF.h"
+#include "MNA.h"
+#include "NetlistReloader.h"
+#include "EngineSelector.h"
 
 //==============================================================================
 /**
 */
-class RCThreeWaysAudioProcessor  : public juce::AudioProcessor
+class RCThreeWaysAudioProcessor  : public juce::AudioProcessor,
+                                   private juce::AsyncUpdater
 {
 public:
     //==============================================================================
@@ -18,6 +22,7 @@ public:
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
+    void reset() override;
 
    #ifndef JucePlugin_PreferredChannelConfigurations
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
@@ -51,12 +56,23 @@ public:
     juce::AudioProcessorValueTreeState apvts;
     juce::AudioProcessorValueTreeState::ParameterLayout create_params();
 
+    // METHOD 4 runs this file through MNA and reloads it whenever it changes on disk
+    void load_netlist (const juce::File& file);
+    juce::String netlist_status() const;
+
 private:
     //==============================================================================
-    
+    // setLatencySamples calls back into the host, so processBlock leaves the value here and it's reported
+    // from the message thread
+    void handleAsyncUpdate() override;
     
     DKMethod DK;
     RCLowPass WavDig;
+    MNA Nodal;
+    NetlistReloader HotNetlist;
+    int auto_method = 2; //what METHOD 0 runs, picked in prepareToPlay
+    double auto_rate = 0.0; //the rate it was picked for
+    std::atomic<int> wanted_latency {0}; //what processBlock last asked to report
     
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RCThreeWaysAudioProcessor)
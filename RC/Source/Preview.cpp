@@ -0,0 +1,135 @@
+
+
+#include "Preview.h"
+#include <algorithm>
+
+
+namespace {
+
+constexpr int lanes = PreviewBank::lanes;
+
+
+//DKMethod::process_sample lane by lane, tile[n * lanes + l] gets setting l's output. The coefficients and
+//states come into locals so nothing the loop writes can alias them and it vectorizes across the lanes
+void run_dk(const float* coefficient_r, const float* coefficient_gain, const float* coefficient_back, float* history,
+            const float* in, float* tile, int n){
+    float r[lanes], gain[lanes], back[lanes], state[lanes];
+    std::copy(coefficient_r, coefficient_r + lanes, r);
+    std::copy(coefficient_gain, coefficient_gain + lanes, gain);
+    std::copy(coefficient_back, coefficient_back + lanes, back);
+    std::copy(history, history + lanes, state);
+    for(int i = 0; i < n; ++i){
+        const float x = in[i];
+        float* y = tile + i * lanes;
+        for(int l = 0; l < lanes; ++l){
+            const float v = (x + r[l] * state[l]) * gain[l];
+            state[l] = back[l] * v - state[l];
+            y[l] = v;
+        }
+    }
+    std::copy(state, state + lanes, history);
+}
+
+
+//RCLowPass::process_sample with the tree worked out: the resistor reflects 0 and the cap its delayed wave s,
+//so the source sees s, sends 2 Vin - s back, and the adaptor hands the cap -(x + port 1's wave)
+void run_wdf(const float* coefficient_gain, float* history, const float* in, float* tile, int n){
+    float gain[lanes], state[lanes];
+    std::copy(coefficient_gain, coefficient_gain + lanes, gain);
+    std::copy(history, history + lanes, state);
+    for(int i = 0; i < n; ++i){
+        const float v = in[i];
+        float* y = tile + i * lanes;
+        for(int l = 0; l < lanes; ++l){
+            const float s = state[l];
+            const float x = s - 2.0f * v;
+            const float w = x + s;
+            const float a = -(x - gain[l] * w);
+            y[l] = (a + s)/2.0f;
+            state[l] = a;
+        }
+    }
+    std::copy(state, state + lanes, history);
+}
+
+}
+
+
+void PreviewBank::prepare(float sr){
+    fs = sr;
+    for(Block& b : blocks)
+        for(int l = 0; l < lanes; ++l)
+            update_coefficients(b, l);
+    reset();
+}
+
+
+void PreviewBank::reset(float input){
+    for(Block& b : blocks){
+        for(int l = 0; l < lanes; ++l){
+            //the cap charged up to the input, as the engines' reset() leaves it
+            const float Z = 1/(2 * fs * b.capacitor[l]);
+            b.state[l] = model == PreviewModel::DK ? input/Z : input;
+        }
+    }
+}
+
+
+void PreviewBank::set_configurations(const float* resistors, const float* capacitors, int n){
+    count = std::max(0, n);
+    blocks.assign(static_cast<std::size_t>((count + lanes - 1)/lanes), Block{});
+    for(int k = 0; k < static_cast<int>(blocks.size()) * lanes; ++k){
+        Block& b = blocks[static_cast<std::size_t>(k/lanes)];
+        //the lanes past count run a harmless 10k/10n nobody reads
+        b.resistor[k % lanes] = k < count ? resistors[k] : 10000.0f;
+        b.capacitor[k % lanes] = k < count ? capacitors[k] : 10e-9f;
+        update_coefficients(b, k % lanes);
+    }
+    reset();
+}
+
+
+void PreviewBank::set_configuration(int k, float resistor, float capacitor){
+    Block& b = blocks[static_cast<std::size_t>(k/lanes)];
+    b.resistor[k % lanes] = resistor;
+    b.capacitor[k % lanes] = capacitor;
+    update_coefficients(b, k % lanes);
+}
+
+
+//the engines' own expressions, so the lanes round the same way they do
+void PreviewBank::update_coefficients(Block& b, int l){
+    const float R = b.resistor[l];
+    const float Z = 1/(2 * fs * b.capacitor[l]);
+    if(model == PreviewModel::DK){
+        b.gain[l] = Z/(R + Z);
+        b.back[l] = 2/Z;
+    }
+    else{
+        b.gain[l] = R/(R + Z);
+        b.back[l] = 0.0f;
+    }
+}
+
+
+void PreviewBank::process(const float* in, float* const* out, int num_samples){
+    alignas(64) float tile[tile_length * lanes];
+    for(int start = 0; start < num_samples; start += tile_length){
+        const int n = std::min(tile_length, num_samples - start);
+        for(std::size_t j = 0; j < blocks.size(); ++j){
+            Block& b = blocks[j];
+            if(model == PreviewModel::DK)
+                run_dk(b.resistor, b.gain, b.back, b.state, in + start, tile, n);
+            else
+                run_wdf(b.gain, b.state, in + start, tile, n);
+
+            const int first = static_cast<int>(j) * lanes;
+            const int used = std::min(lanes, count - first);
+            for(int l = 0; l < used; ++l){
+                float* y = out[first + l] + start;
+                for(int i = 0; i < n; ++i)
+                    y[i] = tile[i * lanes + l];
+            }
+        }
+    }
+}
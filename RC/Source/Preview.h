@@ -0,0 +1,58 @@
+
+
+
+#pragma once
+#include <vector>
+
+
+enum class PreviewModel {
+    DK,
+    WDF
+};
+
+
+/* Preview rendering
+ * One input through many R/C settings at once, for a preset browser or A/B auditioning. Rendering them one
+ * after the other walks the input once per setting and runs the per sample recursion with one value in
+ * flight; here the settings sit side by side in blocks of `lanes`, each block's coefficients and states in
+ * arrays that are stepped together with a fixed width loop, so the recursion vectorizes across settings
+ * (like the block versions in FastMath.h, no intrinsics). Every lane runs the same arithmetic as
+ * DKMethod/RCLowPass's process_sample, so a preview matches what the engine would play, minus the noise.
+ */
+class PreviewBank {
+
+public:
+    static constexpr int lanes = 16; //settings per block: one AVX-512 register, two AVX or four SSE ones
+
+    explicit PreviewBank(PreviewModel m = PreviewModel::DK) : model(m) {}
+
+    void prepare(float fs); //also resets
+    void reset(float input = 0.0f); //every setting settled on a constant input
+
+    //not realtime safe (the blocks get allocated), resets
+    void set_configurations(const float* resistors, const float* capacitors, int count);
+    void set_configuration(int k, float resistor, float capacitor); //k < size(), keeps its state
+    int size() const { return count; }
+
+    //out[k] gets in through setting k, no out may be in
+    void process(const float* in, float* const* out, int num_samples);
+
+private:
+    //samples rendered per block before they're copied out to the settings' buffers
+    static constexpr int tile_length = 64;
+
+    struct alignas(64) Block {
+        float resistor[lanes];
+        float capacitor[lanes];
+        float gain[lanes];  //DK: Z/(R + Z)   WDF: R/(R + Z), the resistor port's share in the series adaptor
+        float back[lanes];  //DK: 2/Z, what the cap's history current picks up from the output
+        float state[lanes]; //DK: X, the history current   WDF: the cap's delayed incident wave
+    };
+
+    void update_coefficients(Block& b, int lane);
+
+    PreviewModel model;
+    float fs = 44100.0f;
+    int count = 0;
+    std::vector<Block> blocks;
+};
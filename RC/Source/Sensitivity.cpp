@@ -0,0 +1,356 @@
+
+
+
+#include "Sensitivity.h"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+
+using MatrixD = Eigen::MatrixXd;
+using VectorD = Eigen::VectorXd;
+
+struct Diode {
+    int element;
+    int anode; //unknown index, -1 for ground
+    int cathode;
+    double i_sat;
+    double n_vt;
+};
+
+double port_voltage(const VectorD& x, int a, int k){
+    return (a >= 0 ? x(a) : 0.0) - (k >= 0 ? x(k) : 0.0);
+}
+
+//adds f(x) into f and its jacobian into D
+void stamp_diodes(const std::vector<Diode>& diodes, const VectorD& x, VectorD& f, MatrixD& D){
+    f.setZero();
+    D.setZero();
+    for(const auto& d : diodes){
+        const double e = std::exp(port_voltage(x, d.anode, d.cathode)/d.n_vt);
+        const double i = d.i_sat * (e - 1.0);
+        const double g = d.i_sat * e/d.n_vt;
+        if(d.anode >= 0){
+            f(d.anode) += i;
+            D(d.anode, d.anode) += g;
+        }
+        if(d.cathode >= 0){
+            f(d.cathode) -= i;
+            D(d.cathode, d.cathode) += g;
+        }
+        if(d.anode >= 0 && d.cathode >= 0){
+            D(d.anode, d.cathode) -= g;
+            D(d.cathode, d.anode) -= g;
+        }
+    }
+}
+
+
+//metric of the output and its gradient dJ/dy[n]
+double evaluate_metric(const std::vector<double>& y, float fs, const SensitivitySettings& settings, std::vector<double>& dJ){
+    const int n = static_cast<int>(y.size());
+    dJ.assign(y.size(), 0.0);
+
+    if(settings.metric == SensitivityMetric::RmsError){
+        double sum = 0.0;
+        for(int i = 0; i < n; ++i){
+            const double e = y[i] - (settings.reference ? settings.reference[i] : 0.0f);
+            sum += e * e;
+        }
+        const double rms = std::sqrt(sum/n);
+        if(rms > 0.0){
+            for(int i = 0; i < n; ++i)
+                dJ[i] = (y[i] - (settings.reference ? settings.reference[i] : 0.0f))/(n * rms);
+        }
+        return rms;
+    }
+
+    //hann windowed single bin DFTs at the fundamental and its harmonics
+    const double two_pi = 6.283185307179586;
+    const int top = std::max(2, std::min(settings.harmonics, static_cast<int>(0.5 * fs/settings.fundamental)));
+    std::vector<double> window(y.size());
+    for(int i = 0; i < n; ++i)
+        window[i] = 0.5 - 0.5 * std::cos(two_pi * i/std::max(1, n - 1));
+
+    std::vector<std::complex<double>> Y(static_cast<std::size_t>(top) + 1);
+    for(int h = 1; h <= top; ++h){
+        const double w = two_pi * h * settings.fundamental/fs;
+        std::complex<double> sum = 0.0;
+        for(int i = 0; i < n; ++i)
+            sum += window[i] * y[i] * std::polar(1.0, -w * i);
+        Y[h] = sum;
+    }
+
+    const double fundamental = std::norm(Y[1]);
+    double harmonic = 0.0;
+    for(int h = 2; h <= top; ++h)
+        harmonic += std::norm(Y[h]);
+    if(fundamental <= 0.0)
+        return 0.0;
+
+    const double thd = std::sqrt(harmonic/fundamental);
+    if(thd <= 0.0)
+        return thd;
+
+    //d|Y_h|^2/dy[i] = 2 Re(conj(Y_h) w[i] e^{-jwi})
+    for(int i = 0; i < n; ++i){
+        double dH = 0.0;
+        double dF = 0.0;
+        for(int h = 1; h <= top; ++h){
+            const double w = two_pi * h * settings.fundamental/fs;
+            const double d = 2.0 * window[i] * std::real(std::conj(Y[h]) * std::polar(1.0, -w * i));
+            (h == 1 ? dF : dH) += d;
+        }
+        dJ[i] = (dH/fundamental - harmonic * dF/(fundamental * fundamental))/(2.0 * thd);
+    }
+    return thd;
+}
+
+}
+
+
+SensitivityReport adjoint_sensitivity(const Netlist& circuit, const float* input, int num_samples, float fs,
+                                      const SensitivitySettings& settings){
+    if(num_samples <= 0)
+        throw std::invalid_argument("adjoint_sensitivity: nothing to render");
+
+    const double T = 1.0/fs;
+    const int nodes = circuit.num_nodes() - 1;
+    auto unknown = [](int node){ return node - 1; }; //ground becomes -1
+
+    //one extra row per voltage source for its current
+    std::vector<int> source_row(static_cast<std::size_t>(circuit.num_elements()), -1);
+    int size = nodes;
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        if(circuit.element(i).type == ElementType::VoltageSource)
+            source_row[static_cast<std::size_t>(i)] = size++;
+    }
+
+    MatrixD G = MatrixD::Zero(size, size);
+    MatrixD H = MatrixD::Zero(size, size); //2C/T
+    std::vector<Diode> diodes;
+
+    auto stamp = [&](MatrixD& m, int a, int b, double v){
+        if(a >= 0) m(a, a) += v;
+        if(b >= 0) m(b, b) += v;
+        if(a >= 0 && b >= 0){
+            m(a, b) -= v;
+            m(b, a) -= v;
+        }
+    };
+
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        const int a = unknown(e.n1);
+        const int b = unknown(e.n2);
+        switch(e.type){
+            case ElementType::Resistor: stamp(G, a, b, 1.0/e.value); break;
+            case ElementType::Capacitor: stamp(H, a, b, 2.0 * e.value/T); break;
+            case ElementType::Diode: diodes.push_back({i, a, b, e.value, e.param}); break;
+            case ElementType::VoltageSource:{
+                const int k = source_row[static_cast<std::size_t>(i)];
+                if(a >= 0){ G(a, k) += 1.0; G(k, a) += 1.0; }
+                if(b >= 0){ G(b, k) -= 1.0; G(k, b) -= 1.0; }
+                break;
+            }
+        }
+    }
+
+    //n < 0 is the dc operating point, the input at 0
+    auto sources = [&](int n, VectorD& b){
+        b.setZero();
+        for(int i = 0; i < circuit.num_elements(); ++i){
+            const Element& e = circuit.element(i);
+            if(e.type == ElementType::VoltageSource)
+                b(source_row[static_cast<std::size_t>(i)]) = e.value + (e.is_input && n >= 0 ? input[n] : 0.0f);
+        }
+    };
+
+    const MatrixD A0 = G + H;
+    const MatrixD B0 = G - H;
+    const bool linear = diodes.empty();
+    const Eigen::PartialPivLU<MatrixD> linear_lu = linear ? Eigen::PartialPivLU<MatrixD>(A0) : Eigen::PartialPivLU<MatrixD>();
+
+    //forward: trapezoid with newton on the whole system, keeping every x[n]
+    SensitivityReport report;
+    std::vector<double> y(static_cast<std::size_t>(num_samples));
+    MatrixD X(size, num_samples);
+    const int out = unknown(circuit.get_output());
+
+    VectorD x = VectorD::Zero(size);
+    VectorD b(size), b_prev(size);
+    VectorD f(size), f_prev(size);
+    MatrixD D(size, size);
+
+    //dc operating point the way MNA finds it: capacitors open, newton straight away, else gmin stepping
+    //down to 1e-12 on the node rows, which holds a node that only sees capacitors at 0
+    sources(-1, b_prev);
+    VectorD node_row = VectorD::Zero(size);
+    node_row.head(nodes).setOnes();
+    auto dc_newton = [&](double gmin, VectorD& xd){
+        for(int it = 0; it < 200; ++it){
+            stamp_diodes(diodes, xd, f, D);
+            MatrixD J = G + D;
+            J.diagonal() += gmin * node_row;
+            const VectorD dx = J.partialPivLu().solve(G * xd + f - b_prev + gmin * node_row.cwiseProduct(xd));
+            if(!dx.allFinite())
+                return false;
+            double scale = 1.0;
+            for(const auto& d : diodes){
+                const double dv = std::fabs(port_voltage(dx, d.anode, d.cathode));
+                if(dv > 4.0 * d.n_vt)
+                    scale = std::min(scale, 4.0 * d.n_vt/dv);
+            }
+            xd -= scale * dx;
+            if(dx.cwiseAbs().maxCoeff() * scale < 1e-13 * (1.0 + xd.cwiseAbs().maxCoeff()))
+                return xd.allFinite();
+        }
+        return false;
+    };
+    constexpr double gmin_floor = 1e-12;
+    if(!dc_newton(0.0, x)){
+        x.setZero();
+        bool ok = true;
+        for(double gmin = 1e-2; ok && gmin > 0.5 * gmin_floor; gmin *= 0.1)
+            ok = dc_newton(gmin, x);
+        if(!ok)
+            throw std::invalid_argument("adjoint_sensitivity: no dc operating point");
+    }
+    stamp_diodes(diodes, x, f, D);
+    const VectorD x_dc = x;
+    //LU quietly takes 0 for a node only capacitors hold, the adjoint needs the floor to do the same
+    MatrixD A_dc = G + D;
+    A_dc.diagonal() += gmin_floor * node_row;
+    const MatrixD B_first = B0 + D; //dR_0/dx[-1]
+
+    VectorD x_prev = x;
+    f_prev = f;
+
+    for(int n = 0; n < num_samples; ++n){
+        sources(n, b);
+        const VectorD rhs = b + b_prev - B0 * x_prev - f_prev;
+
+        if(linear){
+            x = linear_lu.solve(rhs);
+        }
+        else{
+            for(int it = 0; it < 100; ++it){
+                stamp_diodes(diodes, x, f, D);
+                const VectorD dx = (A0 + D).partialPivLu().solve(A0 * x + f - rhs);
+
+                //don't let a diode jump more than a few thermal voltages per iteration
+                double scale = 1.0;
+                for(const auto& d : diodes){
+                    const double dv = std::fabs(port_voltage(dx, d.anode, d.cathode));
+                    if(dv > 4.0 * d.n_vt)
+                        scale = std::min(scale, 4.0 * d.n_vt/dv);
+                }
+                x -= scale * dx;
+                if(dx.cwiseAbs().maxCoeff() * scale < 1e-13)
+                    break;
+            }
+            stamp_diodes(diodes, x, f, D);
+        }
+
+        X.col(n) = x;
+        y[static_cast<std::size_t>(n)] = out >= 0 ? x(out) : 0.0;
+        x_prev = x;
+        b_prev = b;
+        f_prev = f;
+    }
+
+    std::vector<double> dJ;
+    report.metric = evaluate_metric(y, fs, settings, dJ);
+    report.output.assign(y.begin(), y.end());
+
+    //backward: one adjoint solve per sample, gradients accumulated on the way
+    std::vector<double> gradient(static_cast<std::size_t>(circuit.num_elements()), 0.0);
+    VectorD lambda = VectorD::Zero(size);
+    VectorD lambda_next = VectorD::Zero(size);
+    const Eigen::PartialPivLU<MatrixD> linear_lu_t = linear ? Eigen::PartialPivLU<MatrixD>(A0.transpose()) : Eigen::PartialPivLU<MatrixD>();
+
+    auto across = [](const VectorD& v, int a, int k){ return port_voltage(v, a, k); };
+
+    for(int n = num_samples - 1; n >= 0; --n){
+        const VectorD& xn = X.col(n);
+        const VectorD xp = n > 0 ? VectorD(X.col(n - 1)) : x_dc;
+
+        VectorD rhs = VectorD::Zero(size);
+        if(out >= 0)
+            rhs(out) = -dJ[static_cast<std::size_t>(n)];
+
+        if(linear){
+            rhs -= B0.transpose() * lambda_next;
+            lambda = linear_lu_t.solve(rhs);
+        }
+        else{
+            stamp_diodes(diodes, xn, f, D);
+            rhs -= (B0 + D).transpose() * lambda_next;
+            lambda = (A0 + D).transpose().partialPivLu().solve(rhs);
+        }
+
+        for(int i = 0; i < circuit.num_elements(); ++i){
+            const Element& e = circuit.element(i);
+            const int a = unknown(e.n1);
+            const int k = unknown(e.n2);
+            double& g = gradient[static_cast<std::size_t>(i)];
+            switch(e.type){
+                case ElementType::Resistor:
+                    g -= across(lambda, a, k) * (across(xn, a, k) + across(xp, a, k))/(static_cast<double>(e.value) * e.value);
+                    break;
+                case ElementType::Capacitor:
+                    g += across(lambda, a, k) * (across(xn, a, k) - across(xp, a, k)) * 2.0/T;
+                    break;
+                case ElementType::VoltageSource:
+                    g -= lambda(source_row[static_cast<std::size_t>(i)]) * 2.0;
+                    break;
+                case ElementType::Diode:{
+                    const double e_n = std::expm1(across(xn, a, k)/e.param);
+                    const double e_p = std::expm1(across(xp, a, k)/e.param);
+                    g += across(lambda, a, k) * (e_n + e_p);
+                    break;
+                }
+            }
+        }
+        lambda_next = lambda;
+    }
+
+    //the dc operating point x[-1] the render started from: capacitors don't enter it
+    const VectorD lambda_dc = A_dc.transpose().partialPivLu().solve(-(B_first.transpose() * lambda_next));
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        const int a = unknown(e.n1);
+        const int k = unknown(e.n2);
+        double& g = gradient[static_cast<std::size_t>(i)];
+        switch(e.type){
+            case ElementType::Resistor:
+                g -= across(lambda_dc, a, k) * across(x_dc, a, k)/(static_cast<double>(e.value) * e.value);
+                break;
+            case ElementType::Capacitor:
+                break;
+            case ElementType::VoltageSource:
+                g -= lambda_dc(source_row[static_cast<std::size_t>(i)]);
+                break;
+            case ElementType::Diode:
+                g += across(lambda_dc, a, k) * std::expm1(across(x_dc, a, k)/e.param);
+                break;
+        }
+    }
+
+    report.components.resize(static_cast<std::size_t>(circuit.num_elements()));
+    for(int i = 0; i < circuit.num_elements(); ++i){
+        const Element& e = circuit.element(i);
+        ComponentSensitivity& c = report.components[static_cast<std::size_t>(i)];
+        std::memcpy(c.name, e.name, sizeof(c.name));
+        c.element = i;
+        c.value = e.value;
+        c.gradient = gradient[static_cast<std::size_t>(i)];
+        c.relative = report.metric != 0.0 ? c.value * c.gradient/report.metric : 0.0;
+    }
+    return report;
+}
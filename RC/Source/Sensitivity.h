@@ -0,0 +1,54 @@
+
+
+
+#pragma once
+#include <vector>
+#include "Netlist.h"
+
+
+/* Adjoint sensitivity
+ * Renders a signal through a netlist (same trapezoidal MNA as the engine, but in double and on the
+ * original, unsimplified circuit so every component keeps its own stamp) and then runs one backward
+ * pass of the adjoint system to get d(metric)/d(value) for every element at once:
+ *     R_n = (G + 2C/T) x[n] + (G - 2C/T) x[n-1] + f(x[n]) + f(x[n-1]) - b[n] - b[n-1] = 0
+ *     A[n]^T l[n] = -dJ/dx[n] - B[n+1]^T l[n+1],   dJ/dp = sum_n l[n]^T dR_n/dp
+ * with A = dR_n/dx[n] and B = dR_n/dx[n-1]. Like the engines, the render starts from the DC operating
+ * point, x[-1] with R_dc = G x[-1] + f(x[-1]) - b_dc = 0 for the input at 0, and that point moves with the
+ * values too: A_dc^T l_dc = -B[0]^T l[0] adds l_dc^T dR_dc/dp. So tolerance analysis or optimizing a design
+ * costs two renders instead of one render per component.
+ *
+ * The DK and WDF engines are the plugin's RC, so their sensitivities are the ones of Netlist::rc_lowpass(R, C).
+ * Offline only, it allocates and keeps the whole trajectory around.
+ */
+enum class SensitivityMetric {
+    RmsError, //rms of (output - reference)
+    THD //sqrt(sum of harmonic powers/fundamental power), over a hann window of the whole render
+};
+
+
+struct SensitivitySettings {
+    SensitivityMetric metric = SensitivityMetric::RmsError;
+    const float* reference = nullptr; //RmsError: target output, num_samples long (nullptr = zeros)
+    float fundamental = 1000.0f; //THD: frequency of the test tone
+    int harmonics = 10; //THD: highest harmonic counted (stops at nyquist anyway)
+};
+
+
+struct ComponentSensitivity {
+    char name[16] = {};
+    int element = 0; //index in the netlist
+    double value = 0.0;
+    double gradient = 0.0; //d metric/d value
+    double relative = 0.0; //(value/metric) * gradient: % change in metric per % change in value
+};
+
+
+struct SensitivityReport {
+    double metric = 0.0;
+    std::vector<float> output; //what the forward render produced
+    std::vector<ComponentSensitivity> components; //one per element, in netlist order
+};
+
+
+SensitivityReport adjoint_sensitivity(const Netlist& circuit, const float* input, int num_samples, float fs,
+                                      const SensitivitySettings& settings = {});
@@ -0,0 +1,34 @@
+
+
+
+#include "SmallMatrix.h"
+#include <utility>
+
+
+namespace smallmatrix {
+
+namespace {
+
+template <int R>
+constexpr Kernels make_kernels(){
+    return {&multiply<R>, &multiply_add<R>, &multiply_sub<R>,
+            &multiply_columns<R>, &multiply_add_columns<R>, &multiply_sub_columns<R>,
+            &lu_factor<R>, &lu_solve<R>, &solve<R>};
+}
+
+template <int... R>
+constexpr auto make_table(std::integer_sequence<int, R...>){
+    struct Table { Kernels k[sizeof...(R)]; };
+    return Table{{make_kernels<R>()...}};
+}
+
+constexpr auto table = make_table(std::make_integer_sequence<int, max_rows + 1>());
+
+}
+
+
+const Kernels& kernels(int rows){
+    return table.k[rows];
+}
+
+}
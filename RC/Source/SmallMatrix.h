@@ -0,0 +1,220 @@
+
+
+
+#pragma once
+#include <cmath>
+#include <limits>
+
+
+/* Small matrix kernels for the audio path
+ * Matrix-vector products, LU with partial pivoting and the two triangular solves, for the 1-16 row
+ * matrices MNA runs per sample. Eigen's dynamic (fixed max) matrices go through generic loops sized at
+ * runtime and build expression temporaries whose aliasing depends on how an expression is written; these
+ * are plain loops with the row count a template parameter, so every loop over rows is fully unrolled and
+ * vectorized for that size, like the block versions in FastMath.h. Nothing allocates and nothing aliases:
+ * the products accumulate in registers and only write y at the end, so a single product's y may be x. The
+ * *_columns versions lay x out in columns of cols and y in columns of R, so there y may only be x when
+ * cols == R, which is how MNA calls them.
+ *
+ * Matrices are column major with the leading dimension equal to the row count, which is how the Eigen
+ * matrices in MNA store them, so they pass straight in as .data(). The number of columns is a runtime
+ * argument, the row loop inside is the one that matters. kernels(rows) hands out the instantiation for a
+ * size picked at runtime. bench/SmallMatrixBench.cpp times each size against Eigen.
+ */
+namespace smallmatrix {
+
+constexpr int max_rows = 16;
+
+
+namespace detail {
+
+//acc += A x, two columns at a time into separate sums so consecutive columns don't wait on each other
+template <int R>
+inline void accumulate(const float* a, int cols, const float* x, float* acc){
+    float odd[R > 0 ? R : 1] = {};
+    int c = 0;
+    for(; c + 1 < cols; c += 2){
+        const float x0 = x[c];
+        const float x1 = x[c + 1];
+        const float* col0 = a + c * R;
+        const float* col1 = col0 + R;
+        for(int r = 0; r < R; ++r){
+            acc[r] += col0[r] * x0;
+            odd[r] += col1[r] * x1;
+        }
+    }
+    if(c < cols){
+        const float xc = x[c];
+        const float* col = a + c * R;
+        for(int r = 0; r < R; ++r)
+            acc[r] += col[r] * xc;
+    }
+    for(int r = 0; r < R; ++r)
+        acc[r] += odd[r];
+}
+
+}
+
+
+//y = A x, A is R x cols
+template <int R>
+inline void multiply(const float* a, int cols, const float* x, float* y){
+    float acc[R > 0 ? R : 1] = {};
+    detail::accumulate<R>(a, cols, x, acc);
+    for(int r = 0; r < R; ++r)
+        y[r] = acc[r];
+}
+
+
+//y += A x
+template <int R>
+inline void multiply_add(const float* a, int cols, const float* x, float* y){
+    float acc[R > 0 ? R : 1] = {};
+    detail::accumulate<R>(a, cols, x, acc);
+    for(int r = 0; r < R; ++r)
+        y[r] += acc[r];
+}
+
+
+//y -= A x
+template <int R>
+inline void multiply_sub(const float* a, int cols, const float* x, float* y){
+    float acc[R > 0 ? R : 1] = {};
+    detail::accumulate<R>(a, cols, x, acc);
+    for(int r = 0; r < R; ++r)
+        y[r] -= acc[r];
+}
+
+
+//the same for several vectors at once, stored one after the other (x is cols x columns, y is R x columns,
+//both column major). One call for all of MNA's channels instead of one per channel. y may be x only if
+//cols == R: otherwise y's column j lands on a column of x that hasn't been read yet
+template <int R>
+inline void multiply_columns(const float* a, int cols, const float* x, float* y, int columns){
+    for(int j = 0; j < columns; ++j)
+        multiply<R>(a, cols, x + j * cols, y + j * R);
+}
+
+
+template <int R>
+inline void multiply_add_columns(const float* a, int cols, const float* x, float* y, int columns){
+    for(int j = 0; j < columns; ++j)
+        multiply_add<R>(a, cols, x + j * cols, y + j * R);
+}
+
+
+template <int R>
+inline void multiply_sub_columns(const float* a, int cols, const float* x, float* y, int columns){
+    for(int j = 0; j < columns; ++j)
+        multiply_sub<R>(a, cols, x + j * cols, y + j * R);
+}
+
+
+//A = P L U in place (unit L below the diagonal, U on and above it), pivot[k] is the row swapped with k.
+//False on a singular A, and on one so close to it that a pivot is down at the rounding error the
+//elimination makes on A's largest entry: solving with that would be noise at best and inf at worst
+template <int N>
+inline bool lu_factor(float* a, int* pivot){
+    float scale = 0.0f;
+    for(int i = 0; i < N * N; ++i)
+        scale = std::fmax(scale, std::fabs(a[i]));
+    const float tiny = scale * static_cast<float>(N) * std::numeric_limits<float>::epsilon();
+
+    for(int k = 0; k < N; ++k){
+        int p = k;
+        float largest = std::fabs(a[k * N + k]);
+        for(int r = k + 1; r < N; ++r){
+            if(std::fabs(a[k * N + r]) > largest){
+                largest = std::fabs(a[k * N + r]);
+                p = r;
+            }
+        }
+        if(!(largest > tiny))
+            return false; //NaN in A ends up here too
+
+        pivot[k] = p;
+        if(p != k){
+            for(int c = 0; c < N; ++c){
+                const float t = a[c * N + k];
+                a[c * N + k] = a[c * N + p];
+                a[c * N + p] = t;
+            }
+        }
+
+        const float inverse = 1.0f/a[k * N + k];
+        for(int r = k + 1; r < N; ++r)
+            a[k * N + r] *= inverse;
+        //rank one update of the trailing block, a column at a time so the inner loop is contiguous
+        for(int c = k + 1; c < N; ++c){
+            const float f = a[c * N + k];
+            for(int r = k + 1; r < N; ++r)
+                a[c * N + r] -= a[k * N + r] * f;
+        }
+    }
+    return true;
+}
+
+
+//b = L^-1 b, unit lower triangle of a factorized A
+template <int N>
+inline void lower_solve(const float* lu, float* b){
+    for(int k = 0; k < N; ++k){
+        const float bk = b[k];
+        for(int r = k + 1; r < N; ++r)
+            b[r] -= lu[k * N + r] * bk;
+    }
+}
+
+
+//b = U^-1 b
+template <int N>
+inline void upper_solve(const float* lu, float* b){
+    for(int k = N - 1; k >= 0; --k){
+        b[k] /= lu[k * N + k];
+        const float bk = b[k];
+        for(int r = 0; r < k; ++r)
+            b[r] -= lu[k * N + r] * bk;
+    }
+}
+
+
+//b = A^-1 b from lu_factor()'s output
+template <int N>
+inline void lu_solve(const float* lu, const int* pivot, float* b){
+    for(int k = 0; k < N; ++k){
+        const float t = b[k];
+        b[k] = b[pivot[k]];
+        b[pivot[k]] = t;
+    }
+    lower_solve<N>(lu, b);
+    upper_solve<N>(lu, b);
+}
+
+
+//factor a (destroyed) and solve for b in one go, false (b untouched) if lu_factor() says no
+template <int N>
+inline bool solve(float* a, float* b){
+    int pivot[N > 0 ? N : 1];
+    if(!lu_factor<N>(a, pivot))
+        return false;
+    lu_solve<N>(a, pivot, b);
+    return true;
+}
+
+
+//the kernels for one row count, for sizes that are only known at runtime
+struct Kernels {
+    void (*multiply)(const float* a, int cols, const float* x, float* y);
+    void (*multiply_add)(const float* a, int cols, const float* x, float* y);
+    void (*multiply_sub)(const float* a, int cols, const float* x, float* y);
+    void (*multiply_columns)(const float* a, int cols, const float* x, float* y, int columns);
+    void (*multiply_add_columns)(const float* a, int cols, const float* x, float* y, int columns);
+    void (*multiply_sub_columns)(const float* a, int cols, const float* x, float* y, int columns);
+    bool (*lu_factor)(float* a, int* pivot);
+    void (*lu_solve)(const float* lu, const int* pivot, float* b);
+    bool (*solve)(float* a, float* b);
+};
+
+const Kernels& kernels(int rows); //0 to max_rows
+
+}
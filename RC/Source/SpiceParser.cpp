@@ -0,0 +1,350 @@
+
+
+
+#include "SpiceParser.h"
+#include "Subcircuit.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+
+namespace {
+
+std::string lower(std::string s){
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+
+[[noreturn]] void fail(int line, const std::string& what){
+    throw std::runtime_error("spice line " + std::to_string(line) + ": " + what);
+}
+
+
+float parse_value(const std::string& token, int line){
+    const std::string t = lower(token);
+    const char* begin = t.c_str();
+    char* end = nullptr;
+    const double v = std::strtod(begin, &end);
+    if(end == begin || !std::isfinite(v))
+        fail(line, "'" + token + "' is not a number");
+
+    const std::string suffix(end);
+    double scale = 1.0;
+    if(suffix.compare(0, 3, "meg") == 0) scale = 1e6;
+    else if(!suffix.empty()){
+        switch(suffix[0]){
+            case 'f': scale = 1e-15; break;
+            case 'p': scale = 1e-12; break;
+            case 'n': scale = 1e-9; break;
+            case 'u': scale = 1e-6; break;
+            case 'm': scale = 1e-3; break;
+            case 'k': scale = 1e3; break;
+            case 'g': scale = 1e9; break;
+            case 't': scale = 1e12; break;
+            default: break; //units, ignored
+        }
+    }
+    return static_cast<float>(v * scale);
+}
+
+
+//joins '+' continuations and strips comments, keeping the line number each statement started on
+std::vector<std::pair<int, std::vector<std::string>>> statements(const std::string& text){
+    std::vector<std::pair<int, std::vector<std::string>>> out;
+    std::istringstream in(text);
+    std::string raw;
+    int line = 0;
+    while(std::getline(in, raw)){
+        ++line;
+        const auto semicolon = raw.find(';');
+        if(semicolon != std::string::npos)
+            raw.erase(semicolon);
+
+        std::istringstream words(raw);
+        std::vector<std::string> tokens;
+        for(std::string w; words >> w;)
+            tokens.push_back(w);
+        if(tokens.empty() || tokens[0][0] == '*')
+            continue;
+
+        if(tokens[0][0] == '+'){
+            if(out.empty())
+                fail(line, "continuation with nothing to continue");
+            tokens[0].erase(0, 1);
+            auto& previous = out.back().second;
+            for(auto& t : tokens){
+                if(!t.empty())
+                    previous.push_back(t);
+            }
+            continue;
+        }
+        out.push_back({line, tokens});
+    }
+    return out;
+}
+
+}
+
+
+namespace {
+
+//the netlist statements land in: the circuit itself, or the body of the .subckt being defined
+struct Scope {
+    Netlist net;
+    std::map<std::string, int> nodes{{"0", 0}, {"gnd", 0}};
+    std::set<std::string> instances;
+    std::string name; //subcircuit name, empty for the circuit
+    int num_ports = 0;
+
+    int node(const std::string& node_name, int line){
+        const std::string key = lower(node_name);
+        const auto it = nodes.find(key);
+        if(it != nodes.end())
+            return it->second;
+        const int n = net.add_node();
+        if(n < 0)
+            fail(line, "more than " + std::to_string(Netlist::max_nodes) + " nodes");
+        nodes[key] = n;
+        return n;
+    }
+
+    int existing_node(const std::string& node_name, int line) const{
+        const auto it = nodes.find(lower(node_name));
+        if(it == nodes.end())
+            fail(line, "node '" + node_name + "' isn't connected to anything");
+        return it->second;
+    }
+};
+
+
+struct Definition {
+    Netlist body;
+    int num_ports = 0;
+};
+
+
+//X<name> node ... subcircuit
+void add_instance(Scope& scope, const std::map<std::string, Definition>& definitions, int line, const std::vector<std::string>& tokens){
+    if(tokens.size() < 3)
+        fail(line, "'" + tokens[0] + "' takes its nodes and then a subcircuit name");
+    const auto it = definitions.find(lower(tokens.back()));
+    if(it == definitions.end())
+        fail(line, "no .subckt " + tokens.back() + " defined above");
+    const Definition& definition = it->second;
+    const int num_nodes = static_cast<int>(tokens.size()) - 2;
+    if(num_nodes != definition.num_ports)
+        fail(line, "'" + tokens.back() + "' has " + std::to_string(definition.num_ports) + " ports, got " + std::to_string(num_nodes) + " nodes");
+    if(!scope.instances.insert(lower(tokens[0])).second)
+        fail(line, "instance '" + tokens[0] + "' is defined twice");
+
+    int nodes[Netlist::max_probes];
+    for(int port = 0; port < num_nodes; ++port)
+        nodes[port] = scope.node(tokens[static_cast<std::size_t>(port) + 1], line);
+
+    const auto equivalent = SubcircuitCache::shared().equivalent(definition.body, definition.num_ports);
+    if(instanced_name_length(*equivalent, tokens[0].c_str()) > Netlist::max_name)
+        fail(line, "'" + tokens[0] + "' makes element names longer than " + std::to_string(Netlist::max_name)
+                   + " characters (instance.element), shorten them");
+    if(!instance_subcircuit(scope.net, *equivalent, tokens[0].c_str(), nodes))
+        fail(line, "'" + tokens[0] + "' doesn't fit, more than " + std::to_string(Netlist::max_nodes) + " nodes or "
+                   + std::to_string(Netlist::max_elements) + " elements");
+}
+
+}
+
+
+Netlist parse_spice(const std::string& text){
+    Scope circuit;
+    Scope body;
+    Scope* scope = &circuit;
+    std::map<std::string, Definition> definitions;
+    bool has_output = false;
+    int subckt_line = 0;
+
+    for(const auto& [line, tokens] : statements(text)){
+        const std::string head = lower(tokens[0]);
+        Netlist& net = scope->net;
+        const bool in_subckt = scope == &body;
+
+        if(head[0] == '.'){
+            if(head == ".end")
+                break;
+            if(head == ".title")
+                continue;
+            if(head == ".subckt"){
+                if(in_subckt)
+                    fail(line, ".subckt inside .subckt " + body.name + ", instance one defined above instead");
+                if(tokens.size() < 3)
+                    fail(line, ".subckt takes a name and its ports");
+                if(tokens.size() - 2 > static_cast<std::size_t>(Netlist::max_probes))
+                    fail(line, "more than " + std::to_string(Netlist::max_probes) + " ports");
+                body = Scope{};
+                body.name = lower(tokens[1]);
+                if(definitions.count(body.name))
+                    fail(line, ".subckt " + tokens[1] + " is defined twice");
+                for(std::size_t i = 2; i < tokens.size(); ++i){
+                    const std::string port = lower(tokens[i]);
+                    if(body.nodes.count(port))
+                        fail(line, "port '" + tokens[i] + "' is ground or listed twice");
+                    body.node(port, line); //ports are nodes 1..n in order
+                }
+                body.num_ports = static_cast<int>(tokens.size()) - 2;
+                scope = &body;
+                subckt_line = line;
+                continue;
+            }
+            if(head == ".ends"){
+                if(!in_subckt)
+                    fail(line, ".ends without a .subckt");
+                if(tokens.size() > 1 && lower(tokens[1]) != body.name)
+                    fail(line, ".ends " + tokens[1] + " closes .subckt " + body.name);
+                definitions[body.name] = Definition{body.net, body.num_ports};
+                scope = &circuit;
+                continue;
+            }
+            if(in_subckt && (head == ".output" || head == ".probe"))
+                fail(line, head + " inside .subckt " + body.name);
+
+            if(head == ".output"){
+                if(tokens.size() != 2)
+                    fail(line, ".output takes one node");
+                net.set_output(scope->existing_node(tokens[1], line));
+                has_output = true;
+            }
+            else if(head == ".probe"){
+                for(std::size_t i = 1; i < tokens.size(); ++i){
+                    if(net.add_probe(scope->existing_node(tokens[i], line)) < 0)
+                        fail(line, "more than " + std::to_string(Netlist::max_probes) + " probes");
+                }
+            }
+            else if(head == ".noise"){
+                for(std::size_t i = 1; i < tokens.size(); ++i){
+                    const int e = net.find(tokens[i].c_str());
+                    if(e < 0 || net.element(e).type != ElementType::Resistor)
+                        fail(line, "'" + tokens[i] + "' is not a resistor defined above");
+                    net.element(e).noise |= NoiseThermal;
+                }
+            }
+            else{
+                fail(line, "unknown directive " + tokens[0]);
+            }
+            continue;
+        }
+
+        if(tokens[0].size() > static_cast<std::size_t>(Netlist::max_name))
+            fail(line, "element name '" + tokens[0] + "' is longer than " + std::to_string(Netlist::max_name) + " characters");
+        if(head[0] == 'x'){
+            add_instance(*scope, definitions, line, tokens);
+            continue;
+        }
+        if(net.find(tokens[0].c_str()) >= 0)
+            fail(line, "element '" + tokens[0] + "' is defined twice");
+        if(tokens.size() < 3)
+            fail(line, "'" + tokens[0] + "' needs two nodes");
+
+        const int n1 = scope->node(tokens[1], line);
+        const int n2 = scope->node(tokens[2], line);
+        if(head[0] == 'v' && n1 == n2)
+            fail(line, "'" + tokens[0] + "' connects " + tokens[1] + " to itself");
+        const char* name = tokens[0].c_str();
+        int index = -1;
+
+        switch(head[0]){
+            case 'r':
+            case 'c':{
+                if(tokens.size() != 4)
+                    fail(line, "'" + tokens[0] + "' takes two nodes and a value");
+                const float v = parse_value(tokens[3], line);
+                if(!(v > 0.0f))
+                    fail(line, "'" + tokens[0] + "' has to be positive");
+                index = head[0] == 'r' ? net.add_resistor(name, n1, n2, v) : net.add_capacitor(name, n1, n2, v);
+                break;
+            }
+            case 'v':{
+                float v = 0.0f;
+                bool input = false;
+                bool has_value = false;
+                for(std::size_t i = 3; i < tokens.size(); ++i){
+                    const std::string t = lower(tokens[i]);
+                    if(t == "dc")
+                        continue;
+                    if(t == "input")
+                        input = true;
+                    else if(!has_value){
+                        v = parse_value(tokens[i], line);
+                        has_value = true;
+                    }
+                    else
+                        fail(line, "unexpected '" + tokens[i] + "'");
+                }
+                if(input && in_subckt)
+                    fail(line, "the INPUT source can't be inside a .subckt");
+                index = net.add_voltage_source(name, n1, n2, v, input);
+                break;
+            }
+            case 'd':{
+                float is = 2.52e-9f;
+                float n = 1.752f;
+                std::uint8_t noise = NoiseNone;
+                float kf = 0.0f;
+                for(std::size_t i = 3; i < tokens.size(); ++i){
+                    const std::string t = lower(tokens[i]);
+                    const auto eq = t.find('=');
+                    if(eq == std::string::npos)
+                        fail(line, "diode parameters go as NAME=value");
+                    const std::string key = t.substr(0, eq);
+                    const std::string value = t.substr(eq + 1);
+                    if(key == "is")
+                        is = parse_value(value, line);
+                    else if(key == "n")
+                        n = parse_value(value, line);
+                    else if(key == "kf")
+                        kf = parse_value(value, line);
+                    else if(key == "noise"){
+                        if(value == "shot") noise = NoiseShot;
+                        else if(value == "flicker") noise = NoiseFlicker;
+                        else if(value == "both") noise = NoiseShot | NoiseFlicker;
+                        else fail(line, "noise is shot, flicker or both");
+                    }
+                    else
+                        fail(line, "unknown diode parameter " + key);
+                }
+                if(!(is > 0.0f) || !(n > 0.0f))
+                    fail(line, "IS and N have to be positive");
+                index = net.add_diode(name, n1, n2, is, n * 0.02585f);
+                if(index >= 0)
+                    net.set_noise(name, noise, kf);
+                break;
+            }
+            default:
+                fail(line, "don't know what a '" + tokens[0] + "' is (R, C, V, D and X only)");
+        }
+
+        if(index < 0)
+            fail(line, "more than " + std::to_string(Netlist::max_elements) + " elements");
+    }
+
+    if(scope != &circuit)
+        fail(subckt_line, ".subckt " + body.name + " has no .ends");
+    if(!has_output)
+        throw std::runtime_error("spice: no .output node");
+    return circuit.net;
+}
+
+
+Netlist read_spice(const char* path){
+    std::ifstream file(path);
+    if(!file)
+        throw std::runtime_error(std::string("spice: can't open ") + path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return parse_spice(text.str());
+}
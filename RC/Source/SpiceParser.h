@@ -0,0 +1,34 @@
+
+
+
+#pragma once
+#include <string>
+#include "Netlist.h"
+
+
+/* SPICE reader
+ * The part of SPICE that maps onto a Netlist, one element or directive per line:
+ *     R<name> n1 n2 value
+ *     C<name> n1 n2 value
+ *     V<name> n+ n- [DC] value [INPUT]        INPUT marks the source the audio gets added to
+ *     D<name> anode cathode [IS=value] [N=value] [NOISE=shot|flicker|both] [KF=value]
+ *     X<name> node ... subcircuit             an instance of a .subckt defined above it
+ *     .subckt name port ...                   up to 8 ports, everything up to .ends is its body
+ *     .ends [name]
+ *     .output node
+ *     .probe node [node ...]
+ *     .noise R<name> ...                      thermal noise on those resistors
+ *     .end
+ * '*' starts a comment line and ';' a comment to the end of one, '+' continues the previous line.
+ * There's no title line, use .title if you want one. Node names are anything (case insensitive),
+ * 0 and gnd are ground. Values take the SPICE suffixes f p n u m k meg g t, and anything after them
+ * (units) is ignored. N is the emission coefficient, the thermal voltage is 25.85 mV.
+ * Node names in a .subckt body are its own apart from ground, which is everybody's. A body can instance
+ * subcircuits defined before it but can't have .output, .probe or the INPUT source. Instances go in as
+ * the body's port level equivalent out of SubcircuitCache (Subcircuit.h), so identical subcircuits get
+ * reduced once.
+ *
+ * Errors throw std::runtime_error with the line number, this runs when a circuit gets loaded.
+ */
+Netlist parse_spice(const std::string& text);
+Netlist read_spice(const char* path);
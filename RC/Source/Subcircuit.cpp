@@ -0,0 +1,148 @@
+
+
+
+#include "Subcircuit.h"
+#include "DiskCache.h"
+#include "NetlistSimplify.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+
+namespace {
+
+//what the reduction depends on, names included: the ones that survive it are in the result
+std::uint64_t structure_hash(const Netlist& body, int num_ports){
+    return cache::hash_bytes(&num_ports, sizeof(num_ports), cache::hash_netlist(body));
+}
+
+
+bool same_structure(const Netlist& a, const Netlist& b){
+    if(a.num_nodes() != b.num_nodes() || a.num_elements() != b.num_elements())
+        return false;
+    for(int i = 0; i < a.num_elements(); ++i){
+        const Element& x = a.element(i);
+        const Element& y = b.element(i);
+        if(x.type != y.type || x.n1 != y.n1 || x.n2 != y.n2 || x.value != y.value || x.param != y.param
+           || x.is_input != y.is_input || x.noise != y.noise || x.kf != y.kf || std::strcmp(x.name, y.name) != 0)
+            return false;
+    }
+    return true;
+}
+
+}
+
+
+Netlist reduce_subcircuit(const Netlist& body, int num_ports){
+    Netlist work = body;
+    for(int port = 1; port <= num_ports; ++port)
+        work.add_probe(port);
+
+    SimplifyOptions options;
+    options.max_kron_degree = Netlist::max_elements; //fill is bounded by the ports here, see the header
+    return simplify(work, options);
+}
+
+
+bool instance_subcircuit(Netlist& net, const Netlist& equivalent, const char* name, const int* nodes){
+    int map[Netlist::max_nodes];
+    for(int n = 0; n < Netlist::max_nodes; ++n)
+        map[n] = -1;
+    map[0] = 0;
+    for(int port = 0; port < equivalent.num_probes(); ++port)
+        map[equivalent.get_probe(port)] = nodes[port];
+
+    for(int n = 1; n < equivalent.num_nodes(); ++n){
+        if(map[n] < 0){
+            map[n] = net.add_node();
+            if(map[n] < 0)
+                return false;
+        }
+    }
+
+    for(int i = 0; i < equivalent.num_elements(); ++i){
+        const Element& e = equivalent.element(i);
+        //whole, add_element() turns down the ones that don't fit rather than cutting them to collide
+        const std::string full = std::string(name) + "." + e.name;
+        if(full.size() > static_cast<std::size_t>(Netlist::max_name))
+            return false;
+        Element copy = e;
+        std::memcpy(copy.name, full.c_str(), full.size() + 1);
+        if(net.add_copy(copy, map[e.n1], map[e.n2]) < 0)
+            return false;
+    }
+    return true;
+}
+
+
+int instanced_name_length(const Netlist& equivalent, const char* name){
+    int longest = -1;
+    for(int i = 0; i < equivalent.num_elements(); ++i)
+        longest = std::max(longest, static_cast<int>(std::strlen(equivalent.element(i).name)));
+    return longest < 0 ? 0 : static_cast<int>(std::strlen(name)) + 1 + longest;
+}
+
+
+SubcircuitCache& SubcircuitCache::shared(){
+    static SubcircuitCache cache;
+    return cache;
+}
+
+
+std::shared_ptr<const Netlist> SubcircuitCache::equivalent(const Netlist& body, int num_ports){
+    const std::uint64_t key = structure_hash(body, num_ports);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const auto range = entries.equal_range(key);
+        for(auto it = range.first; it != range.second; ++it){
+            if(it->second.num_ports == num_ports && same_structure(it->second.body, body)){
+                ++hit_count;
+                it->second.last_used = ++uses;
+                return it->second.reduced;
+            }
+        }
+    }
+
+    //reduce outside the lock, two threads racing on the same body both do the work and the first one wins
+    auto reduced = std::make_shared<const Netlist>(reduce_subcircuit(body, num_ports));
+
+    std::lock_guard<std::mutex> guard(lock);
+    const auto range = entries.equal_range(key);
+    for(auto it = range.first; it != range.second; ++it){
+        if(it->second.num_ports == num_ports && same_structure(it->second.body, body))
+            return it->second.reduced;
+    }
+    ++miss_count;
+    if(entries.size() >= max_entries){
+        //anything still instanced holds its own reference, this only forgets how to skip the work
+        auto oldest = entries.begin();
+        for(auto it = entries.begin(); it != entries.end(); ++it){
+            if(it->second.last_used < oldest->second.last_used)
+                oldest = it;
+        }
+        entries.erase(oldest);
+    }
+    entries.emplace(key, Entry{body, num_ports, reduced, ++uses});
+    return reduced;
+}
+
+
+int SubcircuitCache::hits() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return hit_count;
+}
+
+
+int SubcircuitCache::misses() const{
+    std::lock_guard<std::mutex> guard(lock);
+    return miss_count;
+}
+
+
+void SubcircuitCache::clear(){
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    uses = 0;
+    hit_count = 0;
+    miss_count = 0;
+}
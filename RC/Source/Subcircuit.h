@@ -0,0 +1,65 @@
+
+
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "Netlist.h"
+
+
+/* Subcircuits
+ * A subcircuit body is a Netlist whose nodes 1..num_ports are its ports, node 0 being the global ground.
+ * Before it gets instanced it's reduced to its port level equivalent: simplify() with the ports held like
+ * probes, and Kron reduction of every internal node that only touches resistors, whatever its degree. In
+ * a whole circuit that's capped (max_kron_degree) because a star of d resistors turns into d(d-1)/2 of
+ * them, but inside a subcircuit the mesh can only land on ports and on nodes that hold state, and the
+ * parallel merges fold it straight back down. A purely resistive body comes out as at most one resistor
+ * per pair of ports (ground counting as one). Nodes with a capacitor on them hold state and stay.
+ *
+ * Reductions get cached by structure, values and names, so a ladder used six times gets reduced once, and
+ * so does the same tone stack in the next circuit loaded. Elements inside an instance
+ * keep their names behind the instance's ("X1.R1") where they survive, but the ones folded into the
+ * equivalent are gone, so they aren't knobs. Thread safe, not realtime safe: this is load time work. The
+ * cache keeps the max_entries most recently used reductions, so a session that loads netlist after netlist
+ * doesn't grow without end.
+ */
+Netlist reduce_subcircuit(const Netlist& body, int num_ports); //probe i of the result is port i
+
+
+//copies an equivalent into net as instance `name`: port i goes to nodes[i], every other node gets a fresh
+//one, element names get "name." in front. False if net runs out of nodes or elements, or a name comes out
+//longer than Netlist::max_name (check with instanced_name_length() first to tell which)
+bool instance_subcircuit(Netlist& net, const Netlist& equivalent, const char* name, const int* nodes);
+int instanced_name_length(const Netlist& equivalent, const char* name); //of the longest "name.element"
+
+
+class SubcircuitCache {
+
+public:
+    static constexpr std::size_t max_entries = 256;
+
+    static SubcircuitCache& shared(); //process wide
+
+    //reduce_subcircuit(body, num_ports), computed once per distinct structure and values
+    std::shared_ptr<const Netlist> equivalent(const Netlist& body, int num_ports);
+
+    int hits() const;
+    int misses() const;
+    void clear();
+
+private:
+    struct Entry {
+        Netlist body;
+        int num_ports = 0;
+        std::shared_ptr<const Netlist> reduced;
+        std::uint64_t last_used = 0;
+    };
+
+    mutable std::mutex lock;
+    std::unordered_multimap<std::uint64_t, Entry> entries; //a hash collision just means two entries under one key
+    std::uint64_t uses = 0;
+    int hit_count = 0;
+    int miss_count = 0;
+};
@@ -1,6 +1,8 @@
 
 
 #pragma once
+#include <cmath>
+#include "Noise.h"
 
 
 //TODO: Make this ready to use with a knob in juce
@@ -95,12 +97,12 @@ public:
     
     float reflected() override {
         b = delayed_a; //set the reflected wave as the delayed [n-1] incident wave
-        delayed_a = a; //updated the delayed state with the current incident wave
         return b;
     }
     
     void incident(float x) override {
         a = x; //update the incident wave without any changes --> there is no scattering since this is a one port
+        delayed_a = a; //and keep it for the next sample's reflection, doing this in reflected() made it [n-2]
     }
     
     void update_sample_rate(float sr) {
@@ -109,7 +111,8 @@ public:
         }
     }
     
-    void reset_state () { delayed_a = 0; }
+    //a charged cap at rest reflects what it gets, so both waves sit at its voltage
+    void reset_state (float v = 0.0f) { delayed_a = v; a = v; b = v; }
     
     float C; //actual capacitance value
     
@@ -170,7 +173,7 @@ public:
     
     void incident(float x) override { //treating x like it is -a0 here
         const float w = x + child1.get_b() + child2.get_b();
-        const auto port1ReflectedWeights = child1.get_b()/(child1.get_b() + child2.get_b());
+        const auto port1ReflectedWeights = child1.get_R0()/R0; //scattering splits w by port impedance
         const auto port1_a = child1.get_b() - (port1ReflectedWeights * w);
         
         child1.incident(port1_a);
@@ -195,7 +198,6 @@ public:
     //setup
     void prepare(float sr) {
         //set capacitor stuff
-        cap.reset_state();
         cap.update_sample_rate(sr);
         
         //calculate initial impedences for EACH node
@@ -203,14 +205,29 @@ public:
         cap.calc_impedences();
         Vin.calc_impedences();
         adaptor.calc_impedences();
+
+        fs = sr;
+        update_coefficients();
+        reset();
+    }
+
+    //at DC no current flows, so the cap just sits at the input
+    void reset(float input = 0.0f) {
+        cap.reset_state(input);
     }
     
     //process
     float process_sample(float input_voltage){
+        //resistor noise sits in series with Vin so it just rides on the source
+        if(noise_on)
+            input_voltage += noise_sigma * noise.next()[0];
+
         //set Vin
         Vin.set_voltage_source(input_voltage);
-        Vin.incident(adaptor.reflected());   // up: adaptor pulls from leaves
-        adaptor.incident(Vin.reflected());   // down: adaptor pushes to leaves
+        //the series port voltages sum to zero, so the source sits behind a polarity inverter
+        //or the cap ends up charged to -Vin
+        Vin.incident(-adaptor.reflected());   // up: adaptor pulls from leaves
+        adaptor.incident(-Vin.reflected());   // down: adaptor pushes to leaves
         return cap.toVoltage();
     }
     
@@ -219,6 +236,7 @@ public:
             res.R = newR;
             res.calc_impedences();
             adaptor.calc_impedences();
+            update_coefficients();
         }
         
         if(newC != cap.C){
@@ -228,16 +246,30 @@ public:
         }
     }
 
+    //thermal noise of the resistor, not realtime safe
+    void set_noise(bool enabled, float temp = 300.0f){
+        noise_on = enabled;
+        temperature = temp;
+        noise.prepare(1);
+        update_coefficients();
+    }
+
     
 private:
     void update_coefficients(){
-        
+        noise_sigma = std::sqrt(noise::thermal_voltage_variance(res.R, temperature, fs));
     }
     
     //list out all component values
     Resistor res {10000};
-    Capacitor cap {10000};
+    Capacitor cap {10e-9f};
     VoltageSource Vin {5};
     SeriesAdaptor adaptor {res, cap}; //send the child nodes to series adaptor
     float initial_sr {44100};
+    float fs {44100};
+
+    bool noise_on = false;
+    float temperature = 300.0f;
+    float noise_sigma = 0.0f;
+    NoiseBlock noise;
 };
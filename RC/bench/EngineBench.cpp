@@ -0,0 +1,264 @@
+
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "DKMethod.h"
+#include "Decoupling.h"
+#include "MNA.h"
+#include "ModelReduction.h"
+#include "PerfCounters.h"
+#include "Preview.h"
+#include "SpiceParser.h"
+#include "WDF.h"
+
+
+/* Per sample cost of the engines
+ * Every engine renders the same block of noise a number of times and the fastest run is reported as
+ * ns/sample. With --counters it also reads the PMU over each run (see PerfCounters.h) and prints the
+ * counts of that fastest run per sample, so a regression can be told apart as cache misses, mispredicts
+ * or plain instruction count / long latency ops (low IPC).
+ *     rc_engine_bench [--counters] [runs]
+ * A new engine is one more entry in engines().
+ */
+namespace {
+
+using Render = std::function<void(const float* in, float* out, int n)>;
+
+struct Bench {
+    const char* name;
+    Render render;
+};
+
+
+template <typename Engine>
+Render renderer(std::shared_ptr<Engine> engine){
+    return [engine](const float* in, float* out, int n){
+        for(int i = 0; i < n; ++i)
+            out[i] = engine->process_sample(in[i]);
+    };
+}
+
+
+//the same noise 60 dB down, where the level adaptive MNA runs the small signal model
+template <typename Engine>
+Render quiet_renderer(std::shared_ptr<Engine> engine){
+    return [engine](const float* in, float* out, int n){
+        for(int i = 0; i < n; ++i)
+            out[i] = engine->process_sample(0.001f * in[i]);
+    };
+}
+
+
+//n sections of 1k into 10n, the kind of passive network balanced truncation is for
+Netlist rc_ladder(int sections){
+    std::string spice = "Vin n0 0 INPUT\n";
+    for(int k = 1; k <= sections; ++k){
+        const std::string prev = "n" + std::to_string(k - 1), node = "n" + std::to_string(k);
+        spice += "R" + std::to_string(k) + " " + prev + " " + node + " 1k\n";
+        spice += "C" + std::to_string(k) + " " + node + " 0 10n\n";
+    }
+    spice += ".output n" + std::to_string(sections) + "\n";
+    return parse_spice(spice.c_str());
+}
+
+
+//PreviewBank::lanes settings of the rc rendered together, reported per sample of all of them
+Render preview_renderer(PreviewModel model, float fs){
+    constexpr int count = PreviewBank::lanes;
+    auto bank = std::make_shared<PreviewBank>(model);
+    float resistors[count], capacitors[count];
+    for(int k = 0; k < count; ++k){
+        resistors[k] = 1000.0f * static_cast<float>(k + 1);
+        capacitors[k] = 100e-9f;
+    }
+    bank->set_configurations(resistors, capacitors, count);
+    bank->prepare(fs);
+    auto scratch = std::make_shared<std::vector<float>>();
+    return [bank, scratch](const float* in, float* out, int n){
+        scratch->resize(static_cast<std::size_t>(n) * (count - 1));
+        float* rows[count] = {out};
+        for(int k = 1; k < count; ++k)
+            rows[k] = scratch->data() + static_cast<std::size_t>(k - 1) * n;
+        bank->process(in, rows, n);
+    };
+}
+
+
+//n diode clippers in a row, each into a 1k/100n stage, with the 100n caps as the places to cut
+Netlist clipper_chain(int stages){
+    std::string spice = "Vin n0 0 INPUT\n";
+    for(int k = 1; k <= stages; ++k){
+        const std::string i = std::to_string(k), prev = "n" + std::to_string(k - 1), a = "a" + i, node = "n" + i;
+        spice += "R" + i + " " + prev + " " + a + " 2.2k\n";
+        spice += "Ca" + i + " " + a + " 0 10n\n";
+        spice += "Da" + i + " " + a + " 0\n";
+        spice += "Db" + i + " 0 " + a + "\n";
+        spice += "Rb" + i + " " + a + " " + node + " 1k\n";
+        spice += "Cn" + i + " " + node + " 0 100n\n";
+    }
+    spice += ".output n" + std::to_string(stages) + "\n";
+    return parse_spice(spice.c_str());
+}
+
+
+std::vector<Bench> engines(float fs){
+    const float r = 1000.0f;
+    const float c = 100e-9f;
+    std::vector<Bench> out;
+
+    auto dk = std::make_shared<DKMethod>();
+    dk->setKnobs(r, c);
+    dk->prepare(fs);
+    out.push_back({"DK rc", renderer(dk)});
+
+    auto wdf = std::make_shared<RCLowPass>();
+    wdf->setKnobs(r, c);
+    wdf->prepare(fs);
+    out.push_back({"WDF rc", renderer(wdf)});
+
+    out.push_back({"DK rc preview x16", preview_renderer(PreviewModel::DK, fs)});
+    out.push_back({"WDF rc preview x16", preview_renderer(PreviewModel::WDF, fs)});
+
+    auto mna = std::make_shared<MNA>(Netlist::rc_lowpass(r, c));
+    mna->prepare(fs);
+    out.push_back({"MNA rc", renderer(mna)});
+
+    const Netlist clipper = parse_spice("Vin in 0 INPUT\nR1 in a 2.2k\nC1 a 0 10n\nD1 a 0\nD2 0 a\n.output a\n");
+    auto clip = std::make_shared<MNA>(clipper);
+    clip->prepare(fs);
+    out.push_back({"MNA clipper", renderer(clip)});
+
+    auto clip_low = std::make_shared<MNA>(clipper);
+    clip_low->set_accuracy(fastmath::Accuracy::Low);
+    clip_low->prepare(fs);
+    out.push_back({"MNA clipper low", renderer(clip_low)});
+
+    auto clip_table = std::make_shared<MNA>(clipper);
+    clip_table->set_diode_table(true);
+    clip_table->prepare(fs);
+    out.push_back({"MNA clipper table", renderer(clip_table)});
+
+    auto clip_quiet = std::make_shared<MNA>(clipper);
+    clip_quiet->prepare(fs);
+    out.push_back({"MNA clipper -60dB", quiet_renderer(clip_quiet)});
+
+    auto clip_adaptive = std::make_shared<MNA>(clipper);
+    clip_adaptive->set_adaptive(true);
+    clip_adaptive->prepare(fs);
+    out.push_back({"MNA clipper -60dB adaptive", quiet_renderer(clip_adaptive)});
+
+    const Netlist chain = clipper_chain(4);
+    auto chain_mna = std::make_shared<MNA>(chain);
+    chain_mna->prepare(fs);
+    out.push_back({"MNA clipper x4", renderer(chain_mna)});
+
+    std::vector<int> cuts;
+    for(int k = 1; k < 4; ++k)
+        cuts.push_back(chain.element(chain.find(("Cn" + std::to_string(k)).c_str())).n1);
+    auto chain_split = std::make_shared<DecoupledMNA>(chain, cuts);
+    chain_split->prepare(fs);
+    out.push_back({"decoupled clipper x4", [chain_split](const float* in, float* out, int n){
+        chain_split->process_block(in, out, n);
+    }});
+
+    auto ladder = std::make_shared<MNA>(rc_ladder(12));
+    ladder->prepare(fs);
+    out.push_back({"MNA ladder 12", renderer(ladder)});
+
+    auto reduced = std::make_shared<ReducedEngine>(rc_ladder(12));
+    reduced->prepare(fs);
+    out.push_back({"reduced ladder 12", renderer(reduced)});
+
+    auto reduced_long = std::make_shared<ReducedEngine>(rc_ladder(40)); //too big for MNA
+    reduced_long->prepare(fs);
+    out.push_back({"reduced ladder 40", renderer(reduced_long)});
+
+    return out;
+}
+
+}
+
+
+int main(int argc, char** argv){
+    bool counters = false;
+    int runs = 20;
+    for(int i = 1; i < argc; ++i){
+        if(std::strcmp(argv[i], "--counters") == 0)
+            counters = true;
+        else if(std::atoi(argv[i]) > 0)
+            runs = std::atoi(argv[i]);
+        else{
+            std::fprintf(stderr, "usage: %s [--counters] [runs]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    constexpr int n = 1 << 16;
+    constexpr float fs = 48000.0f;
+    std::vector<float> in(n);
+    std::vector<float> out(n);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    for(auto& x : in)
+        x = noise(rng);
+
+    PerfCounters pmu;
+    if(counters && !pmu.available()){
+        std::fprintf(stderr, "no hardware counters here (no PMU, perf_event_paranoid, or not linux), timing only\n");
+        counters = false;
+    }
+
+    if(counters)
+        std::printf("%-26s %9s %9s %9s %6s %10s %10s %9s\n", "engine", "ns/sample", "cycles", "instr", "IPC", "L1D/1k", "LLC/1k", "br miss");
+    else
+        std::printf("%-26s %9s\n", "engine", "ns/sample");
+
+    for(auto& bench : engines(fs)){
+        bench.render(in.data(), out.data(), n); //warm up
+
+        double best_ns = 1e300;
+        CounterValues best;
+        for(int r = 0; r < runs; ++r){
+            if(counters)
+                pmu.start();
+            const auto start = std::chrono::steady_clock::now();
+            bench.render(in.data(), out.data(), n);
+            const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+            const CounterValues v = counters ? pmu.stop() : CounterValues{};
+            if(took.count()/n < best_ns){
+                best_ns = took.count()/n;
+                best = v;
+            }
+        }
+
+        std::printf("%-26s %9.2f", bench.name, best_ns);
+        if(counters){
+            //per sample, cache misses per thousand samples, '-' where the machine doesn't have the event
+            auto column = [&](Counter c, double per, int width, int precision){
+                if(best.valid[c])
+                    std::printf(" %*.*f", width, precision, best.value[c] * per/n);
+                else
+                    std::printf(" %*s", width, "-");
+            };
+            column(Cycles, 1.0, 9, 1);
+            column(Instructions, 1.0, 9, 1);
+            if(best.valid[Cycles] && best.valid[Instructions])
+                std::printf(" %6.2f", best.ipc());
+            else
+                std::printf(" %6s", "-");
+            column(L1DMisses, 1000.0, 10, 2);
+            column(LLCMisses, 1000.0, 10, 2);
+            column(BranchMisses, 1.0, 9, 3);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "FastMath.h"
+
+
+/* Accuracy and speed of FastMath.h against libm
+ * For every function and tier: max error in float ulps (and relative) against a double reference over a
+ * dense sweep of the range the diodes actually see, and ns per value for the block version vs a std:: loop.
+ * pow sweeps x and y together, x geometric and y linear with a different stride so every pairing shows up.
+ * A NaN or inf anywhere in the output is reported instead of dropping out of the max.
+ */
+namespace {
+
+using fastmath::Accuracy;
+
+double ulp_of(double reference){
+    const float r = std::fabs(static_cast<float>(reference));
+    return static_cast<double>(std::nextafter(r, INFINITY) - r);
+}
+
+double omega_reference(double x){
+    double w = x < 1.0 ? std::exp(x) : x - std::log(x);
+    for(int it = 0; it < 64; ++it)
+        w -= (w + std::log(w) - x) * w/(w + 1.0);
+    return w;
+}
+
+
+//x from lo to hi (geometric when lo > 0), and for pow y from y_lo to y_hi
+struct Sweep {
+    const char* name;
+    double lo;
+    double hi;
+    double (*reference)(double, double);
+    float (*libm)(float, float);
+    double y_lo = 0.0;
+    double y_hi = 0.0;
+};
+
+template <Accuracy A>
+void block(const Sweep& f, const float* in, const float* y, float* out, int n){
+    const std::string name = f.name;
+    if(name == "exp") fastmath::exp<A>(in, out, n);
+    else if(name == "log") fastmath::log<A>(in, out, n);
+    else if(name == "tanh") fastmath::tanh<A>(in, out, n);
+    else if(name == "pow") fastmath::pow<A>(in, y, out, n);
+    else fastmath::wright_omega<A>(in, out, n);
+}
+
+template <typename F>
+double ns_per_value(F&& run, int n){
+    constexpr int reps = 50;
+    run(); //warm up
+    const auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < reps; ++r)
+        run();
+    const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    return took.count()/(static_cast<double>(reps) * n);
+}
+
+
+template <Accuracy A>
+void report(const Sweep& f, const char* tier, const std::vector<float>& in, const std::vector<float>& y, std::vector<float>& out){
+    const int n = static_cast<int>(in.size());
+    const double fast_ns = ns_per_value([&]{ block<A>(f, in.data(), y.data(), out.data(), n); }, n);
+
+    double max_ulp = 0.0;
+    double max_rel = 0.0;
+    int bad = 0;
+    for(int i = 0; i < n; ++i){
+        const double reference = f.reference(static_cast<double>(in[i]), static_cast<double>(y[i]));
+        if(!std::isfinite(reference))
+            continue;
+        if(!std::isfinite(out[i])){
+            ++bad;
+            continue;
+        }
+        const double err = std::fabs(static_cast<double>(out[i]) - reference);
+        max_ulp = std::max(max_ulp, err/ulp_of(reference));
+        if(reference != 0.0)
+            max_rel = std::max(max_rel, err/std::fabs(reference));
+    }
+
+    std::printf("%-6s %-6s %12.1f %10.2e %9.2f", f.name, tier, max_ulp, max_rel, fast_ns);
+    if(bad > 0)
+        std::printf("  %d not finite!", bad);
+}
+
+}
+
+
+int main(){
+    constexpr int n = 1 << 16;
+
+    const Sweep sweeps[] = {
+        {"exp", -80.0, 80.0, [](double x, double){ return std::exp(x); }, [](float x, float){ return std::exp(x); }},
+        {"log", 1e-30, 1e30, [](double x, double){ return std::log(x); }, [](float x, float){ return std::log(x); }},
+        {"tanh", -10.0, 10.0, [](double x, double){ return std::tanh(x); }, [](float x, float){ return std::tanh(x); }},
+        {"pow", 1e-3, 1e3, [](double x, double y){ return std::pow(x, y); }, [](float x, float y){ return std::pow(x, y); }, -3.0, 3.0},
+        {"omega", -20.0, 40.0, [](double x, double){ return omega_reference(x); }, nullptr},
+    };
+
+    std::printf("%-6s %-6s %12s %10s %9s %9s\n", "func", "tier", "max ulp", "max rel", "ns/value", "libm ns");
+    std::vector<float> in(n);
+    std::vector<float> y(n);
+    std::vector<float> out(n);
+
+    for(const auto& f : sweeps){
+        //in double, hi/lo for log's range is way past what a float holds. Geometric for positive ranges so
+        //every exponent shows up
+        for(int i = 0; i < n; ++i){
+            const double t = static_cast<double>(i)/static_cast<double>(n - 1);
+            in[i] = static_cast<float>(f.lo > 0.0 ? f.lo * std::pow(f.hi/f.lo, t) : f.lo + (f.hi - f.lo) * t);
+            const double u = static_cast<double>((i * 389) % n)/static_cast<double>(n - 1);
+            y[i] = static_cast<float>(f.y_lo + (f.y_hi - f.y_lo) * u);
+        }
+
+        double libm_ns = NAN;
+        if(f.libm){
+            std::vector<float> scratch(n);
+            libm_ns = ns_per_value([&]{ for(int i = 0; i < n; ++i) scratch[i] = f.libm(in[i], y[i]); }, n);
+        }
+
+        report<Accuracy::Low>(f, "low", in, y, out);
+        std::printf(" %9.2f\n", libm_ns);
+        report<Accuracy::Medium>(f, "medium", in, y, out);
+        std::printf(" %9.2f\n", libm_ns);
+        report<Accuracy::Full>(f, "full", in, y, out);
+        std::printf(" %9.2f\n", libm_ns);
+    }
+    return 0;
+}
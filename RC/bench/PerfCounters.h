@@ -0,0 +1,128 @@
+
+
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/* Hardware counters
+ * The user space part of a few PMU counters around a benchmark run, read through one perf_event_open
+ * group so they all cover exactly the same stretch of code. Counters the machine doesn't have (VMs often
+ * lack the cache events) just read as missing, and when there's no PMU at all, perf_event_paranoid says no,
+ * or this isn't Linux, available() is false and the benchmarks print timing only.
+ * If the kernel had to multiplex the group, the counts get scaled up to the whole run.
+ */
+enum Counter {
+    Cycles,
+    Instructions,
+    L1DMisses, //l1 data cache read misses
+    LLCMisses, //last level cache misses
+    BranchMisses,
+    NumCounters
+};
+
+
+struct CounterValues {
+    double value[NumCounters] = {};
+    bool valid[NumCounters] = {};
+
+    double ipc() const { return valid[Cycles] && valid[Instructions] && value[Cycles] > 0.0 ? value[Instructions]/value[Cycles] : 0.0; }
+};
+
+
+class PerfCounters {
+
+public:
+    PerfCounters(){
+#if defined(__linux__)
+        const struct { std::uint32_t type; std::uint64_t config; } events[NumCounters] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+
+        for(int c = 0; c < NumCounters; ++c){
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[c].type;
+            attr.config = events[c].config;
+            attr.disabled = leader < 0 ? 1 : 0; //the group starts and stops with its leader
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if(fd < 0)
+                continue;
+            if(leader < 0)
+                leader = fd;
+            fds[c] = fd;
+            ioctl(fd, PERF_EVENT_IOC_ID, &ids[c]);
+        }
+#endif
+    }
+
+    ~PerfCounters(){
+#if defined(__linux__)
+        for(int fd : fds){
+            if(fd >= 0)
+                close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const { return leader >= 0; }
+
+    void start(){
+#if defined(__linux__)
+        if(leader < 0)
+            return;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    CounterValues stop(){
+        CounterValues out;
+#if defined(__linux__)
+        if(leader < 0)
+            return out;
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        //nr, time enabled, time running, then {value, id} per event
+        std::uint64_t data[3 + 2 * NumCounters] = {};
+        if(read(leader, data, sizeof(data)) < static_cast<ssize_t>(3 * sizeof(std::uint64_t)))
+            return out;
+        const std::uint64_t nr = data[0];
+        const double scale = data[2] > 0 ? static_cast<double>(data[1])/static_cast<double>(data[2]) : 0.0;
+        for(std::uint64_t i = 0; i < nr && i < NumCounters; ++i){
+            for(int c = 0; c < NumCounters; ++c){
+                if(fds[c] >= 0 && ids[c] == data[4 + 2 * i]){
+                    out.value[c] = static_cast<double>(data[3 + 2 * i]) * scale;
+                    out.valid[c] = data[2] > 0;
+                }
+            }
+        }
+#endif
+        return out;
+    }
+
+private:
+    int fds[NumCounters] = {-1, -1, -1, -1, -1};
+    std::uint64_t ids[NumCounters] = {};
+    int leader = -1;
+};
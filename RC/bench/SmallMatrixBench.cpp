@@ -0,0 +1,104 @@
+
+
+
+#include <Eigen/Dense>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include "SmallMatrix.h"
+
+
+/* SmallMatrix.h against Eigen, size by size
+ * For every size 2-16: ns per matrix-vector product and per LU factor + solve, for the kernels, for Eigen
+ * with the size fixed at compile time, and for Eigen's dynamic matrices with a fixed maximum, which is
+ * what MNA ran per sample before. Each op feeds its result into the next, so this is latency, the way the
+ * audio path sees it. The last column is the largest difference between the kernel and Eigen results.
+ *     rc_smallmatrix_bench [reps]
+ */
+namespace {
+
+template <typename F>
+double ns_per_op(F&& run, int reps){
+    run(); //warm up
+    double best = 1e300;
+    for(int r = 0; r < 5; ++r){
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < reps; ++i)
+            run();
+        const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+        best = std::fmin(best, took.count()/reps);
+    }
+    return best;
+}
+
+
+template <int N>
+void report(int reps){
+    using Fixed = Eigen::Matrix<float, N, N>;
+    using FixedVector = Eigen::Matrix<float, N, 1>;
+    using Dynamic = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, smallmatrix::max_rows, smallmatrix::max_rows>;
+    using DynamicVector = Eigen::Matrix<float, Eigen::Dynamic, 1, 0, smallmatrix::max_rows, 1>;
+
+    //spectral radius under 1 so the chained products don't blow up, diagonally dominant for the solves
+    std::mt19937 rng(N);
+    std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+    Fixed a;
+    for(int c = 0; c < N; ++c)
+        for(int r = 0; r < N; ++r)
+            a(r, c) = u(rng)/N;
+    Fixed lu_input = a;
+    lu_input.diagonal().array() += 2.0f;
+    FixedVector x0;
+    for(int r = 0; r < N; ++r)
+        x0(r) = u(rng);
+
+    //matrix-vector
+    FixedVector x = x0;
+    const double kernel_mv = ns_per_op([&]{ smallmatrix::multiply<N>(a.data(), N, x.data(), x.data()); x(0) += 1.0f; }, reps);
+    const FixedVector kernel_result = x;
+    x = x0;
+    const double fixed_mv = ns_per_op([&]{ x = a*x; x(0) += 1.0f; }, reps);
+    const Dynamic ad = a;
+    DynamicVector xd = x0;
+    const double dynamic_mv = ns_per_op([&]{ xd = ad*xd; xd(0) += 1.0f; }, reps);
+    const double mv_diff = (kernel_result - x).cwiseAbs().maxCoeff();
+
+    //lu factor + solve of a fresh copy every time, like the newton jacobian
+    FixedVector b = x0;
+    const double kernel_lu = ns_per_op([&]{
+        Fixed m = lu_input;
+        smallmatrix::solve<N>(m.data(), b.data());
+        b(0) += 1.0f;
+    }, reps);
+    const FixedVector kernel_solution = b;
+    b = x0;
+    const double fixed_lu = ns_per_op([&]{ b = lu_input.partialPivLu().solve(b); b(0) += 1.0f; }, reps);
+    const Dynamic lu_dynamic = lu_input;
+    DynamicVector bd = x0;
+    const double dynamic_lu = ns_per_op([&]{ bd = lu_dynamic.partialPivLu().solve(bd); bd(0) += 1.0f; }, reps);
+    const double lu_diff = (kernel_solution - b).cwiseAbs().maxCoeff();
+
+    std::printf("%4d %9.1f %9.1f %9.1f %10.1f %9.1f %9.1f %9.1e\n", N, kernel_mv, fixed_mv, dynamic_mv,
+                kernel_lu, fixed_lu, dynamic_lu, std::fmax(mv_diff, lu_diff));
+}
+
+
+template <int... N>
+void report_all(int reps, std::integer_sequence<int, N...>){
+    (report<N + 2>(reps), ...);
+}
+
+}
+
+
+int main(int argc, char** argv){
+    const int reps = argc > 1 && std::atoi(argv[1]) > 0 ? std::atoi(argv[1]) : 100000;
+
+    std::printf("%4s %29s %30s\n", "", "matrix-vector ns", "lu + solve ns");
+    std::printf("%4s %9s %9s %9s %10s %9s %9s %9s\n", "size", "kernel", "eigen", "eigen dyn", "kernel", "eigen", "eigen dyn", "max diff");
+    report_all(reps, std::make_integer_sequence<int, smallmatrix::max_rows - 1>());
+    return 0;
+}
@@ -0,0 +1,142 @@
+
+#include "rc_capi.h"
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "DKMethod.h"
+#include "MNA.h"
+#include "WDF.h"
+
+
+//every instance starts with this, so we can find out what's behind a handle
+struct rc_engine {
+    rc_engine_type type;
+    float resistor = 10000.f;
+    float capacitor = 10e-9f;
+};
+
+namespace {
+
+template <typename Engine>
+struct Instance : rc_engine {
+    Engine engine;
+};
+
+void set_knobs(DKMethod& e, float r, float c) { e.setKnobs(r, c); }
+void set_knobs(RCLowPass& e, float r, float c) { e.setKnobs(r, c); }
+void set_knobs(MNA& e, float r, float c) { e.set_knobs(c, r); }
+
+
+//calls f with the concrete instance behind the handle
+template <typename F>
+void visit(rc_engine* engine, F&& f){
+    switch(engine->type){
+        case RC_ENGINE_DK: f(*static_cast<Instance<DKMethod>*>(engine)); break;
+        case RC_ENGINE_WDF: f(*static_cast<Instance<RCLowPass>*>(engine)); break;
+        case RC_ENGINE_MNA: f(*static_cast<Instance<MNA>*>(engine)); break;
+    }
+}
+
+
+template <typename Engine>
+rc_engine* create(rc_engine_type type, void* memory, std::size_t size){
+    if(size < sizeof(Instance<Engine>) || reinterpret_cast<std::uintptr_t>(memory) % alignof(Instance<Engine>) != 0)
+        return nullptr;
+
+    try{
+        auto* instance = new (memory) Instance<Engine>();
+        instance->type = type;
+        return instance;
+    }
+    catch(...){ //nothing gets to unwind into C
+        return nullptr;
+    }
+}
+
+}
+
+
+int rc_api_version(void){
+    return RC_API_VERSION;
+}
+
+
+size_t rc_engine_size(rc_engine_type type){
+    switch(type){
+        case RC_ENGINE_DK: return sizeof(Instance<DKMethod>);
+        case RC_ENGINE_WDF: return sizeof(Instance<RCLowPass>);
+        case RC_ENGINE_MNA: return sizeof(Instance<MNA>);
+    }
+    return 0;
+}
+
+
+size_t rc_engine_alignment(rc_engine_type type){
+    switch(type){
+        case RC_ENGINE_DK: return alignof(Instance<DKMethod>);
+        case RC_ENGINE_WDF: return alignof(Instance<RCLowPass>);
+        case RC_ENGINE_MNA: return alignof(Instance<MNA>);
+    }
+    return 0;
+}
+
+
+rc_engine* rc_engine_create(rc_engine_type type, void* memory, size_t size){
+    if(memory == nullptr)
+        return nullptr;
+
+    switch(type){
+        case RC_ENGINE_DK: return create<DKMethod>(type, memory, size);
+        case RC_ENGINE_WDF: return create<RCLowPass>(type, memory, size);
+        case RC_ENGINE_MNA: return create<MNA>(type, memory, size);
+    }
+    return nullptr;
+}
+
+
+void rc_engine_prepare(rc_engine* engine, float sample_rate){
+    visit(engine, [&](auto& instance){
+        instance.engine.prepare(sample_rate);
+        set_knobs(instance.engine, instance.resistor, instance.capacitor);
+        instance.engine.reset(); //again, the knobs may have moved the operating point
+    });
+}
+
+
+void rc_engine_reset(rc_engine* engine, float input){
+    visit(engine, [&](auto& instance){
+        set_knobs(instance.engine, instance.resistor, instance.capacitor);
+        instance.engine.reset(input);
+    });
+}
+
+
+void rc_engine_set_param(rc_engine* engine, rc_param param, float value){
+    if(param == RC_PARAM_RESISTOR)
+        engine->resistor = value;
+    else if(param == RC_PARAM_CAPACITOR)
+        engine->capacitor = value;
+    else
+        return;
+
+    visit(engine, [&](auto& instance){ set_knobs(instance.engine, instance.resistor, instance.capacitor); });
+}
+
+
+void rc_engine_process(rc_engine* engine, const float* in, float* out, int num_samples){
+    visit(engine, [&](auto& instance){
+        for(int n = 0; n < num_samples; ++n)
+            out[n] = instance.engine.process_sample(in[n]);
+    });
+}
+
+
+void rc_engine_destroy(rc_engine* engine){
+    if(engine == nullptr)
+        return;
+    visit(engine, [](auto& instance){
+        using T = std::remove_reference_t<decltype(instance)>;
+        instance.~T();
+    });
+}
@@ -0,0 +1,67 @@
+
+
+#ifndef RC_CAPI_H
+#define RC_CAPI_H
+
+#include <stddef.h>
+
+
+/* Plain C interface to the circuit engines
+ * The caller owns every byte: ask for size/alignment, hand over a block, and create() builds the engine
+ * inside it. Nothing in here allocates, and process() works on caller buffers (in and out can be the same).
+ * Only add to the enums and functions below, never change or reorder them, the values are the ABI.
+ */
+
+#if defined(_WIN32)
+  #if defined(RC_BUILDING_CAPI)
+    #define RC_API __declspec(dllexport)
+  #else
+    #define RC_API __declspec(dllimport)
+  #endif
+#else
+  #define RC_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RC_API_VERSION 1
+
+typedef enum rc_engine_type {
+    RC_ENGINE_DK = 0,
+    RC_ENGINE_WDF = 1,
+    RC_ENGINE_MNA = 2
+} rc_engine_type;
+
+/* every engine starts at 10k and 10n, the values go in as they are (no knob scaling) */
+typedef enum rc_param {
+    RC_PARAM_RESISTOR = 0, /* ohms */
+    RC_PARAM_CAPACITOR = 1 /* farads */
+} rc_param;
+
+typedef struct rc_engine rc_engine;
+
+RC_API int rc_api_version(void);
+
+/* memory needed for one instance, 0 for an unknown type */
+RC_API size_t rc_engine_size(rc_engine_type type);
+RC_API size_t rc_engine_alignment(rc_engine_type type);
+
+/* builds the engine inside memory, NULL if the type is unknown or the block is too small/misaligned */
+RC_API rc_engine* rc_engine_create(rc_engine_type type, void* memory, size_t size);
+
+RC_API void rc_engine_prepare(rc_engine* engine, float sample_rate);
+/* puts the engine at rest on a constant input (its DC operating point), prepare already does this for 0 */
+RC_API void rc_engine_reset(rc_engine* engine, float input);
+RC_API void rc_engine_set_param(rc_engine* engine, rc_param param, float value);
+RC_API void rc_engine_process(rc_engine* engine, const float* in, float* out, int num_samples);
+
+/* tears the engine down, the memory is the caller's to reuse or free afterwards */
+RC_API void rc_engine_destroy(rc_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
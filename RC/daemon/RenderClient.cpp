@@ -0,0 +1,166 @@
+
+#include "RenderClient.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+RenderClient::~RenderClient(){
+    close();
+}
+
+
+bool RenderClient::connect(const char* socket_path){
+    close();
+
+    const std::string fallback = socket_path ? std::string() : render::default_socket_path();
+    if(!socket_path)
+        socket_path = fallback.c_str();
+    if(socket_path[0] == '\0')
+        return false;
+
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if(std::strlen(socket_path) >= sizeof(addr.sun_path))
+        return false;
+    std::strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(socket < 0)
+        return false;
+
+    if(::connect(socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+bool RenderClient::start(render::Engine engine, float sample_rate, float resistor, float capacitor, std::uint32_t ring_capacity){
+    if(socket < 0 || shared != nullptr || ring_capacity == 0 || ring_capacity > render::max_capacity
+       || (ring_capacity & (ring_capacity - 1)) != 0)
+        return false;
+
+    const std::size_t bytes = render::shared_size(ring_capacity);
+#if defined(__linux__)
+    //sealed against shrinking, so the daemon knows nobody can pull pages out from under its mapping
+    const int fd = memfd_create("rc_renderd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    const bool sized = fd >= 0 && ftruncate(fd, static_cast<off_t>(bytes)) == 0
+                    && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) == 0;
+#else
+    //name only lives long enough to get an fd, the daemon gets the fd itself
+    static std::atomic<int> counter {0};
+    char name[64];
+    std::snprintf(name, sizeof(name), "/rc_renderd_%d_%d", static_cast<int>(getpid()), counter.fetch_add(1));
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd >= 0)
+        shm_unlink(name);
+    const bool sized = fd >= 0 && ftruncate(fd, static_cast<off_t>(bytes)) == 0;
+#endif
+    if(fd < 0)
+        return false;
+
+    void* mapping = MAP_FAILED;
+    if(sized)
+        mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED){
+        ::close(fd);
+        return false;
+    }
+
+    shared = new (mapping) render::SharedHeader();
+    shared->capacity = ring_capacity;
+    shared_bytes = bytes;
+    capacity = ring_capacity;
+
+    render::JobRequest job;
+    job.engine = engine;
+    job.sample_rate = sample_rate;
+    job.resistor = resistor;
+    job.capacitor = capacitor;
+    job.capacity = capacity;
+
+    render::JobReply reply;
+    const bool sent = render::send_with_fd(socket, &job, sizeof(job), fd);
+    ::close(fd);
+
+    if(!sent || !render::recv_all(socket, &reply, sizeof(reply)) || reply.magic != render::magic || reply.status != 0){
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+bool RenderClient::set_param(render::Param param, float value){
+    render::ControlMessage msg;
+    msg.param = param;
+    msg.value = value;
+    return socket >= 0 && render::send_all(socket, &msg, sizeof(msg));
+}
+
+
+int RenderClient::write(const float* in, int num_samples){
+    if(shared == nullptr)
+        return 0;
+    return static_cast<int>(render::ring_write(shared->in, render::in_samples(shared), capacity,
+                                               in, static_cast<std::uint32_t>(num_samples)));
+}
+
+
+int RenderClient::read(float* out, int num_samples){
+    if(shared == nullptr)
+        return 0;
+    return static_cast<int>(render::ring_read(shared->out, render::out_samples(shared, capacity), capacity,
+                                              out, static_cast<std::uint32_t>(num_samples)));
+}
+
+
+int RenderClient::render(const float* in, float* out, int num_samples, int timeout_ms){
+    using clock = std::chrono::steady_clock;
+    int written = 0;
+    int done = 0;
+    auto last_progress = clock::now();
+    while(done < num_samples && shared != nullptr){
+        written += write(in + written, num_samples - written);
+        const int got = read(out + done, num_samples - done);
+        done += got;
+        if(got > 0){
+            last_progress = clock::now();
+            continue;
+        }
+
+        //the daemon never writes to the socket after the reply, so anything readable there means it's gone
+        pollfd pfd {socket, POLLIN, 0};
+        if(poll(&pfd, 1, 0) != 0)
+            break;
+        if(clock::now() - last_progress > std::chrono::milliseconds(timeout_ms))
+            break;
+        std::this_thread::yield();
+    }
+    return done;
+}
+
+
+void RenderClient::close(){
+    if(shared != nullptr){
+        munmap(shared, shared_bytes);
+        shared = nullptr;
+        capacity = 0;
+    }
+    if(socket >= 0){
+        ::close(socket);
+        socket = -1;
+    }
+}
@@ -0,0 +1,37 @@
+
+
+#pragma once
+#include <cstdint>
+#include "RenderProtocol.h"
+
+
+/* Client side of rc_renderd
+ * start() makes the shared rings and hands them to the daemon, then write()/read() move audio through
+ * them without blocking. render() is the blocking convenience for offline tools, it gives up once the
+ * daemon has made no progress for timeout_ms (or hung up) and returns how many samples came back.
+ */
+class RenderClient {
+
+public:
+    RenderClient() = default;
+    ~RenderClient();
+
+    RenderClient(const RenderClient&) = delete;
+    RenderClient& operator=(const RenderClient&) = delete;
+
+    bool connect(const char* socket_path = nullptr); //nullptr: render::default_socket_path()
+    bool start(render::Engine engine, float sample_rate, float resistor, float capacitor, std::uint32_t capacity = 1u << 14);
+    bool set_param(render::Param param, float value);
+
+    int write(const float* in, int num_samples); //how many fit
+    int read(float* out, int num_samples); //how many were ready
+    int render(const float* in, float* out, int num_samples, int timeout_ms = 1000);
+
+    void close();
+
+private:
+    int socket = -1;
+    render::SharedHeader* shared = nullptr;
+    std::size_t shared_bytes = 0;
+    std::uint32_t capacity = 0; //ours, the header's copy is the daemon's to scribble on
+};
@@ -0,0 +1,106 @@
+
+#include "RenderProtocol.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+namespace render {
+
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL; //a client going away shouldn't kill us with SIGPIPE
+#else
+constexpr int send_flags = 0;
+#endif
+
+
+std::string default_socket_path(){
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    if(runtime && runtime[0] == '/')
+        return std::string(runtime) + "/rc_renderd.sock";
+
+    const std::string dir = "/tmp/rc_renderd-" + std::to_string(getuid());
+    mkdir(dir.c_str(), 0700); //fails if it's already there, which the checks below sort out
+    struct stat info {};
+    if(lstat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077) != 0)
+        return {};
+    return dir + "/rc_renderd.sock";
+}
+
+
+bool send_with_fd(int socket, const void* data, std::size_t size, int fd){
+    iovec iov {const_cast<void*>(data), size};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    return sendmsg(socket, &msg, send_flags) == static_cast<ssize_t>(size);
+}
+
+
+bool recv_with_fd(int socket, void* data, std::size_t size, int& fd){
+    iovec iov {data, size};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    fd = -1;
+    if(recvmsg(socket, &msg, MSG_WAITALL) != static_cast<ssize_t>(size))
+        return false;
+
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return fd >= 0;
+}
+
+
+bool send_all(int socket, const void* data, std::size_t size){
+    const char* p = static_cast<const char*>(data);
+    while(size > 0){
+        const ssize_t n = send(socket, p, size, send_flags);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+
+bool recv_all(int socket, void* data, std::size_t size){
+    char* p = static_cast<char*>(data);
+    while(size > 0){
+        const ssize_t n = recv(socket, p, size, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,114 @@
+
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+/* Render daemon protocol
+ * Clients talk to rc_renderd over a unix socket, but audio never goes through it. The client makes a
+ * shared memory block holding two single-producer/single-consumer rings (input and output), passes its fd
+ * along with the JobRequest (SCM_RIGHTS, so nothing needs a name in /dev/shm), and from then on the
+ * socket only carries small ControlMessages. Closing the socket ends the job.
+ */
+namespace render {
+
+constexpr std::uint32_t magic = 0x52435244; //"RCRD"
+constexpr std::uint32_t version = 1;
+constexpr std::uint32_t max_capacity = 1u << 24; //samples per ring
+
+enum class Engine : std::uint32_t {
+    DK = 0,
+    WDF = 1,
+    MNA = 2
+};
+
+enum class Param : std::uint32_t {
+    Resistor = 0,
+    Capacitor = 1
+};
+
+//where rc_renderd listens unless it's told otherwise: $XDG_RUNTIME_DIR (private to the user by spec), or
+///tmp/rc_renderd-<uid>, made 0700. Clients hand the daemon their shared memory, so whoever owns the socket
+//gets it: empty if the /tmp directory exists but isn't ours alone, someone else could be squatting it
+std::string default_socket_path();
+
+
+struct JobRequest {
+    std::uint32_t magic = render::magic;
+    std::uint32_t version = render::version;
+    Engine engine = Engine::MNA;
+    float sample_rate = 44100.f;
+    float resistor = 10000.f;
+    float capacitor = 10000.f;
+    std::uint32_t capacity = 0; //samples per ring, power of two up to max_capacity
+};
+
+struct JobReply {
+    std::uint32_t magic = render::magic;
+    std::int32_t status = 0; //0 is ok
+};
+
+struct ControlMessage {
+    Param param = Param::Resistor;
+    float value = 0.0f;
+};
+
+
+//write/read counters only ever grow, the slot is counter & (capacity - 1)
+struct Ring {
+    alignas(64) std::atomic<std::uint64_t> write {0};
+    alignas(64) std::atomic<std::uint64_t> read {0};
+};
+
+//the other process can write anything into this at any time, so each side keeps its own copy of the
+//capacity from the handshake and never goes by the one in here after that
+struct SharedHeader {
+    std::uint32_t magic = render::magic;
+    std::uint32_t capacity = 0;
+    Ring in; //client -> daemon
+    Ring out; //daemon -> client
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "rings need lock free 64 bit atomics to work across processes");
+
+inline std::size_t samples_offset() { return (sizeof(SharedHeader) + 63) & ~std::size_t{63}; }
+inline std::size_t shared_size(std::uint32_t capacity) { return samples_offset() + 2 * std::size_t{capacity} * sizeof(float); }
+inline float* in_samples(SharedHeader* h) { return reinterpret_cast<float*>(reinterpret_cast<char*>(h) + samples_offset()); }
+inline float* out_samples(SharedHeader* h, std::uint32_t capacity) { return in_samples(h) + capacity; }
+
+
+//producer side: copies what fits, returns how many went in
+inline std::uint32_t ring_write(Ring& ring, float* slots, std::uint32_t capacity, const float* src, std::uint32_t n){
+    const std::uint64_t w = ring.write.load(std::memory_order_relaxed);
+    const std::uint64_t r = ring.read.load(std::memory_order_acquire);
+    const std::uint32_t space = capacity - static_cast<std::uint32_t>(w - r);
+    const std::uint32_t count = n < space ? n : space;
+    for(std::uint32_t i = 0; i < count; ++i)
+        slots[(w + i) & (capacity - 1)] = src[i];
+    ring.write.store(w + count, std::memory_order_release);
+    return count;
+}
+
+//consumer side: copies what's there, returns how many came out
+inline std::uint32_t ring_read(Ring& ring, const float* slots, std::uint32_t capacity, float* dst, std::uint32_t n){
+    const std::uint64_t r = ring.read.load(std::memory_order_relaxed);
+    const std::uint64_t w = ring.write.load(std::memory_order_acquire);
+    const std::uint32_t available = static_cast<std::uint32_t>(w - r);
+    const std::uint32_t count = n < available ? n : available;
+    for(std::uint32_t i = 0; i < count; ++i)
+        dst[i] = slots[(r + i) & (capacity - 1)];
+    ring.read.store(r + count, std::memory_order_release);
+    return count;
+}
+
+
+//unix socket helpers, the fd rides along as SCM_RIGHTS ancillary data
+bool send_with_fd(int socket, const void* data, std::size_t size, int fd);
+bool recv_with_fd(int socket, void* data, std::size_t size, int& fd);
+bool send_all(int socket, const void* data, std::size_t size);
+bool recv_all(int socket, void* data, std::size_t size);
+
+}
@@ -0,0 +1,333 @@
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "DKMethod.h"
+#include "MNA.h"
+#include "RenderProtocol.h"
+#include "WDF.h"
+
+
+/* rc_renderd
+ * Keeps the engines warm in one process so offline tools and sandboxed hosts don't each pay for startup.
+ * One thread per connected client renders straight from its input ring into its output ring. Clients
+ * aren't trusted: the shared block has to be as big as the capacity they asked for, the capacity is read
+ * once from the request, and ring counters are only ever used masked, so a client can garble its own
+ * audio but not reach outside its block or take the daemon down. At most max_clients jobs run at once,
+ * a connection past that is closed straight away, and every job thread is joined before the daemon exits.
+ *
+ *     rc_renderd [socket path]     (default: render::default_socket_path())
+ *
+ * An existing file at the path only gets replaced if it's a socket.
+ */
+namespace {
+
+constexpr std::size_t max_clients = 64;
+constexpr int request_timeout_ms = 2000; //for a client's JobRequest, and for the rest of a message once one starts
+
+std::atomic<bool> running {true};
+int listen_socket = -1;
+
+void stop(int){
+    running.store(false);
+    if(listen_socket >= 0)
+        shutdown(listen_socket, SHUT_RDWR); //kicks accept() loose
+}
+
+
+struct Renderer {
+    virtual ~Renderer() = default;
+    virtual void set_knobs(float r, float c) = 0;
+    virtual float process_sample(float x) = 0;
+};
+
+template <typename Engine>
+struct EngineRenderer : Renderer {
+    EngineRenderer() = default;
+    explicit EngineRenderer(const Engine& prototype) : engine(prototype) {}
+
+    void set_knobs(float r, float c) override { knobs(engine, r, c); }
+    float process_sample(float x) override { return engine.process_sample(x); }
+
+    static void knobs(DKMethod& e, float r, float c) { e.setKnobs(r, c); }
+    static void knobs(RCLowPass& e, float r, float c) { e.setKnobs(r, c); }
+    static void knobs(MNA& e, float r, float c) { e.set_knobs(c, r); }
+
+    Engine engine;
+};
+
+
+//prepared MNAs by (fs, R, C): a new job with a setting we've seen just copies the factorized system.
+//Clients pick the keys, so it keeps the max_prototypes most recently used ones
+class PrototypeCache {
+
+public:
+    static constexpr std::size_t max_prototypes = 64;
+
+    std::unique_ptr<Renderer> make_mna(float fs, float r, float c){
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto key = std::make_tuple(fs, r, c);
+        auto it = prototypes.find(key);
+        if(it == prototypes.end()){
+            if(prototypes.size() >= max_prototypes){
+                auto oldest = prototypes.begin();
+                for(auto p = prototypes.begin(); p != prototypes.end(); ++p){
+                    if(p->second.last_used < oldest->second.last_used)
+                        oldest = p;
+                }
+                prototypes.erase(oldest);
+            }
+            MNA mna;
+            mna.set_knobs(c, r);
+            mna.prepare(fs);
+            it = prototypes.emplace(key, Entry{mna, 0}).first;
+        }
+        it->second.last_used = ++uses;
+        return std::make_unique<EngineRenderer<MNA>>(it->second.mna);
+    }
+
+private:
+    struct Entry {
+        MNA mna;
+        std::uint64_t last_used;
+    };
+
+    std::mutex mutex;
+    std::map<std::tuple<float, float, float>, Entry> prototypes;
+    std::uint64_t uses = 0;
+};
+
+PrototypeCache cache;
+
+
+bool sane_value(float v){
+    return std::isfinite(v) && v > 0.0f;
+}
+
+
+std::unique_ptr<Renderer> make_renderer(const render::JobRequest& job){
+    if(!sane_value(job.sample_rate) || !sane_value(job.resistor) || !sane_value(job.capacitor))
+        return nullptr;
+    if(job.engine == render::Engine::MNA)
+        return cache.make_mna(job.sample_rate, job.resistor, job.capacitor);
+
+    //knobs before prepare, which is where the engines settle on their DC operating point
+    if(job.engine == render::Engine::DK){
+        auto dk = std::make_unique<EngineRenderer<DKMethod>>();
+        dk->set_knobs(job.resistor, job.capacitor);
+        dk->engine.prepare(job.sample_rate);
+        return dk;
+    }
+    if(job.engine == render::Engine::WDF){
+        auto wdf = std::make_unique<EngineRenderer<RCLowPass>>();
+        wdf->set_knobs(job.resistor, job.capacitor);
+        wdf->engine.prepare(job.sample_rate);
+        return wdf;
+    }
+    return nullptr;
+}
+
+
+//everything that's waiting in the input ring and fits in the output ring, in place in shared memory.
+//capacity is the one the mapping was checked against, never the client writable copy in the header
+std::uint32_t render(render::SharedHeader* shared, std::uint32_t capacity, Renderer& renderer){
+    const std::uint32_t mask = capacity - 1;
+    const float* in = render::in_samples(shared);
+    float* out = render::out_samples(shared, capacity);
+
+    const std::uint64_t ir = shared->in.read.load(std::memory_order_relaxed);
+    const std::uint64_t iw = shared->in.write.load(std::memory_order_acquire);
+    const std::uint64_t ow = shared->out.write.load(std::memory_order_relaxed);
+    const std::uint64_t orr = shared->out.read.load(std::memory_order_acquire);
+
+    //counters the client made up can't be trusted to make sense, the slots are masked either way
+    const std::uint64_t used = ow - orr;
+    const std::uint64_t available = std::min<std::uint64_t>(iw - ir, capacity);
+    const std::uint64_t space = used < capacity ? capacity - used : 0;
+    const std::uint32_t count = static_cast<std::uint32_t>(std::min(available, space));
+
+    for(std::uint32_t i = 0; i < count; ++i)
+        out[(ow + i) & mask] = renderer.process_sample(in[(ir + i) & mask]);
+
+    shared->in.read.store(ir + count, std::memory_order_release);
+    shared->out.write.store(ow + count, std::memory_order_release);
+    return count;
+}
+
+
+void serve(int client){
+    //a client that connects and then says nothing (or half a message) mustn't hold its thread forever
+    timeval timeout {request_timeout_ms/1000, (request_timeout_ms % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    render::JobRequest job;
+    int shm = -1;
+    render::JobReply reply;
+
+    const bool received = render::recv_with_fd(client, &job, sizeof(job), shm);
+    const std::uint32_t capacity = job.capacity;
+    bool valid = received && job.magic == render::magic && job.version == render::version
+              && capacity > 0 && capacity <= render::max_capacity && (capacity & (capacity - 1)) == 0;
+
+    //touching pages past the end of a smaller shm object is a SIGBUS for the whole daemon
+    const std::size_t size = valid ? render::shared_size(capacity) : 0;
+    struct stat info {};
+    valid = valid && shm >= 0 && fstat(shm, &info) == 0 && info.st_size >= 0 && static_cast<std::size_t>(info.st_size) >= size;
+#if defined(__linux__)
+    //and it has to stay that big: without the seal a client could shrink it after the fstat
+    valid = valid && (fcntl(shm, F_GET_SEALS) & F_SEAL_SHRINK) != 0;
+#endif
+
+    void* mapping = MAP_FAILED;
+    if(valid)
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    if(shm >= 0)
+        close(shm);
+
+    std::unique_ptr<Renderer> renderer;
+    auto* shared = static_cast<render::SharedHeader*>(mapping);
+    if(mapping != MAP_FAILED && shared->magic == render::magic && shared->capacity == capacity)
+        renderer = make_renderer(job);
+
+    reply.status = renderer ? 0 : -1;
+    render::send_all(client, &reply, sizeof(reply));
+
+    float resistor = job.resistor;
+    float capacitor = job.capacitor;
+    while(renderer && running.load()){
+        //spin while there's work, otherwise nap on the socket so an idle job costs nothing
+        const int timeout_ms = render(shared, capacity, *renderer) > 0 ? 0 : 1;
+
+        pollfd pfd {client, POLLIN, 0};
+        if(poll(&pfd, 1, timeout_ms) > 0){
+            render::ControlMessage msg;
+            if(!render::recv_all(client, &msg, sizeof(msg)))
+                break; //client hung up
+
+            if(!sane_value(msg.value))
+                continue;
+            if(msg.param == render::Param::Resistor)
+                resistor = msg.value;
+            else if(msg.param == render::Param::Capacitor)
+                capacitor = msg.value;
+            renderer->set_knobs(resistor, capacitor);
+        }
+    }
+
+    if(mapping != MAP_FAILED)
+        munmap(mapping, size);
+}
+
+}
+
+
+struct Job {
+    int client = -1; //closed after the join, so shutting it down from main can't hit a reused fd
+    std::thread thread;
+    std::atomic<bool> done {false};
+};
+
+
+int main(int argc, char** argv){
+    const std::string path = argc > 1 ? std::string(argv[1]) : render::default_socket_path();
+    if(path.empty()){
+        std::fprintf(stderr, "rc_renderd: /tmp/rc_renderd-%d isn't a private directory of ours, set XDG_RUNTIME_DIR "
+                             "or pass a socket path\n", static_cast<int>(getuid()));
+        return 1;
+    }
+
+    std::signal(SIGINT, stop);
+    std::signal(SIGTERM, stop);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if(listen_socket < 0 || path.size() >= sizeof(addr.sun_path)){
+        std::fprintf(stderr, "rc_renderd: can't make a socket at %s\n", path.c_str());
+        return 1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    //a stale socket from a daemon that died goes, anything else at that path is somebody's file
+    struct stat existing {};
+    if(lstat(path.c_str(), &existing) == 0){
+        if(!S_ISSOCK(existing.st_mode)){
+            std::fprintf(stderr, "rc_renderd: %s exists and isn't a socket, not replacing it\n", path.c_str());
+            return 1;
+        }
+        unlink(path.c_str());
+    }
+    if(bind(listen_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_socket, 16) != 0){
+        std::perror("rc_renderd");
+        return 1;
+    }
+    std::printf("rc_renderd: listening on %s\n", path.c_str());
+
+    std::list<Job> jobs;
+    auto reap = [&jobs](bool all){
+        for(auto it = jobs.begin(); it != jobs.end();){
+            if(all || it->done.load()){
+                it->thread.join();
+                close(it->client);
+                it = jobs.erase(it);
+            }
+            else{
+                ++it;
+            }
+        }
+    };
+
+    while(running.load()){
+        const int client = accept(listen_socket, nullptr, nullptr);
+        reap(false);
+        if(client < 0){
+            //out of fds or memory doesn't go away by asking again straight away
+            if(errno != EINTR && running.load())
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        if(jobs.size() >= max_clients){
+            close(client); //its start() fails on the hang up
+            continue;
+        }
+
+        jobs.emplace_back();
+        Job& job = jobs.back();
+        job.client = client;
+        job.thread = std::thread([client, &job]{
+            serve(client);
+            job.done.store(true);
+        });
+    }
+
+    //a job mid-render sees running go false within a poll timeout, one still waiting for its request
+    //needs its socket shut, and the cache outlives them all
+    for(Job& job : jobs)
+        shutdown(job.client, SHUT_RDWR);
+    reap(true);
+    close(listen_socket);
+    unlink(path.c_str());
+    return 0;
+}
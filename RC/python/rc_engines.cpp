@@ -0,0 +1,435 @@
+
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DKMethod.h"
+#include "Decoupling.h"
+#include "HarmonicBalance.h"
+#include "EngineSelector.h"
+#include "MNA.h"
+#include "ModelReduction.h"
+#include "Oversampling.h"
+#include "Preview.h"
+#include "Sensitivity.h"
+#include "SpiceParser.h"
+#include "WDF.h"
+
+
+/* Python bindings for the engines
+ * Buffers are float32 C-contiguous numpy arrays processed in place (noconvert, so a wrong dtype is an
+ * error instead of a silent copy), and the GIL is dropped while the engines run.
+ */
+namespace py = pybind11;
+using Buffer = py::array_t<float, py::array::c_style>;
+
+namespace {
+
+//the engines don't agree on knob names/order, so python gets one spelling
+void set_knobs(DKMethod& e, float r, float c) { e.setKnobs(r, c); }
+void set_knobs(RCLowPass& e, float r, float c) { e.setKnobs(r, c); }
+void set_knobs(MNA& e, float r, float c) { e.set_knobs(c, r); }
+void set_knobs(OversampledMNA& e, float r, float c) { e.set_knobs(c, r); }
+void set_knobs(ReducedEngine& e, float r, float c) { e.set_knobs(c, r); }
+
+
+template <typename Engine>
+void process_in_place(Engine& engine, Buffer& buffer){
+    float* data = buffer.mutable_data();
+    const py::ssize_t n = buffer.size();
+
+    py::gil_scoped_release release;
+    for(py::ssize_t i = 0; i < n; ++i)
+        data[i] = engine.process_sample(data[i]);
+}
+
+
+//rows of `signals` are rendered in place, each through a fresh engine set up by `setup(engine, row)`.
+//Whatever make() or setup() throws on a pool thread comes back out of here once every thread is joined,
+//an exception escaping a std::thread would take the interpreter down with it
+template <typename Make, typename Setup>
+void run_batch(Buffer& signals, int num_threads, Make make, Setup setup){
+    if(signals.ndim() != 2)
+        throw std::invalid_argument("signals has to be 2D: (configurations, samples)");
+
+    float* data = signals.mutable_data();
+    const int rows = static_cast<int>(signals.shape(0));
+    const py::ssize_t length = signals.shape(1);
+
+    if(num_threads <= 0)
+        num_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    num_threads = std::max(1, std::min(num_threads, rows));
+
+    py::gil_scoped_release release;
+    std::vector<std::exception_ptr> errors(static_cast<std::size_t>(num_threads));
+    auto work = [&](int first){
+        try{
+            for(int k = first; k < rows; k += num_threads){
+                auto engine = make();
+                setup(engine, k);
+                float* row = data + k * length;
+                for(py::ssize_t i = 0; i < length; ++i)
+                    row[i] = engine.process_sample(row[i]);
+            }
+        }
+        catch(...){
+            errors[static_cast<std::size_t>(first)] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(int t = 1; t < num_threads; ++t)
+        pool.emplace_back(work, t);
+    work(0);
+    for(auto& t : pool)
+        t.join();
+    for(const auto& e : errors){
+        if(e)
+            std::rethrow_exception(e);
+    }
+}
+
+
+void check_params(const Buffer& signals, const py::array_t<float, py::array::c_style>& params, py::ssize_t columns){
+    if(params.ndim() != 2 || params.shape(1) != columns || params.shape(0) != signals.shape(0))
+        throw std::invalid_argument("params has to be (configurations, " + std::to_string(columns) + ")");
+}
+
+
+//dk and wdf batches take (resistor, capacitor) per row
+template <typename Engine>
+void rc_batch(Buffer& signals, const py::array_t<float, py::array::c_style>& params, float fs, int num_threads){
+    check_params(signals, params, 2);
+    const float* p = params.data();
+    run_batch(signals, num_threads, []{ return Engine{}; }, [&](Engine& e, int k){
+        set_knobs(e, p[2 * k], p[2 * k + 1]);
+        e.prepare(fs); //after the knobs, it's where the engines settle on their DC operating point
+    });
+}
+
+
+//one input through every row of params = (resistor, capacitor) at once, (configurations, samples) out
+py::array_t<float> preview(PreviewModel model, const py::array_t<float, py::array::c_style>& input,
+                           const py::array_t<float, py::array::c_style>& params, float fs){
+    if(input.ndim() != 1)
+        throw std::invalid_argument("input has to be 1D");
+    if(params.ndim() != 2 || params.shape(1) != 2)
+        throw std::invalid_argument("params has to be (configurations, 2)");
+
+    const int count = static_cast<int>(params.shape(0));
+    const py::ssize_t length = input.shape(0);
+    std::vector<float> resistors(static_cast<std::size_t>(count)), capacitors(static_cast<std::size_t>(count));
+    for(int k = 0; k < count; ++k){
+        resistors[static_cast<std::size_t>(k)] = params.at(k, 0);
+        capacitors[static_cast<std::size_t>(k)] = params.at(k, 1);
+    }
+
+    py::array_t<float> out({static_cast<py::ssize_t>(count), length});
+    std::vector<float*> rows(static_cast<std::size_t>(count));
+    for(int k = 0; k < count; ++k)
+        rows[static_cast<std::size_t>(k)] = out.mutable_data(k, 0);
+
+    py::gil_scoped_release release;
+    PreviewBank bank(model);
+    bank.set_configurations(resistors.data(), capacitors.data(), count);
+    bank.prepare(fs);
+    bank.process(input.data(), rows.data(), static_cast<int>(length));
+    return out;
+}
+
+}
+
+
+PYBIND11_MODULE(rc_engines, m){
+    m.doc() = "RC circuit engines (DK method, WDF, MNA) with in-place numpy processing";
+
+    py::enum_<NoiseFlags>(m, "Noise", py::arithmetic())
+        .value("NONE", NoiseNone)
+        .value("THERMAL", NoiseThermal)
+        .value("SHOT", NoiseShot)
+        .value("FLICKER", NoiseFlicker);
+
+    py::class_<Netlist>(m, "Netlist")
+        .def(py::init<>())
+        .def("add_node", &Netlist::add_node)
+        .def("add_resistor", &Netlist::add_resistor, py::arg("name"), py::arg("n1"), py::arg("n2"), py::arg("r"))
+        .def("add_capacitor", &Netlist::add_capacitor, py::arg("name"), py::arg("n1"), py::arg("n2"), py::arg("c"))
+        .def("add_voltage_source", &Netlist::add_voltage_source,
+             py::arg("name"), py::arg("n1"), py::arg("n2"), py::arg("v"), py::arg("is_input") = false)
+        .def("add_diode", &Netlist::add_diode,
+             py::arg("name"), py::arg("anode"), py::arg("cathode"), py::arg("i_s") = 2.52e-9f, py::arg("n_vt") = 1.752f * 0.02585f)
+        .def("add_probe", &Netlist::add_probe)
+        .def("set_output", &Netlist::set_output)
+        .def("set_value", &Netlist::set_value)
+        .def("set_noise", [](Netlist& n, const std::string& name, int flags, float kf){
+                 return n.set_noise(name.c_str(), static_cast<std::uint8_t>(flags), kf);
+             }, py::arg("name"), py::arg("flags"), py::arg("kf") = 0.0f)
+        .def_property_readonly("num_nodes", &Netlist::num_nodes)
+        .def_property_readonly("num_elements", &Netlist::num_elements)
+        .def_static("rc_lowpass", &Netlist::rc_lowpass, py::arg("r"), py::arg("c"));
+
+    m.def("parse_spice", &parse_spice, py::arg("text"));
+    m.def("read_spice", &read_spice, py::arg("path"));
+
+    py::class_<DKMethod>(m, "DKMethod")
+        .def(py::init<>())
+        .def("prepare", &DKMethod::prepare)
+        .def("reset", &DKMethod::reset, py::arg("input") = 0.0f)
+        .def("set_knobs", [](DKMethod& e, float r, float c){ set_knobs(e, r, c); }, py::arg("resistor"), py::arg("capacitor"))
+        .def("set_noise", &DKMethod::set_noise, py::arg("enabled"), py::arg("temperature") = 300.0f)
+        .def("process_sample", &DKMethod::process_sample)
+        .def("process", &process_in_place<DKMethod>, py::arg("buffer").noconvert());
+
+    py::class_<RCLowPass>(m, "RCLowPass")
+        .def(py::init<>())
+        .def("prepare", &RCLowPass::prepare)
+        .def("reset", &RCLowPass::reset, py::arg("input") = 0.0f)
+        .def("set_knobs", [](RCLowPass& e, float r, float c){ set_knobs(e, r, c); }, py::arg("resistor"), py::arg("capacitor"))
+        .def("set_noise", &RCLowPass::set_noise, py::arg("enabled"), py::arg("temperature") = 300.0f)
+        .def("process_sample", &RCLowPass::process_sample)
+        .def("process", &process_in_place<RCLowPass>, py::arg("buffer").noconvert());
+
+    py::class_<MNA>(m, "MNA")
+        .def(py::init<>())
+        .def(py::init<const Netlist&>(), py::arg("netlist"))
+        .def("prepare", &MNA::prepare)
+        .def("reset", &MNA::reset, py::arg("input") = 0.0f)
+        .def("set_knobs", [](MNA& e, float r, float c){ set_knobs(e, r, c); }, py::arg("resistor"), py::arg("capacitor"))
+        .def("set_value", &MNA::set_value)
+        .def("set_noise", &MNA::set_noise, py::arg("enabled"), py::arg("temperature") = 300.0f, py::arg("seed") = 0x5eed)
+        .def("set_adaptive", &MNA::set_adaptive, py::arg("enabled"), py::arg("tolerance") = 1e-4f, py::arg("release_ms") = 50.0f)
+        .def_property_readonly("running_linear", &MNA::running_linear)
+        .def("set_refinement", &MNA::set_refinement, py::arg("tolerance") = 1e-5f)
+        .def_property_readonly("refining", &MNA::refining)
+        .def("process_sample", &MNA::process_sample)
+        .def("process", &process_in_place<MNA>, py::arg("buffer").noconvert())
+        .def("process_channels", [](MNA& e, Buffer& channels){
+                 if(channels.ndim() != 2 || channels.shape(0) > MNA::max_channels)
+                     throw std::invalid_argument("channels has to be 2D: (channels, samples), at most MNA.max_channels rows");
+                 float* rows[MNA::max_channels];
+                 const int num_channels = static_cast<int>(channels.shape(0));
+                 for(int c = 0; c < num_channels; ++c)
+                     rows[c] = channels.mutable_data(c, 0);
+                 py::gil_scoped_release release;
+                 e.process_block(rows, num_channels, static_cast<int>(channels.shape(1)));
+             }, "every row through one shared set of coefficients, each with its own state", py::arg("channels").noconvert())
+        .def_readonly_static("max_channels", &MNA::max_channels)
+        .def("save", [](const MNA& e){
+                 std::vector<unsigned char> bytes;
+                 e.save(bytes);
+                 return py::bytes(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+             })
+        .def_static("load", [](const py::bytes& data){
+                 const std::string bytes = data;
+                 MNA e;
+                 if(!e.load(bytes.data(), bytes.size()))
+                     throw std::invalid_argument("MNA.load: not a compiled circuit (or built with different limits)");
+                 return e;
+             }, py::arg("data"))
+        .def("stable_oversampling", [](const MNA& e, float base_rate, float accuracy, float max_ringing, float junction_current, int max_factor){
+                 OversamplingTarget target{accuracy, max_ringing, junction_current, max_factor};
+                 return e.stable_oversampling(base_rate, target);
+             }, py::arg("base_rate"), py::arg("accuracy") = 1e-2f, py::arg("max_ringing") = 0.5f,
+             py::arg("junction_current") = 1e-3f, py::arg("max_factor") = 16)
+        .def_property_readonly("num_unknowns", &MNA::num_unknowns)
+        .def_property_readonly("num_nonlinear", &MNA::num_nonlinear);
+
+    py::class_<OversampledMNA>(m, "OversampledMNA")
+        .def(py::init([](const Netlist& netlist, float accuracy, float max_ringing, float junction_current, int max_factor, float crossfade_ms){
+                 OversamplingTarget target{accuracy, max_ringing, junction_current, max_factor};
+                 return std::make_unique<OversampledMNA>(netlist, target, crossfade_ms);
+             }), py::arg("netlist"), py::arg("accuracy") = 1e-2f, py::arg("max_ringing") = 0.5f,
+             py::arg("junction_current") = 1e-3f, py::arg("max_factor") = 16, py::arg("crossfade_ms") = 10.0f)
+        .def("prepare", &OversampledMNA::prepare)
+        .def("reset", &OversampledMNA::reset, py::arg("input") = 0.0f)
+        .def("set_knobs", [](OversampledMNA& e, float r, float c){ set_knobs(e, r, c); }, py::arg("resistor"), py::arg("capacitor"))
+        .def("set_value", &OversampledMNA::set_value)
+        .def("process_sample", &OversampledMNA::process_sample)
+        .def("process", &process_in_place<OversampledMNA>, py::arg("buffer").noconvert())
+        .def_property_readonly("factor", &OversampledMNA::factor)
+        .def_property_readonly("latency", &OversampledMNA::latency);
+
+    py::class_<DecoupledMNA>(m, "DecoupledMNA")
+        .def(py::init<const Netlist&, const std::vector<int>&, int, int, float>(),
+             py::arg("netlist"), py::arg("cut_nodes"), py::arg("line_delay") = 1,
+             py::arg("num_threads") = 0, py::arg("default_impedance") = 1000.0f)
+        .def("prepare", &DecoupledMNA::prepare)
+        .def("set_value", &DecoupledMNA::set_value)
+        .def("process", [](DecoupledMNA& e, Buffer& buffer){
+                 float* data = buffer.mutable_data();
+                 const int n = static_cast<int>(buffer.size());
+                 py::gil_scoped_release release;
+                 e.process_block(data, data, n);
+             }, py::arg("buffer").noconvert())
+        .def_property_readonly("num_subcircuits", &DecoupledMNA::num_subcircuits);
+
+    m.def("reduce_balanced", [](const Netlist& netlist, float fs, double max_error, int max_order){
+              const ReducedModel r = reduce_balanced(netlist, fs, max_error, max_order);
+              py::dict out;
+              out["order"] = r.order;
+              out["full_order"] = r.full_order;
+              out["error_bound"] = r.error_bound;
+              out["hankel"] = std::vector<double>(r.hankel, r.hankel + r.full_order);
+              return out;
+          }, "order, error bound and hankel singular values of a linear circuit",
+          py::arg("netlist"), py::arg("fs"), py::arg("max_error") = 1e-4, py::arg("max_order") = ReducedModel::max_order);
+
+    py::class_<ReducedEngine>(m, "ReducedEngine")
+        .def(py::init<const Netlist&, double, int>(), py::arg("netlist"), py::arg("max_error") = 1e-4,
+             py::arg("max_order") = ReducedModel::max_order)
+        .def("prepare", &ReducedEngine::prepare)
+        .def("reset", &ReducedEngine::reset)
+        .def("set_knobs", [](ReducedEngine& e, float r, float c){ set_knobs(e, r, c); }, py::arg("resistor"), py::arg("capacitor"))
+        .def("set_value", &ReducedEngine::set_value)
+        .def("process_sample", &ReducedEngine::process_sample)
+        .def("process", &process_in_place<ReducedEngine>, py::arg("buffer").noconvert())
+        .def_property_readonly("order", &ReducedEngine::order)
+        .def_property_readonly("error_bound", &ReducedEngine::error_bound)
+        .def_property_readonly("generation", &ReducedEngine::generation)
+        .def_property_readonly("last_error", &ReducedEngine::last_error);
+
+    py::enum_<SensitivityMetric>(m, "SensitivityMetric")
+        .value("RMS_ERROR", SensitivityMetric::RmsError)
+        .value("THD", SensitivityMetric::THD);
+
+    m.def("adjoint_sensitivity", [](const Netlist& netlist, const py::array_t<float, py::array::c_style>& input, float fs,
+                                    SensitivityMetric metric, std::optional<py::array_t<float, py::array::c_style>> reference,
+                                    float fundamental, int harmonics){
+              SensitivitySettings settings;
+              settings.metric = metric;
+              settings.fundamental = fundamental;
+              settings.harmonics = harmonics;
+              if(reference){
+                  if(reference->size() != input.size())
+                      throw std::invalid_argument("reference has to be as long as input");
+                  settings.reference = reference->data();
+              }
+
+              SensitivityReport report;
+              {
+                  py::gil_scoped_release release;
+                  report = adjoint_sensitivity(netlist, input.data(), static_cast<int>(input.size()), fs, settings);
+              }
+
+              py::dict components;
+              for(const auto& c : report.components)
+                  components[py::str(c.name)] = py::make_tuple(c.value, c.gradient, c.relative);
+              return py::make_tuple(report.metric, py::array_t<float>(static_cast<py::ssize_t>(report.output.size()), report.output.data()), components);
+          },
+          "Render input through netlist and return (metric, output, {name: (value, d metric/d value, relative)})",
+          py::arg("netlist"), py::arg("input"), py::arg("fs"), py::arg("metric") = SensitivityMetric::RmsError,
+          py::arg("reference") = py::none(), py::arg("fundamental") = 1000.0f, py::arg("harmonics") = 10);
+
+    py::class_<HarmonicBalance>(m, "HarmonicBalance")
+        .def(py::init([](const Netlist& netlist, int harmonics, float fs, int num_threads){
+                 HarmonicBalanceSettings settings;
+                 settings.harmonics = harmonics;
+                 settings.fs = fs;
+                 settings.num_threads = num_threads;
+                 return HarmonicBalance(netlist, settings);
+             }), py::arg("netlist"), py::arg("harmonics") = 10, py::arg("fs") = 0.0f, py::arg("num_threads") = 0)
+        .def("solve", [](const HarmonicBalance& hb, float frequency, float level){
+                 const HarmonicPoint p = hb.solve(frequency, level);
+                 return py::make_tuple(p.converged, p.thd, p.magnitude);
+             }, "(converged, thd, [dc, f, 2f, ...] peak amplitudes)", py::arg("frequency"), py::arg("level"))
+        .def("distortion_map", [](const HarmonicBalance& hb, const std::vector<float>& frequencies, const std::vector<float>& levels){
+                 std::vector<HarmonicPoint> points;
+                 {
+                     py::gil_scoped_release release;
+                     points = hb.distortion_map(frequencies, levels);
+                 }
+                 py::array_t<double> thd({frequencies.size(), levels.size()});
+                 auto t = thd.mutable_unchecked<2>();
+                 for(std::size_t f = 0; f < frequencies.size(); ++f)
+                     for(std::size_t l = 0; l < levels.size(); ++l){
+                         const HarmonicPoint& p = points[f * levels.size() + l];
+                         t(f, l) = p.converged ? p.thd : std::numeric_limits<double>::quiet_NaN();
+                     }
+                 return thd;
+             }, "THD over a frequency x level grid, nan where the solve didn't converge",
+             py::arg("frequencies"), py::arg("levels"));
+
+    py::enum_<EngineChoice>(m, "EngineChoice")
+        .value("DK", EngineChoice::DK)
+        .value("WDF", EngineChoice::WDF)
+        .value("MNA", EngineChoice::MNA)
+        .value("MNA_MEDIUM", EngineChoice::MNAMedium)
+        .value("MNA_LOW", EngineChoice::MNALow)
+        .value("MNA_TABLE", EngineChoice::MNATable);
+
+    m.def("select_engine", [](const Netlist& netlist, float fs, double max_error, double max_ns_per_sample,
+                              float level, float bandwidth, int oversampling){
+              SelectionBudget budget;
+              budget.max_error = max_error;
+              budget.max_ns_per_sample = max_ns_per_sample;
+              budget.level = level;
+              budget.bandwidth = bandwidth;
+              budget.oversampling = oversampling;
+
+              EngineSelection selection;
+              {
+                  py::gil_scoped_release release;
+                  selection = select_engine(netlist, fs, budget);
+              }
+
+              py::list scores;
+              for(const auto& s : selection.scores)
+                  scores.append(py::make_tuple(s.engine, s.name, s.error, s.max_abs_error, s.ns_per_sample, s.within_budget));
+              return py::make_tuple(selection.engine, selection.found, scores);
+          },
+          "(engine, found, [(engine, name, error, max_abs_error, ns_per_sample, within_budget)] cheapest first)",
+          py::arg("netlist"), py::arg("fs"), py::arg("max_error") = 1e-2, py::arg("max_ns_per_sample") = 0.0,
+          py::arg("level") = 0.5f, py::arg("bandwidth") = 0.25f, py::arg("oversampling") = 8);
+
+    m.def("dk_batch", &rc_batch<DKMethod>,
+          "Render each row of signals in place through DKMethod with params[k] = (resistor, capacitor)",
+          py::arg("signals").noconvert(), py::arg("params"), py::arg("fs"), py::arg("num_threads") = 0);
+
+    m.def("wdf_batch", &rc_batch<RCLowPass>,
+          "Render each row of signals in place through RCLowPass with params[k] = (resistor, capacitor)",
+          py::arg("signals").noconvert(), py::arg("params"), py::arg("fs"), py::arg("num_threads") = 0);
+
+    m.def("dk_preview", [](const py::array_t<float, py::array::c_style>& input, const py::array_t<float, py::array::c_style>& params, float fs){
+              return preview(PreviewModel::DK, input, params, fs);
+          }, "input through DKMethod at every params[k] = (resistor, capacitor) in one pass, (configurations, samples) out",
+          py::arg("input"), py::arg("params"), py::arg("fs"));
+
+    m.def("wdf_preview", [](const py::array_t<float, py::array::c_style>& input, const py::array_t<float, py::array::c_style>& params, float fs){
+              return preview(PreviewModel::WDF, input, params, fs);
+          }, "input through RCLowPass at every params[k] = (resistor, capacitor) in one pass, (configurations, samples) out",
+          py::arg("input"), py::arg("params"), py::arg("fs"));
+
+    m.def("mna_batch", [](Buffer& signals, const py::array_t<float, py::array::c_style>& params, float fs,
+                          const Netlist& netlist, const std::vector<std::string>& names, int num_threads){
+              check_params(signals, params, static_cast<py::ssize_t>(names.size()));
+              //a misspelled name would otherwise render every row at the netlist's own value
+              for(const auto& name : names){
+                  if(netlist.find(name.c_str()) < 0)
+                      throw py::key_error("mna_batch: no element '" + name + "' in the netlist");
+              }
+              const MNA check(netlist); //a circuit that's too big throws here, before any thread starts
+              const float* p = params.data();
+              const auto columns = names.size();
+              run_batch(signals, num_threads, [&]{ return MNA(netlist); }, [&](MNA& e, int k){
+                  //the row's values first: prepare() solves the DC operating point, and a source or bias
+                  //value set after it would start the render on a settling transient
+                  for(std::size_t j = 0; j < columns; ++j)
+                      e.set_value(names[j].c_str(), p[k * columns + j]);
+                  e.prepare(fs);
+              });
+          },
+          "Render each row of signals in place through an MNA of netlist, params[k][j] goes to element names[j]",
+          py::arg("signals").noconvert(), py::arg("params"), py::arg("fs"),
+          py::arg("netlist") = Netlist::rc_lowpass(10000.f, 10e-9f),
+          py::arg("names") = std::vector<std::string>{"R1", "C1"}, py::arg("num_threads") = 0);
+}
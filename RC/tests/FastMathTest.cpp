@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "FastMath.h"
+
+
+/* Every FastMath.h tier against the bounds its header promises
+ * The same sweeps as bench/FastMathBench.cpp (the range the diodes see, pow over x and y together), the
+ * error against a double reference in float ulps and relative. The block versions are what the engines
+ * vectorize, exp and log also go through the runtime tier pick MNA uses. Any NaN or inf fails.
+ */
+namespace {
+
+using fastmath::Accuracy;
+
+constexpr int n = 1 << 16;
+
+double omega_reference(double x){
+    double w = x < 1.0 ? std::exp(x) : x - std::log(x);
+    for(int it = 0; it < 64; ++it)
+        w -= (w + std::log(w) - x) * w/(w + 1.0);
+    return w;
+}
+
+struct Bound {
+    double relative; //max error over |reference|
+    double ulps; //0 = not checked
+};
+
+//FastMath.h's header
+constexpr Bound low {1e-3, 0.0};
+constexpr Bound medium {1e-5, 0.0};
+constexpr Bound full_ulps {1e-6, 5.0};
+constexpr Bound full_relative {2.5e-6, 0.0};
+
+
+struct Sweep {
+    const char* name;
+    double lo;
+    double hi;
+    double (*reference)(double, double);
+    double y_lo = 0.0;
+    double y_hi = 0.0;
+};
+
+int failures = 0;
+
+
+template <Accuracy A>
+void run(const Sweep& f, const float* in, const float* y, float* out){
+    const std::string_view name = f.name;
+    if(name == "exp") fastmath::exp<A>(in, out, n);
+    else if(name == "log") fastmath::log<A>(in, out, n);
+    else if(name == "tanh") fastmath::tanh<A>(in, out, n);
+    else if(name == "pow") fastmath::pow<A>(in, y, out, n);
+    else fastmath::wright_omega<A>(in, out, n);
+}
+
+
+void check(const Sweep& f, const char* how, const Bound& bound, const std::vector<float>& in, const std::vector<float>& y,
+           const std::vector<float>& out){
+    double max_rel = 0.0;
+    double max_ulp = 0.0;
+    int bad = 0;
+    for(int i = 0; i < n; ++i){
+        const double reference = f.reference(static_cast<double>(in[i]), static_cast<double>(y[i]));
+        if(!std::isfinite(reference))
+            continue;
+        if(!std::isfinite(out[i])){
+            ++bad;
+            continue;
+        }
+        const double err = std::fabs(static_cast<double>(out[i]) - reference);
+        const float r = std::fabs(static_cast<float>(reference));
+        max_ulp = std::max(max_ulp, err/static_cast<double>(std::nextafter(r, INFINITY) - r));
+        if(reference != 0.0)
+            max_rel = std::max(max_rel, err/std::fabs(reference));
+    }
+
+    const bool ok = bad == 0 && max_rel < bound.relative && (bound.ulps == 0.0 || max_ulp < bound.ulps);
+    std::printf("%-4s %-6s %-14s max rel %.2e (< %.1e)  max ulp %8.1f", ok ? "ok" : "FAIL", f.name, how, max_rel, bound.relative, max_ulp);
+    if(bound.ulps > 0.0)
+        std::printf(" (< %.0f)", bound.ulps);
+    if(bad > 0)
+        std::printf("  %d not finite", bad);
+    std::printf("\n");
+    failures += !ok;
+}
+
+
+template <Accuracy A>
+void check_tier(const Sweep& f, const char* tier, const Bound& bound, const std::vector<float>& in, const std::vector<float>& y){
+    std::vector<float> out(n);
+    run<A>(f, in.data(), y.data(), out.data());
+    check(f, tier, bound, in, y, out);
+
+    //MNA picks exp/log's tier at runtime
+    const std::string_view name = f.name;
+    if(name == "exp" || name == "log"){
+        for(int i = 0; i < n; ++i)
+            out[i] = name == "exp" ? fastmath::exp(in[i], A) : fastmath::log(in[i], A);
+        check(f, (std::string(tier) + " runtime").c_str(), bound, in, y, out);
+    }
+}
+
+}
+
+
+int main(){
+    const Sweep sweeps[] = {
+        {"exp", -80.0, 80.0, [](double x, double){ return std::exp(x); }},
+        {"log", 1e-30, 1e30, [](double x, double){ return std::log(x); }},
+        {"tanh", -10.0, 10.0, [](double x, double){ return std::tanh(x); }},
+        {"pow", 1e-3, 1e3, [](double x, double y){ return std::pow(x, y); }, -3.0, 3.0},
+        {"omega", -20.0, 40.0, [](double x, double){ return omega_reference(x); }},
+    };
+
+    std::vector<float> in(n);
+    std::vector<float> y(n);
+    for(const auto& f : sweeps){
+        for(int i = 0; i < n; ++i){
+            const double t = static_cast<double>(i)/static_cast<double>(n - 1);
+            in[i] = static_cast<float>(f.lo > 0.0 ? f.lo * std::pow(f.hi/f.lo, t) : f.lo + (f.hi - f.lo) * t);
+            const double u = static_cast<double>((i * 389) % n)/static_cast<double>(n - 1);
+            y[i] = static_cast<float>(f.y_lo + (f.y_hi - f.y_lo) * u);
+        }
+
+        const std::string_view name = f.name;
+        const Bound& full = (name == "pow" || name == "omega") ? full_relative : full_ulps;
+        check_tier<Accuracy::Low>(f, "low", low, in, y);
+        check_tier<Accuracy::Medium>(f, "medium", medium, in, y);
+        check_tier<Accuracy::Full>(f, "full", full, in, y);
+    }
+
+    std::printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "EngineSelector.h"
+#include "MNA.h"
+#include "SpiceParser.h"
+
+
+/* MNA's linear/nonlinear partition against the whole circuit solved at once
+ * MNA runs newton on the diode voltages only, through K = N A^-1 N^T, and puts the diode currents back
+ * through A^-1 N^T. That's exact algebra, so it has to land on what newton on every unknown of the same
+ * trapezoid gets: reference_render() at oversampling 1, in double on the unsimplified circuit, from the same
+ * DC operating point. The difference left is float rounding and newton's stopping tolerance. Both
+ * process_sample() and process_block() get checked, with a DC bias and with diodes that share nodes, and a
+ * circuit the partition can't take (a node only diodes hold) has to be turned away, not run.
+ */
+namespace {
+
+constexpr float fs = 48000.0f;
+constexpr int num_samples = 4800;
+constexpr double tolerance = 1e-4; //volts, on signals of a few volts
+
+int failures = 0;
+
+double input(double t){
+    return 2.5 * std::sin(2.0 * M_PI * 440.0 * t) + 0.8 * std::sin(2.0 * M_PI * 3100.0 * t);
+}
+
+
+void check(const char* name, const char* spice){
+    const Netlist circuit = parse_spice(spice);
+    const std::vector<double> reference = reference_render(circuit, fs, 1, num_samples, input);
+
+    MNA per_sample(circuit);
+    MNA per_block(circuit);
+    per_sample.prepare(fs);
+    per_block.prepare(fs);
+
+    std::vector<float> block(num_samples);
+    for(int n = 0; n < num_samples; ++n)
+        block[static_cast<std::size_t>(n)] = static_cast<float>(input(n/double(fs)));
+    float* channels[] = {block.data()};
+    per_block.process_block(channels, 1, num_samples);
+
+    //a NaN fails the comparison below instead of vanishing from the max
+    auto worse = [](double so_far, double e){ return (e > so_far || e != e) ? e : so_far; };
+    double sample_error = 0.0;
+    double block_error = 0.0;
+    double peak = 0.0;
+    for(int n = 0; n < num_samples; ++n){
+        const double y = reference[static_cast<std::size_t>(n)];
+        sample_error = worse(sample_error, std::fabs(per_sample.process_sample(static_cast<float>(input(n/double(fs)))) - y));
+        block_error = worse(block_error, std::fabs(block[static_cast<std::size_t>(n)] - y));
+        peak = std::max(peak, std::fabs(y));
+    }
+
+    const bool ok = sample_error < tolerance && block_error < tolerance && peak > 0.1;
+    std::printf("%-4s %-24s %d diodes  max error per sample %.2e V, per block %.2e V (< %.0e), output peak %.2f V\n",
+                ok ? "ok" : "FAIL", name, per_sample.num_nonlinear(), sample_error, block_error, tolerance, peak);
+    failures += !ok;
+}
+
+
+void check_rejected(const char* name, const char* spice){
+    bool rejected = false;
+    try{
+        MNA engine(parse_spice(spice));
+    }
+    catch(const std::invalid_argument&){
+        rejected = true;
+    }
+    std::printf("%-4s %-24s rejected\n", rejected ? "ok" : "FAIL", name);
+    failures += !rejected;
+}
+
+}
+
+
+int main(){
+    check("clipper", "VIN 1 0 0 INPUT\nR1 1 2 2.2k\nD1 2 0\nD2 0 2\nC1 2 0 10n\n.output 2\n");
+    check("biased clipper", "VIN 1 0 0 INPUT\nVB 4 0 0.3\nR1 1 2 4.7k\nD1 2 4\nD2 0 2\nC1 2 0 4.7n\n.output 2\n");
+    check("diode ladder", "VIN 1 0 0 INPUT\nR1 1 2 1k\nD1 2 3\nR2 3 0 10k\nC1 3 0 47n\nD2 3 4\nD3 4 3\n"
+                          "R3 4 0 4.7k\nC2 4 0 10n\nC3 2 0 1n\n.output 3\n");
+    check("grounded bridge", "VIN 1 0 0 INPUT\nR1 1 2 1k\nD1 2 3\nD2 0 3\nD3 4 2\nD4 4 0\nR2 3 0 10k\nR3 4 0 10k\n"
+                             "C1 3 4 100n\n.output 3\n");
+    check_rejected("floating bridge", "VIN 1 0 0 INPUT\nR1 1 2 1k\nD1 2 3\nD2 0 3\nD3 4 2\nD4 4 0\nR2 3 4 10k\n"
+                                      "C1 3 4 100n\n.output 3\n");
+
+    std::printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "MNA.h"
+#include "NetlistSimplify.h"
+#include "SpiceParser.h"
+
+
+/* simplify() and the Reduction it records
+ * A knob change replays the recorded steps on the new values instead of simplifying again, so replaying
+ * has to give bit for bit what simplify() gives on the changed netlist, over random netlists that hit
+ * every pass. Parallel sources that disagree have no solution and have to throw. And the simplified
+ * circuit has to sound like the one it came from: MNA with every pass on against MNA with none.
+ */
+namespace {
+
+int failures = 0;
+
+void report(bool ok, const char* what){
+    std::printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    failures += !ok;
+}
+
+
+Netlist random_netlist(std::mt19937& rng){
+    std::uniform_real_distribution<float> u(0.5f, 2.0f);
+    Netlist net;
+    const int nodes = 3 + static_cast<int>(rng() % 12);
+    for(int n = 0; n < nodes; ++n)
+        net.add_node();
+    net.add_voltage_source("VIN", 1, 0, 0.0f, true);
+    if(rng() % 2)
+        net.add_voltage_source("VB", 2, 0, 1.5f);
+    const int count = 4 + static_cast<int>(rng() % 40);
+    for(int k = 0; k < count; ++k){
+        const int a = static_cast<int>(rng() % (nodes + 1));
+        const int b = static_cast<int>(rng() % (nodes + 1));
+        if(a == b)
+            continue;
+        const std::string name = std::to_string(k);
+        switch(rng() % 6){
+            case 0: case 1: case 2: net.add_resistor(("R" + name).c_str(), a, b, 1000.0f * u(rng)); break;
+            case 3: case 4: net.add_capacitor(("C" + name).c_str(), a, b, 1e-8f * u(rng)); break;
+            default: net.add_diode(("D" + name).c_str(), a, b); break;
+        }
+    }
+    if(rng() % 3 == 0)
+        net.add_voltage_source("VS", 3, 4, 0.25f); //a series merge candidate
+    net.set_output(1 + static_cast<int>(rng() % nodes));
+    return net;
+}
+
+
+void check_replay(){
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> u(0.5f, 2.0f);
+    int trials = 0;
+    int mismatched = 0;
+    int invalid = 0;
+    for(int t = 0; t < 3000; ++t){
+        const Netlist net = random_netlist(rng);
+        Reduction reduction;
+        Netlist reduced;
+        try{
+            reduced = simplify(net, {}, &reduction);
+        }
+        catch(const std::invalid_argument&){
+            continue; //a random short across the input, say
+        }
+        if(!reduction.valid()){
+            ++invalid;
+            continue;
+        }
+
+        for(int rep = 0; rep < 5; ++rep){
+            Netlist changed = net;
+            for(int i = 0; i < changed.num_elements(); ++i){
+                Element& e = changed.element(i);
+                if(e.type != ElementType::VoltageSource)
+                    e.value *= u(rng);
+                else if(!e.is_input && std::string(e.name) == "VS")
+                    e.value = u(rng);
+            }
+            const Netlist fresh = simplify(changed);
+            Netlist replayed = reduced;
+            reduction.apply(changed, replayed);
+
+            bool same = fresh.num_elements() == replayed.num_elements();
+            for(int i = 0; same && i < fresh.num_elements(); ++i)
+                same = fresh.element(i).value == replayed.element(i).value;
+            mismatched += !same;
+            ++trials;
+        }
+    }
+    std::printf("     %d replays, %d mismatched, %d reductions too long to record\n", trials, mismatched, invalid);
+    report(trials > 10000 && mismatched == 0 && invalid == 0, "replay matches simplify bit for bit");
+}
+
+
+bool rejects(float v2, bool flipped, bool input1, bool input2){
+    Netlist net;
+    net.add_node();
+    net.add_node();
+    net.add_voltage_source("V1", 1, 0, 1.0f, input1);
+    if(flipped)
+        net.add_voltage_source("V2", 0, 1, v2, input2);
+    else
+        net.add_voltage_source("V2", 1, 0, v2, input2);
+    net.add_resistor("R1", 1, 2, 1000.0f);
+    net.add_capacitor("C1", 2, 0, 1e-6f);
+    net.set_output(2);
+
+    bool threw = true;
+    for(bool merge : {true, false}){
+        SimplifyOptions options;
+        options.merge_sources = merge;
+        try{
+            simplify(net, options);
+            threw = false;
+        }
+        catch(const std::invalid_argument&){
+        }
+    }
+    return threw;
+}
+
+
+void check_parallel_sources(){
+    report(!rejects(1.0f, false, false, false), "equal parallel sources merge");
+    report(!rejects(-1.0f, true, false, false), "a source parallel to its flipped copy merges");
+    report(rejects(2.0f, false, false, false), "different parallel sources throw");
+    report(rejects(1.0f, true, false, false), "opposite parallel sources throw");
+    report(rejects(1.0f, false, true, false), "a bias parallel to the input throws");
+    report(rejects(-1.0f, true, true, true), "the input parallel to its flipped copy throws");
+}
+
+
+void check_sound(const char* name, const char* spice){
+    const Netlist circuit = parse_spice(spice);
+    SimplifyOptions none;
+    none.remove_dangling = false;
+    none.series_parallel = false;
+    none.merge_sources = false;
+    none.kron_reduce = false;
+    MNA simplified(circuit);
+    MNA whole(circuit, none);
+    simplified.prepare(48000.0f);
+    whole.prepare(48000.0f);
+
+    double error = 0.0;
+    double peak = 0.0;
+    for(int n = 0; n < 4800; ++n){
+        const float x = 2.0f * std::sin(0.0576f * static_cast<float>(n)) + 0.5f * std::sin(0.41f * static_cast<float>(n));
+        const float a = simplified.process_sample(x);
+        const float b = whole.process_sample(x);
+        const double e = std::fabs(static_cast<double>(a) - static_cast<double>(b));
+        error = (e > error || e != e) ? e : error;
+        peak = std::max(peak, std::fabs(static_cast<double>(b)));
+    }
+    std::printf("     %s: %d of %d elements left, max difference %.2e V, peak %.2f V\n", name,
+                simplify(circuit).num_elements(), circuit.num_elements(), error, peak);
+    report(error < 1e-4 && peak > 0.1, (std::string(name) + " sounds the same simplified").c_str());
+}
+
+}
+
+
+int main(){
+    check_replay();
+    check_parallel_sources();
+    check_sound("series/parallel RC", "VIN 1 0 0 INPUT\nR1 1 2 1k\nR2 2 3 1.2k\nR3 3 0 47k\nR4 3 0 47k\n"
+                                      "C1 3 0 10n\nC2 3 0 12n\nC3 3 4 1n\nR5 4 5 10k\n.output 3\n");
+    check_sound("kron star", "VIN 1 0 0 INPUT\nR1 1 2 2.2k\nR2 2 3 4.7k\nR3 2 0 10k\nC1 3 0 22n\n"
+                             "D1 3 0\nD2 0 3\n.output 3\n");
+    check_sound("stacked bias", "VIN 1 0 0 INPUT\nVB1 4 0 0.2\nVB2 5 4 0.1\nR1 1 2 4.7k\nD1 2 5\nD2 0 2\n"
+                                "C1 2 0 4.7n\nC2 1 0 1n\n.output 2\n");
+
+    std::printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <vector>
+#include "MNA.h"
+#include "SpiceParser.h"
+
+
+/* rc_netc
+ * Netlist compiler: parses a SPICE file, simplifies it, builds the MNA system, factorizes it at the given
+ * rate, solves the DC operating point, and writes all of it out as a compiled circuit that MNA::load()
+ * takes as is.
+ *     rc_netc circuit.cir circuit.rcc [sample rate, default 48000]
+ * Loading at a different rate still works, prepare() just redoes the coefficients.
+ */
+int main(int argc, char** argv){
+    if(argc < 3 || argc > 4){
+        std::fprintf(stderr, "usage: %s circuit.cir circuit.rcc [sample_rate]\n", argv[0]);
+        return 2;
+    }
+    const float fs = argc == 4 ? static_cast<float>(std::atof(argv[3])) : 48000.0f;
+    if(!(fs > 0.0f)){
+        std::fprintf(stderr, "rc_netc: bad sample rate %s\n", argv[3]);
+        return 2;
+    }
+
+    std::vector<unsigned char> compiled;
+    try{
+        MNA engine(read_spice(argv[1]));
+        engine.prepare(fs);
+        engine.save(compiled);
+        std::printf("%s: %d unknowns, %d diodes after simplification\n", argv[1], engine.num_unknowns(), engine.num_nonlinear());
+    }
+    catch(const std::exception& e){
+        std::fprintf(stderr, "rc_netc: %s\n", e.what());
+        return 1;
+    }
+
+    std::FILE* f = std::fopen(argv[2], "wb");
+    const bool ok = f && std::fwrite(compiled.data(), 1, compiled.size(), f) == compiled.size();
+    if(!f || std::fclose(f) != 0 || !ok){
+        std::fprintf(stderr, "rc_netc: couldn't write %s\n", argv[2]);
+        return 1;
+    }
+    std::printf("wrote %s (%zu bytes)\n", argv[2], compiled.size());
+    return 0;
+}